@@ -63,11 +63,12 @@ const char *upstream_host = nullptr;
 bool timestamped = false;
 bool export_mdns = false;
 const char* mdns_name = "openmrn_hub";
+unsigned num_threads = 0;
 
 void usage(const char *e)
 {
     fprintf(stderr, "Usage: %s [-p port] [-d device_path] [-u upstream_host] "
-                    "[-q upstream_port] [-m] [-n mdns_name] [-t]\n\n",
+                    "[-q upstream_port] [-m] [-n mdns_name] [-t] [-j threads]\n\n",
             e);
     fprintf(stderr, "GridConnect CAN HUB.\nListens to a specific TCP port, "
                     "reads CAN packets from the incoming connections using "
@@ -85,6 +86,10 @@ void usage(const char *e)
             "\t-q upstream_port   is the port number for the upstream hub.\n");
     fprintf(stderr,
             "\t-t prints timestamps for each packet.\n");
+    fprintf(stderr,
+            "\t-j threads   starts this many threads for handling the TCP "
+            "connections. Default is 0, which handles everything on the main "
+            "thread.\n");
 #ifdef HAVE_AVAHI_CLIENT
     fprintf(stderr,
             "\t-m exports the current service on mDNS.\n");
@@ -97,7 +102,7 @@ void usage(const char *e)
 void parse_args(int argc, char *argv[])
 {
     int opt;
-    while ((opt = getopt(argc, argv, "hp:d:u:q:tmn:")) >= 0)
+    while ((opt = getopt(argc, argv, "hp:d:u:q:tmn:j:")) >= 0)
     {
         switch (opt)
         {
@@ -119,6 +124,9 @@ void parse_args(int argc, char *argv[])
             case 't':
                 timestamped = true;
                 break;
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
             case 'm':
                 export_mdns = true;
                 break;
@@ -142,7 +150,7 @@ int appl_main(int argc, char *argv[])
 {
     parse_args(argc, argv);
     GcPacketPrinter packet_printer(&can_hub0, timestamped);
-    GcTcpHub hub(&can_hub0, port);
+    GcTcpHub hub(&can_hub0, port, num_threads);
     vector<std::unique_ptr<ConnectionClient>> connections;
 
 #ifdef HAVE_AVAHI_CLIENT
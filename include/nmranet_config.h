@@ -129,6 +129,10 @@ DECLARE_CONST(num_datagram_registry_entries);
  * happen concurrently. */
 DECLARE_CONST(num_datagram_clients);
 
+/** Number of incoming multi-frame datagrams that can be reassembled
+ * concurrently on a CAN interface. Each takes about 80 bytes of RAM. */
+DECLARE_CONST(num_datagram_reassembly_buffers);
+
 /** Maximum number of memory spaces that can be registered for the MemoryConfig
  * datagram handler. */
 DECLARE_CONST(num_memory_spaces);
@@ -142,5 +146,25 @@ DECLARE_CONST(enable_all_memory_space);
  * standard. */
 DECLARE_CONST(node_init_identify);
 
+/** Maximum number of producer / consumer identified messages per second that
+ * the event service sends in response to Identify Events messages. Set to 0
+ * to send them directly, without rate limiting. */
+DECLARE_CONST(event_identify_rate);
+
+/** Queue priority (0..3, 0 is the most urgent) of the rate limited producer /
+ * consumer identified messages in the interface's write queue. */
+DECLARE_CONST(event_identify_priority);
+
+/** Set to CONSTANT_TRUE to let the rate limited identify responses merge
+ * aligned blocks of producer / consumer identified (unknown state) messages
+ * into range identified messages. */
+DECLARE_CONST(event_identify_merge_ranges);
+
+/** Number of executor threads that the event service dispatches the event
+ * handler calls to. The calls of a given handler always go to the same
+ * thread. Set to 0 to call all handlers on the event service's executor, one
+ * at a time. Only supported on Linux and Mac hosts. */
+DECLARE_CONST(event_dispatch_threads);
+
 
 #endif /* _nmranet_config_h_ */
@@ -0,0 +1,195 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file AccessoryScheduler.cxx
+ *
+ * Track-side stage that interleaves DCC accessory packets with the packets of
+ * the update loop.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#include "dcc/AccessoryScheduler.hxx"
+
+#include "dcc/Packet.hxx"
+
+namespace dcc
+{
+
+AccessoryScheduler::AccessoryScheduler(Service *service,
+    PacketFlowInterface *update_loop, PacketFlowInterface *track_send,
+    unsigned refresh_ratio, unsigned repeat, long long on_time,
+    unsigned max_commands)
+    : StateFlow(service)
+    , updateLoop_(update_loop)
+    , trackSend_(track_send)
+    , refreshRatio_(refresh_ratio)
+    , repeat_(repeat)
+    , onTime_(on_time)
+    , refreshCount_(refresh_ratio)
+    , maxCommands_(max_commands)
+    , pending_(new Command[max_commands])
+    , deactivations_(new Deactivation[max_commands])
+{
+    HASSERT(repeat_ > 0 && repeat_ < 256);
+    HASSERT(maxCommands_ > 0);
+}
+
+AccessoryScheduler::~AccessoryScheduler()
+{
+}
+
+void AccessoryScheduler::send_accessory(unsigned address, bool is_activate)
+{
+    AtomicHolder h(this);
+    ++stats_.commands;
+    if (is_activate)
+    {
+        // A new activation restarts the on time.
+        for (unsigned i = 0; i < numDeactivations_; ++i)
+        {
+            if (deactivations_[i].address == address)
+            {
+                deactivations_[i] = deactivations_[--numDeactivations_];
+                break;
+            }
+        }
+    }
+    if (!add_command(address, is_activate))
+    {
+        ++stats_.dropped;
+    }
+}
+
+bool AccessoryScheduler::add_command(unsigned address, bool is_activate)
+{
+    for (unsigned i = 0; i < numPending_; ++i)
+    {
+        Command &c = pending_at(i);
+        if (c.address == address && c.isActivate == is_activate)
+        {
+            c.remaining = repeat_;
+            ++stats_.coalesced;
+            return true;
+        }
+        if (is_activate && c.isActivate && c.address == (address ^ 1) &&
+            !c.sent)
+        {
+            // The other output of the pair was not activated yet; the new
+            // command supersedes it.
+            c.address = address;
+            ++stats_.coalesced;
+            return true;
+        }
+    }
+    if (numPending_ >= maxCommands_)
+    {
+        return false;
+    }
+    pending_at(numPending_++) = {
+        (uint16_t)address, is_activate, (uint8_t)repeat_, false};
+    return true;
+}
+
+void AccessoryScheduler::queue_due_deactivations(long long now)
+{
+    for (unsigned i = 0; i < numDeactivations_;)
+    {
+        // When the queue is full, the deactivation stays and is retried
+        // at the next slot.
+        if (deactivations_[i].due <= now &&
+            add_command(deactivations_[i].address, false))
+        {
+            deactivations_[i] = deactivations_[--numDeactivations_];
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+StateFlowBase::Action AccessoryScheduler::entry()
+{
+    Command c;
+    bool is_accessory = false;
+    {
+        AtomicHolder h(this);
+        if (onTime_ && numDeactivations_)
+        {
+            queue_due_deactivations(os_get_time_monotonic());
+        }
+        if (numPending_ && refreshCount_ >= refreshRatio_)
+        {
+            is_accessory = true;
+            c = pending_at(0);
+            pendingHead_ = (pendingHead_ + 1) % maxCommands_;
+            --numPending_;
+            c.sent = true;
+            if (--c.remaining)
+            {
+                pending_at(numPending_++) = c;
+            }
+            else if (c.isActivate && onTime_)
+            {
+                if (numDeactivations_ < maxCommands_)
+                {
+                    deactivations_[numDeactivations_++] = {
+                        c.address, os_get_time_monotonic() + onTime_};
+                }
+                else
+                {
+                    // No room to wait for the on time; the slot just freed
+                    // in the queue takes the deactivate command.
+                    add_command(c.address, false);
+                }
+            }
+            refreshCount_ = 0;
+            ++stats_.packets;
+        }
+        else
+        {
+            if (refreshCount_ < refreshRatio_)
+            {
+                ++refreshCount_;
+            }
+            ++stats_.refreshSlots;
+        }
+    }
+    if (!is_accessory)
+    {
+        updateLoop_->send(transfer_message());
+        return exit();
+    }
+    Packet *pkt = message()->data();
+    pkt->clear();
+    pkt->add_dcc_basic_accessory(c.address, c.isActivate);
+    trackSend_->send(transfer_message());
+    return exit();
+}
+
+} // namespace dcc
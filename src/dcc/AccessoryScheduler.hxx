@@ -0,0 +1,216 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file AccessoryScheduler.hxx
+ *
+ * Track-side stage that interleaves DCC accessory packets with the packets of
+ * the update loop.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#ifndef _DCC_ACCESSORYSCHEDULER_HXX_
+#define _DCC_ACCESSORYSCHEDULER_HXX_
+
+#include <memory>
+
+#include "dcc/PacketFlowInterface.hxx"
+#include "executor/StateFlow.hxx"
+
+namespace dcc
+{
+
+/// Schedules DCC basic accessory commands between the packets of the update
+/// loop.
+///
+/// The packet slots (the empty buffers coming from the PoolToQueueFlow) are
+/// sent to this flow instead of the update loop. While accessory commands are
+/// waiting, one slot out of every refresh_ratio + 1 is filled with an
+/// accessory packet and sent to the track directly; all other slots are
+/// forwarded to the update loop. However large a burst of accessory commands
+/// is, the update loop gets at least refresh_ratio slots between two
+/// accessory packets.
+///
+/// Commands wait in arrival order and are coalesced: a command that is the
+/// same as a waiting one only restarts the waiting one's repeat count, and an
+/// activate command for one output of a pair replaces a waiting activate for
+/// the other output that has not been sent yet. Every command is sent repeat
+/// times, round-robin with the other waiting commands; the packets carry no
+/// repeat count for the track driver. If on_time is nonzero, an activate
+/// command is followed by a deactivate command to the same output on_time
+/// after its last packet.
+///
+/// The waiting commands and the scheduled deactivations are kept in arrays
+/// allocated by the constructor, so sending a command does not allocate
+/// memory. When all max_commands entries are taken, new commands are dropped
+/// (and counted), and an activate command that has no room to wait for its
+/// on time is deactivated right away.
+///
+/// Usage:
+///
+/// - instantiate the update loop with the track interface as usual.
+///
+/// - instantiate AccessoryScheduler with the update loop and the track
+///   interface.
+///
+/// - send all packets from the pool to the AccessoryScheduler using a
+///   PoolToQueueFlow.
+///
+/// - send accessory commands with send_accessory(), or give the scheduler to
+///   openlcb::DccAccyConsumer.
+class AccessoryScheduler : public StateFlow<Buffer<dcc::Packet>, QList<1>>
+{
+public:
+    /// Counters about the scheduled commands.
+    struct Stats
+    {
+        /// Number of send_accessory calls.
+        unsigned commands{0};
+        /// Number of commands merged into a waiting command.
+        unsigned coalesced{0};
+        /// Number of accessory packets sent to the track.
+        unsigned packets{0};
+        /// Number of slots forwarded to the update loop.
+        unsigned refreshSlots{0};
+        /// Number of commands dropped because the queue was full.
+        unsigned dropped{0};
+    };
+
+    /// Constructor.
+    /// @param service defines the executor to run on.
+    /// @param update_loop is where the slots not used for accessories are
+    /// forwarded to.
+    /// @param track_send is where the accessory packets are sent.
+    /// @param refresh_ratio is the minimum number of slots forwarded to the
+    /// update loop between two accessory packets.
+    /// @param repeat is how many packets to send for each command.
+    /// @param on_time is the time after which an activated output is
+    /// deactivated, or 0 to leave the outputs to the decoders.
+    /// @param max_commands is how many commands may wait at the same time,
+    /// and how many deactivations may be scheduled at the same time.
+    AccessoryScheduler(Service *service, PacketFlowInterface *update_loop,
+        PacketFlowInterface *track_send, unsigned refresh_ratio = 2,
+        unsigned repeat = 4, long long on_time = 0,
+        unsigned max_commands = 64);
+
+    ~AccessoryScheduler();
+
+    /// Queues a basic accessory command. May be called from any thread.
+    /// @param address is the accessory output address (0..4095), in the
+    /// encoding of Packet::add_dcc_basic_accessory.
+    /// @param is_activate is true for activate (C=1), false for deactivate.
+    void send_accessory(unsigned address, bool is_activate);
+
+    /// @return the number of commands waiting to be sent (not counting the
+    /// scheduled deactivations).
+    size_t pending()
+    {
+        AtomicHolder h(this);
+        return numPending_;
+    }
+
+    /// @return a copy of the counters.
+    Stats get_stats()
+    {
+        AtomicHolder h(this);
+        return stats_;
+    }
+
+    // Entry to the state flow -- when a new packet slot is available.
+    Action entry() OVERRIDE;
+
+private:
+    /// A waiting command.
+    struct Command
+    {
+        /// Accessory output address.
+        uint16_t address;
+        /// true for activate, false for deactivate.
+        bool isActivate;
+        /// How many more packets to send.
+        uint8_t remaining;
+        /// true if at least one packet of this command was sent.
+        bool sent;
+    };
+
+    /// A scheduled deactivation.
+    struct Deactivation
+    {
+        /// Accessory output address.
+        uint16_t address;
+        /// When to queue the deactivate command.
+        long long due;
+    };
+
+    /// Queues the deactivations that are due. Must be called with the lock
+    /// held. @param now is the current time.
+    void queue_due_deactivations(long long now);
+
+    /// Adds a command to the queue, coalescing with the waiting ones. Must be
+    /// called with the lock held. @param address is the output
+    /// address. @param is_activate is true for activate. @return false if
+    /// the queue was full.
+    bool add_command(unsigned address, bool is_activate);
+
+    /// @return the i-th waiting command. @param i is the index from the
+    /// front of the queue.
+    Command &pending_at(unsigned i)
+    {
+        return pending_[(pendingHead_ + i) % maxCommands_];
+    }
+
+    /// Where the slots for the update loop are forwarded to.
+    PacketFlowInterface *updateLoop_;
+    /// Where the accessory packets are sent.
+    PacketFlowInterface *trackSend_;
+    /// Slots to forward to the update loop between accessory packets.
+    unsigned refreshRatio_;
+    /// Packets per command.
+    unsigned repeat_;
+    /// Time from the last activate packet to the deactivate command.
+    long long onTime_;
+    /// Slots forwarded to the update loop since the last accessory packet.
+    unsigned refreshCount_;
+    /// Number of entries in pending_ and in deactivations_.
+    unsigned maxCommands_;
+    /// Ring buffer of the commands waiting to be sent, in round-robin order.
+    std::unique_ptr<Command[]> pending_;
+    /// Index of the front of pending_.
+    unsigned pendingHead_{0};
+    /// Number of commands in pending_.
+    unsigned numPending_{0};
+    /// Deactivations waiting for their due time.
+    std::unique_ptr<Deactivation[]> deactivations_;
+    /// Number of entries used in deactivations_.
+    unsigned numDeactivations_{0};
+    /// Counters.
+    Stats stats_;
+};
+
+} // namespace dcc
+
+#endif // _DCC_ACCESSORYSCHEDULER_HXX_
@@ -35,6 +35,8 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
 
 
 #define LOGLEVEL INFO
@@ -71,4 +73,153 @@ StateFlowBase::Action LocalTrackIfSelect::entry() {
     return write_repeated(&helper_, fd_, p, sizeof(*p), STATE(finish));
 }
 
+#ifdef LOCALTRACKIF_BATCH
+LocalTrackIfBatch::LocalTrackIfBatch(
+    Service *service, int pool_size, unsigned max_batch)
+    : StateFlowBase(service)
+    , pool_(sizeof(Buffer<dcc::Packet>), pool_size)
+{
+    HASSERT(max_batch > 0);
+    if (max_batch > IOV_MAX)
+    {
+        max_batch = IOV_MAX;
+    }
+    iov_.resize(max_batch);
+    written_.reserve(max_batch);
+    start_flow(STATE(wait_for_packets));
+}
+
+LocalTrackIfBatch::~LocalTrackIfBatch()
+{
+    for (auto *b : pending_)
+    {
+        b->unref();
+    }
+}
+
+void LocalTrackIfBatch::send(Buffer<dcc::Packet> *message, unsigned priority)
+{
+    bool wakeup;
+    {
+        AtomicHolder h(this);
+        pending_.push_back(message);
+        wakeup = idle_;
+        idle_ = false;
+    }
+    if (wakeup)
+    {
+        notify();
+    }
+}
+
+StateFlowBase::Action LocalTrackIfBatch::wait_for_packets()
+{
+    AtomicHolder h(this);
+    if (pending_.empty())
+    {
+        idle_ = true;
+        lastPending_ = 0;
+        return wait();
+    }
+    if (pending_.size() < iov_.size() && pending_.size() != lastPending_)
+    {
+        // Packets are still arriving. Lets the sender run before writing, so
+        // that the window fills up and goes out in one call.
+        lastPending_ = pending_.size();
+        return yield_and_call(STATE(wait_for_packets));
+    }
+    lastPending_ = 0;
+    return call_immediately(STATE(try_write));
+}
+
+StateFlowBase::Action LocalTrackIfBatch::try_write()
+{
+    HASSERT(fd_ >= 0);
+    unsigned count = 0;
+    {
+        AtomicHolder h(this);
+        for (auto *b : pending_)
+        {
+            if (count >= iov_.size())
+            {
+                break;
+            }
+            iov_[count].iov_base = b->data();
+            iov_[count].iov_len = sizeof(dcc::Packet);
+            ++count;
+        }
+    }
+    // The first packet may have been partially written by the previous call.
+    iov_[0].iov_base = static_cast<uint8_t *>(iov_[0].iov_base) + firstOffset_;
+    iov_[0].iov_len -= firstOffset_;
+    size_t requested = count * sizeof(dcc::Packet) - firstOffset_;
+    ssize_t ret = ::writev(fd_, iov_.data(), count);
+    size_t done;
+    if (ret >= 0)
+    {
+        done = firstOffset_ + ret;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+        errno == ENOSPC)
+    {
+        ret = 0;
+        done = firstOffset_;
+    }
+    else
+    {
+        // The device will not take these packets. Drops them, so that the
+        // buffers go back to the pool and the update loop is not stuck.
+        LOG_ERROR("LocalTrackIfBatch: writev failed: %s", strerror(errno));
+        {
+            AtomicHolder h(this);
+            ++stats_.writes;
+            for (unsigned i = 0; i < count; ++i)
+            {
+                written_.push_back(pending_.front());
+                pending_.pop_front();
+            }
+            firstOffset_ = 0;
+            stats_.dropped += count;
+        }
+        for (auto *b : written_)
+        {
+            b->unref();
+        }
+        written_.clear();
+        return call_immediately(STATE(wait_for_packets));
+    }
+    {
+        AtomicHolder h(this);
+        ++stats_.writes;
+        while (done >= sizeof(dcc::Packet))
+        {
+            written_.push_back(pending_.front());
+            pending_.pop_front();
+            done -= sizeof(dcc::Packet);
+        }
+        firstOffset_ = done;
+        stats_.packets += written_.size();
+        if ((size_t)ret < requested)
+        {
+            ++stats_.blocked;
+        }
+    }
+    // Releasing the buffers lets the update loop generate the next packets.
+    for (auto *b : written_)
+    {
+        b->unref();
+    }
+    written_.clear();
+    if ((size_t)ret < requested)
+    {
+        // The device is full. Waits until it can take more.
+        helper_.reset(Selectable::WRITE, fd_, Selectable::MAX_PRIO);
+        helper_.set_wakeup(this);
+        service()->executor()->select(&helper_);
+        return wait_and_call(STATE(try_write));
+    }
+    return call_immediately(STATE(wait_for_packets));
+}
+#endif // LOCALTRACKIF_BATCH
+
 } // namespace dcc
@@ -36,9 +36,21 @@
 #ifndef _DCC_LOCALTRACKIF_HXX_
 #define _DCC_LOCALTRACKIF_HXX_
 
+#if defined(__linux__) || defined(__MACH__)
+#include <deque>
+#include <vector>
+#include <sys/uio.h>
+#endif
+
 #include "executor/Executor.hxx"
 #include "executor/StateFlow.hxx"
 #include "dcc/Packet.hxx"
+#include "dcc/PacketFlowInterface.hxx"
+
+#if defined(__linux__) || defined(__MACH__)
+/// Enables LocalTrackIfBatch, which needs writev() from the host OS.
+#define LOCALTRACKIF_BATCH
+#endif
 
 namespace dcc
 {
@@ -114,6 +126,126 @@ protected:
     StateFlowSelectHelper helper_{this};
 };
 
+#ifdef LOCALTRACKIF_BATCH
+/// Flow that accepts dcc::Packet structures and sends them to a local device
+/// driver in batches.
+///
+/// Instead of one write() per packet, the packets are collected and handed to
+/// the device in a single writev() call. A batch is written when it is full,
+/// when the device became writable again, or when no more packets arrived
+/// after the flow yielded the executor once. Packet buffers are held until
+/// the device has accepted them and only then are released to their pool.
+/// When the pool is the one the update loop's PoolToQueueFlow is reading
+/// from, the pool size is the window of packets the update loop generates
+/// ahead of the track, and a device that does not accept more data stops the
+/// generation (backpressure). If the device reports an error, the packets
+/// are dropped instead.
+///
+/// The device must support the select() model and be opened with
+/// O_NONBLOCK. Devices with one-packet-per-write semantics work too, since
+/// every packet is a separate iovec entry.
+///
+/// Usage:
+///
+/// - create a LocalTrackIfBatch with a pool of the desired window size
+///   (e.g. 16), and call set_fd.
+///
+/// - instantiate the update loop, passing the LocalTrackIfBatch pointer.
+///
+/// - send all packets from the pool to the update loop using a
+///   PoolToQueueFlow.
+class LocalTrackIfBatch : public StateFlowBase,
+                          public PacketFlowInterface,
+                          private Atomic
+{
+public:
+    /// Counters about the device writes.
+    struct Stats
+    {
+        /// Number of writev() calls made.
+        unsigned writes{0};
+        /// Number of packets fully written.
+        unsigned packets{0};
+        /// Number of times the device did not accept all offered data.
+        unsigned blocked{0};
+        /// Number of packets dropped because the device returned an error.
+        unsigned dropped{0};
+    };
+
+    /** Constructs a TrackInterface from an fd to the mainline.
+     *
+     * @param service Usually the main executor.
+     * @param pool_size will determine how many packets the current flow's
+     * alloc() will have. This is the window of packets that can be generated
+     * ahead of the track.
+     * @param max_batch is the largest number of packets to hand to the
+     * device in one call.
+     */
+    LocalTrackIfBatch(Service *service, int pool_size, unsigned max_batch = 16);
+
+    ~LocalTrackIfBatch();
+
+    FixedPool *pool() OVERRIDE
+    {
+        return &pool_;
+    }
+
+    /** You must call this function before sending any packets. @param fd is
+     * the file descriptor to /dev/mainline, in nonblocking mode. */
+    void set_fd(int fd)
+    {
+        fd_ = fd;
+    }
+
+    /// Enqueues a packet for the device. May be called from any thread.
+    /// @param message is the packet to send. @param priority is ignored; the
+    /// packets go out in the order they arrived.
+    void send(Buffer<dcc::Packet> *message, unsigned priority) OVERRIDE;
+
+    /// @return the number of packets waiting for the device, including the
+    /// one being written.
+    size_t pending()
+    {
+        AtomicHolder h(this);
+        return pending_.size();
+    }
+
+    /// @return a copy of the counters.
+    Stats get_stats()
+    {
+        AtomicHolder h(this);
+        return stats_;
+    }
+
+private:
+    /// Waits until there are packets to write. @return next action.
+    Action wait_for_packets();
+    /// Offers the pending packets to the device. @return next action.
+    Action try_write();
+
+    /// Packets not yet (fully) accepted by the device, in order.
+    std::deque<Buffer<dcc::Packet> *> pending_;
+    /// Scatter list of the current write.
+    std::vector<struct iovec> iov_;
+    /// Packets fully written by the current write, to be released.
+    std::vector<Buffer<dcc::Packet> *> written_;
+    /// Number of bytes of the first pending packet already written.
+    unsigned firstOffset_{0};
+    /// Size of pending_ when the flow last yielded to let the sender run.
+    size_t lastPending_{0};
+    /// True if the flow is waiting for send() to wake it up.
+    bool idle_{false};
+    /// Filedes of the device to which we are writing the generated packets.
+    int fd_{-1};
+    /// Counters.
+    Stats stats_;
+    /// Packet pool from which to allocate packets.
+    FixedPool pool_;
+    /// Helper for waiting for the device to become writable.
+    StateFlowSelectHelper helper_{this};
+};
+#endif // LOCALTRACKIF_BATCH
+
 } // namespace dcc
 
 #endif // _DCC_LOCALTRACKIF_HXX_
@@ -0,0 +1,305 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file PriorityUpdateLoop.cxx
+ *
+ * Control flow central to the command station: it sends out the packets for
+ * recently changed trains with priority, and refreshes the trains in the
+ * background.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#include "dcc/PriorityUpdateLoop.hxx"
+
+#include <algorithm>
+
+#include "dcc/Packet.hxx"
+#include "dcc/PacketSource.hxx"
+
+namespace dcc
+{
+
+PriorityUpdateLoop::PriorityUpdateLoop(Service *service,
+    PacketFlowInterface *track_send, long long min_gap, long long hot_period,
+    unsigned max_sources)
+    : StateFlow(service)
+    , trackSend_(track_send)
+    , nextRefreshIndex_(0)
+    , maxSources_(max_sources)
+    , hot_(new HotEntry[max_sources])
+    , numHot_(0)
+    , nextHotIndex_(0)
+    , hotCount_(0)
+    , urgent_(new UrgentEntry[max_sources])
+    , numUrgent_(0)
+    , urgentCount_(0)
+    , sent_(new SentEntry[max_sources])
+    , sentHead_(0)
+    , numSent_(0)
+    , minGap_(min_gap)
+    , hotPeriod_(hot_period)
+{
+    HASSERT(maxSources_ > 0);
+    refreshSources_.reserve(max_sources);
+}
+
+PriorityUpdateLoop::~PriorityUpdateLoop()
+{
+}
+
+void PriorityUpdateLoop::add_refresh_source(dcc::PacketSource *source)
+{
+    AtomicHolder h(this);
+    refreshSources_.push_back(source);
+}
+
+void PriorityUpdateLoop::remove_refresh_source(dcc::PacketSource *source)
+{
+    AtomicHolder h(this);
+    refreshSources_.erase(
+        std::remove(refreshSources_.begin(), refreshSources_.end(), source),
+        refreshSources_.end());
+    for (unsigned i = 0; i < numHot_; ++i)
+    {
+        if (hot_[i].source == source)
+        {
+            erase_at(hot_.get(), &numHot_, i);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < numUrgent_;)
+    {
+        if (urgent_[i].source == source)
+        {
+            erase_at(urgent_.get(), &numUrgent_, i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    for (unsigned i = 0; i < numSent_; ++i)
+    {
+        if (sent_at(i).source == source)
+        {
+            // Entries are kept in place; the source will not be found
+            // anymore.
+            sent_at(i).source = nullptr;
+            break;
+        }
+    }
+}
+
+void PriorityUpdateLoop::notify_update(PacketSource *source, unsigned code)
+{
+    long long now = os_get_time_monotonic();
+    AtomicHolder h(this);
+    bool found = false;
+    for (unsigned i = 0; i < numUrgent_; ++i)
+    {
+        if (urgent_[i].source == source && urgent_[i].code == code)
+        {
+            // The packet will be generated from the latest state anyway.
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+    {
+        if (numUrgent_ < maxSources_)
+        {
+            urgent_[numUrgent_++] = {source, code, now};
+        }
+        else
+        {
+            ++stats_.dropped;
+        }
+    }
+    for (unsigned i = 0; i < numHot_; ++i)
+    {
+        if (hot_[i].source == source)
+        {
+            hot_[i].lastUpdate = now;
+            return;
+        }
+    }
+    if (numHot_ < maxSources_)
+    {
+        hot_[numHot_++] = {source, now};
+    }
+}
+
+void PriorityUpdateLoop::prune_sent(long long now)
+{
+    while (numSent_ && now - sent_at(0).sendTime >= minGap_)
+    {
+        sentHead_ = (sentHead_ + 1) % maxSources_;
+        --numSent_;
+    }
+}
+
+PacketSource *PriorityUpdateLoop::pick_urgent(long long now, unsigned *code)
+{
+    for (unsigned i = 0; i < numUrgent_; ++i)
+    {
+        if (eligible(urgent_[i].source))
+        {
+            PacketSource *source = urgent_[i].source;
+            *code = urgent_[i].code;
+            record_latency(now - urgent_[i].enqueueTime);
+            erase_at(urgent_.get(), &numUrgent_, i);
+            return source;
+        }
+    }
+    return nullptr;
+}
+
+PacketSource *PriorityUpdateLoop::next_hot(long long now)
+{
+    while (numHot_)
+    {
+        if (nextHotIndex_ >= numHot_)
+        {
+            nextHotIndex_ = 0;
+        }
+        if (now - hot_[nextHotIndex_].lastUpdate > hotPeriod_)
+        {
+            erase_at(hot_.get(), &numHot_, nextHotIndex_);
+            continue;
+        }
+        return hot_[nextHotIndex_++].source;
+    }
+    return nullptr;
+}
+
+PacketSource *PriorityUpdateLoop::next_cold()
+{
+    if (refreshSources_.empty())
+    {
+        return nullptr;
+    }
+    if (nextRefreshIndex_ >= refreshSources_.size())
+    {
+        nextRefreshIndex_ = 0;
+    }
+    return refreshSources_[nextRefreshIndex_++];
+}
+
+PacketSource *PriorityUpdateLoop::pick_refresh(long long now)
+{
+    PacketSource *source = nullptr;
+    if (hotCount_ < HOT_WEIGHT)
+    {
+        source = next_hot(now);
+        if (source && eligible(source))
+        {
+            ++hotCount_;
+            return source;
+        }
+    }
+    // The background sources that were sent a packet within min_gap are
+    // skipped; if there is anyone else, we take them instead of an idle
+    // packet.
+    for (unsigned i = 0; i < refreshSources_.size(); ++i)
+    {
+        source = next_cold();
+        if (eligible(source))
+        {
+            hotCount_ = 0;
+            return source;
+        }
+    }
+    return nullptr;
+}
+
+void PriorityUpdateLoop::record_latency(long long latency)
+{
+    ++stats_.count;
+    stats_.totalNsec += latency;
+    if (latency > stats_.maxNsec)
+    {
+        stats_.maxNsec = latency;
+    }
+    unsigned bucket = 0;
+    for (long long limit = MSEC_TO_NSEC(1);
+         latency >= limit && bucket < NUM_LATENCY_BUCKETS - 1; limit <<= 1)
+    {
+        ++bucket;
+    }
+    ++stats_.buckets[bucket];
+}
+
+StateFlowBase::Action PriorityUpdateLoop::entry()
+{
+    long long now = os_get_time_monotonic();
+    PacketSource *source = nullptr;
+    unsigned code = 0;
+    {
+        AtomicHolder h(this);
+        prune_sent(now);
+        if (urgentCount_ < MAX_URGENT_BURST || refreshSources_.empty())
+        {
+            source = pick_urgent(now, &code);
+        }
+        if (source)
+        {
+            ++urgentCount_;
+        }
+        else
+        {
+            urgentCount_ = 0;
+            source = pick_refresh(now);
+        }
+        if (source && minGap_ > 0)
+        {
+            if (numSent_ == maxSources_)
+            {
+                // Forgets the oldest packet; more sources than max_sources
+                // are sent packets within min_gap.
+                sentHead_ = (sentHead_ + 1) % maxSources_;
+                --numSent_;
+            }
+            sent_at(numSent_++) = {source, now};
+        }
+    }
+    if (source)
+    {
+        source->get_next_packet(code, message()->data());
+    }
+    else
+    {
+        // Nobody can be sent a packet right now, or there are no locomotives
+        // at all. We send an idle packet.
+        message()->data()->set_dcc_idle();
+    }
+    // We pass on the filled packet to the track processor.
+    trackSend_->send(transfer_message());
+    return exit();
+}
+
+} // namespace dcc
@@ -0,0 +1,314 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file PriorityUpdateLoop.hxx
+ *
+ * Control flow central to the command station: it sends out the packets for
+ * recently changed trains with priority, and refreshes the trains in the
+ * background.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#ifndef _DCC_PRIORITYUPDATELOOP_HXX_
+#define _DCC_PRIORITYUPDATELOOP_HXX_
+
+#include <memory>
+#include <vector>
+
+#include "dcc/UpdateLoop.hxx"
+#include "executor/StateFlow.hxx"
+
+namespace dcc
+{
+
+/// Implementation of a command station update loop with prioritization.
+///
+/// Every outgoing packet slot is filled from one of three places, in this
+/// order:
+///
+/// - the urgent queue: sources that called notify_update, in the order of the
+///   calls. Repeated notifications with the same code are coalesced while
+///   they are waiting.
+///
+/// - the hot refresh list: sources that were updated in the last
+///   hot_period. These get HOT_WEIGHT refresh packets for every packet of
+///   the background refresh.
+///
+/// - the background refresh: strict round-robin over all refresh sources.
+///
+/// Starvation is bounded: after MAX_URGENT_BURST consecutive urgent packets
+/// one refresh packet is sent, and after HOT_WEIGHT consecutive hot refresh
+/// packets one background refresh packet is sent. With N refresh sources
+/// every source gets a refresh packet at least once every
+/// N * (HOT_WEIGHT + 1) * (MAX_URGENT_BURST + 1) packets.
+///
+/// The loop never sends two packets to the same source within min_gap, even
+/// if packets to other sources were sent in between; an idle packet is sent
+/// instead if there is no other candidate.
+///
+/// The time between notify_update and the urgent packet being handed to the
+/// track driver is collected in @ref LatencyStats.
+///
+/// The urgent queue, the hot list and the recently sent list are arrays
+/// allocated by the constructor, so notify_update does not allocate memory.
+/// A notification that finds the urgent queue full is dropped (and counted);
+/// the source still gets its refresh packets.
+///
+/// Usage is the same as @ref SimpleUpdateLoop.
+class PriorityUpdateLoop : public StateFlow<Buffer<dcc::Packet>, QList<1>>,
+                           private UpdateLoopBase
+{
+public:
+    /// How many hot refresh packets to send for every background refresh
+    /// packet.
+    static const unsigned HOT_WEIGHT = 3;
+    /// How many urgent packets may be sent back-to-back before a refresh
+    /// packet is sent.
+    static const unsigned MAX_URGENT_BURST = 4;
+    /// Number of buckets in the latency histogram.
+    static const unsigned NUM_LATENCY_BUCKETS = 12;
+
+    /// Statistics about the command-to-track latency of urgent packets.
+    struct LatencyStats
+    {
+        LatencyStats()
+        {
+            clear();
+        }
+
+        /// Resets all counters.
+        void clear()
+        {
+            count = 0;
+            dropped = 0;
+            totalNsec = 0;
+            maxNsec = 0;
+            for (unsigned i = 0; i < NUM_LATENCY_BUCKETS; ++i)
+            {
+                buckets[i] = 0;
+            }
+        }
+
+        /// Number of urgent packets sent.
+        unsigned count;
+        /// Number of notifications dropped because the urgent queue was
+        /// full.
+        unsigned dropped;
+        /// Sum of the latencies of all urgent packets.
+        long long totalNsec;
+        /// Largest latency seen.
+        long long maxNsec;
+        /// Histogram of the latencies. Bucket 0 counts latencies below 1
+        /// msec, bucket i counts latencies between 2^(i-1) and 2^i msec. The
+        /// last bucket counts everything larger.
+        unsigned buckets[NUM_LATENCY_BUCKETS];
+    };
+
+    /// Constructor.
+    /// @param service defines the executor to run on.
+    /// @param track_send is where the generated packets are sent.
+    /// @param min_gap is the minimum time between two packets sent to the
+    /// same source.
+    /// @param hot_period is how long a source gets weighted refresh after it
+    /// was updated.
+    /// @param max_sources is the size of the urgent queue and of the hot
+    /// list, and the number of refresh sources that can be added without
+    /// allocating memory.
+    PriorityUpdateLoop(Service *service, PacketFlowInterface *track_send,
+        long long min_gap = MSEC_TO_NSEC(5),
+        long long hot_period = SEC_TO_NSEC(5), unsigned max_sources = 64);
+    ~PriorityUpdateLoop();
+
+    /** Adds a new refresh source to the background refresh packets. */
+    void add_refresh_source(dcc::PacketSource *source) OVERRIDE;
+
+    /** Deletes a packet refresh source. */
+    void remove_refresh_source(dcc::PacketSource *source) OVERRIDE;
+
+    /** Queues an urgent packet for a source and marks the source hot. */
+    void notify_update(PacketSource *source, unsigned code) OVERRIDE;
+
+    /// @return a copy of the latency statistics.
+    LatencyStats get_latency_stats()
+    {
+        AtomicHolder h(this);
+        return stats_;
+    }
+
+    /// Resets the latency statistics.
+    void clear_latency_stats()
+    {
+        AtomicHolder h(this);
+        stats_.clear();
+    }
+
+    // Entry to the state flow -- when a new packet needs to be sent.
+    Action entry() OVERRIDE;
+
+private:
+    /// A pending notification.
+    struct UrgentEntry
+    {
+        /// Who sent the notification.
+        PacketSource *source;
+        /// Update code to pass to get_next_packet.
+        unsigned code;
+        /// When the (first) notification arrived.
+        long long enqueueTime;
+    };
+
+    /// A packet sent within the last min_gap.
+    struct SentEntry
+    {
+        /// Where the packet came from.
+        PacketSource *source;
+        /// When the packet was sent.
+        long long sendTime;
+    };
+
+    /// A recently updated source.
+    struct HotEntry
+    {
+        /// The source that was updated.
+        PacketSource *source;
+        /// When the last notification arrived.
+        long long lastUpdate;
+    };
+
+    /// @return true if it is allowed to send a packet to source now.
+    /// Must be called with the lock held, after prune_sent(now).
+    bool eligible(PacketSource *source)
+    {
+        for (unsigned i = 0; i < numSent_; ++i)
+        {
+            if (sent_at(i).source == source)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @return the i-th entry of sent_, oldest first. Must be called with
+    /// the lock held.
+    SentEntry &sent_at(unsigned i)
+    {
+        return sent_[(sentHead_ + i) % maxSources_];
+    }
+
+    /// Drops the entries from sent_ that are older than min_gap. Must be
+    /// called with the lock held.
+    /// @param now is the current time.
+    void prune_sent(long long now);
+
+    /// Takes the first eligible entry off the urgent queue. Must be called
+    /// with the lock held.
+    /// @param now is the current time.
+    /// @param code will be filled with the update code.
+    /// @return the source, or nullptr if no urgent entry can be sent now.
+    PacketSource *pick_urgent(long long now, unsigned *code);
+
+    /// Chooses a source for a refresh packet. Must be called with the lock
+    /// held.
+    /// @param now is the current time.
+    /// @return the source, or nullptr if no source can be sent now.
+    PacketSource *pick_refresh(long long now);
+
+    /// Returns the next hot source, dropping the entries that are not hot
+    /// anymore. Must be called with the lock held.
+    /// @param now is the current time.
+    PacketSource *next_hot(long long now);
+
+    /// Returns the next source of the background refresh. Must be called
+    /// with the lock held.
+    PacketSource *next_cold();
+
+    /// Removes an entry from an array, keeping the order of the others.
+    /// @param array is the array. @param count is the number of entries
+    /// used, will be decremented. @param i is the index of the entry to
+    /// remove.
+    template <class T>
+    static void erase_at(T *array, unsigned *count, unsigned i)
+    {
+        for (--*count; i < *count; ++i)
+        {
+            array[i] = array[i + 1];
+        }
+    }
+
+    /// Adds a sample to the latency statistics.
+    /// @param latency is the time from notification to sending, in nsec.
+    void record_latency(long long latency);
+
+    // Place where we forward the packets filled in.
+    PacketFlowInterface *trackSend_;
+
+    /// Packet sources to ask about refreshing data periodically.
+    std::vector<dcc::PacketSource *> refreshSources_;
+    /// Offset in the refreshSources_ vector for the next loco to send.
+    size_t nextRefreshIndex_;
+
+    /// Size of the urgent_, hot_ and sent_ arrays.
+    unsigned maxSources_;
+    /// Sources that were updated recently.
+    std::unique_ptr<HotEntry[]> hot_;
+    /// Number of entries used in hot_.
+    unsigned numHot_;
+    /// Offset in the hot_ vector for the next hot refresh.
+    size_t nextHotIndex_;
+    /// How many hot refresh packets were sent since the last background
+    /// refresh.
+    unsigned hotCount_;
+
+    /// Pending notifications in arrival order.
+    std::unique_ptr<UrgentEntry[]> urgent_;
+    /// Number of entries used in urgent_.
+    unsigned numUrgent_;
+    /// How many urgent packets were sent since the last refresh packet.
+    unsigned urgentCount_;
+
+    /// Ring buffer of the non-idle packets sent within the last min_gap,
+    /// oldest first. There is at most one entry per source.
+    std::unique_ptr<SentEntry[]> sent_;
+    /// Index of the oldest entry in sent_.
+    unsigned sentHead_;
+    /// Number of entries used in sent_.
+    unsigned numSent_;
+
+    /// Minimum time between two packets to the same source.
+    long long minGap_;
+    /// How long a source stays on the hot list after an update.
+    long long hotPeriod_;
+
+    /// Command-to-track latency of urgent packets.
+    LatencyStats stats_;
+};
+
+} // namespace dcc
+
+#endif // _DCC_PRIORITYUPDATELOOP_HXX_
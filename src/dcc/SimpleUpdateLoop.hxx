@@ -51,7 +51,8 @@ namespace dcc
 /// Usage:
 ///
 /// - Instantiate a state flow for sending outgoing dcc packets to the command
-///  station driver, usually dcc::LocalTrackIf.
+///  station driver, usually dcc::LocalTrackIf, or dcc::LocalTrackIfBatch on
+///  hosts.
 ///
 /// - create a FixedPool of dcc::Packets of a given size (usually 2 is enough).
 ///
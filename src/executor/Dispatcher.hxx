@@ -36,10 +36,22 @@
 #define _EXECUTOR_DISPATCHER_HXX_
 
 #include <vector>
+#if defined(__linux__) || defined(__MACH__)
+#include <algorithm>
+#include <unordered_map>
+#endif
 
 #include "executor/Notifiable.hxx"
 #include "executor/StateFlow.hxx"
 
+#if defined(__linux__) || defined(__MACH__)
+/// Keeps a hash index of the registered handlers per distinct mask, so that
+/// finding the handlers of a message costs one lookup per distinct mask
+/// instead of a match test per handler. Only on hosts, where the memory of
+/// the index is not a concern.
+#define DISPATCH_FLOW_INDEX
+#endif
+
 /**
    This class takes registrations of StateFlows for incoming messages. When a
    message shows up, all the Flows that match that message will be
@@ -65,6 +77,14 @@ public:
     /** @returns the number of handlers registered. */
     size_t size();
 
+#ifdef DISPATCH_FLOW_INDEX
+    /** Selects between the indexed lookup (default) and testing every
+     * handler for every message. Must not be called while a message is being
+     * dispatched. Negated dispatchers (hubs) always test every handler.
+     * @param indexed true to use the index. */
+    void set_indexed(bool indexed);
+#endif
+
 protected:
     /// Proxy the identifier type for customers to use.
     typedef uint32_t ID;
@@ -172,6 +192,45 @@ private:
         }
     };
 
+    /// @return the number of handlers the current iteration has to look at.
+    size_t num_candidates();
+
+    /// @return the handler at a given position of the current iteration, or
+    /// nullptr if it has been unregistered. @param i is the position.
+    HandlerInfo *candidate(size_t i);
+
+#ifdef DISPATCH_FLOW_INDEX
+    /// @return true if the index is used for matching.
+    bool use_index()
+    {
+        return indexed_ && !negateMatch_;
+    }
+
+    /// Adds a handler to the index. @param idx is the handler's position in
+    /// handlers_.
+    void index_add(size_t idx);
+
+    /// Removes a handler from the index. @param idx is the handler's position
+    /// in handlers_.
+    void index_remove(size_t idx);
+
+    /// Handlers registered with the same mask.
+    struct MaskGroup
+    {
+        /// Mask of all handlers in this group.
+        ID mask;
+        /// Positions in handlers_, by the masked registration ID.
+        std::unordered_map<ID, vector<size_t>> byId;
+    };
+
+    /// One entry for every distinct mask among the registered handlers.
+    vector<MaskGroup> groups_;
+    /// Positions in handlers_ matching the current message, ascending.
+    vector<size_t> matches_;
+    /// true if the index is used for matching.
+    bool indexed_;
+#endif
+
     /// Registered handlers.
     vector<HandlerInfo> handlers_;
 
@@ -308,6 +367,9 @@ template <int NUM_PRIO>
 DispatchFlowBase<NUM_PRIO>::DispatchFlowBase(Service *service)
     : UntypedStateFlow<QList<NUM_PRIO>>(service)
     , negateMatch_(false)
+#ifdef DISPATCH_FLOW_INDEX
+    , indexed_(true)
+#endif
 {
 }
 
@@ -332,6 +394,104 @@ size_t DispatchFlowBase<NUM_PRIO>::size()
     return ret;
 }
 
+#ifdef DISPATCH_FLOW_INDEX
+template<int NUM_PRIO>
+void DispatchFlowBase<NUM_PRIO>::set_indexed(bool indexed)
+{
+    OSMutexLock h(&lock_);
+    groups_.clear();
+    indexed_ = indexed;
+    for (size_t i = 0; i < handlers_.size(); ++i)
+    {
+        if (handlers_[i].handler)
+        {
+            index_add(i);
+        }
+    }
+}
+
+template<int NUM_PRIO>
+void DispatchFlowBase<NUM_PRIO>::index_add(size_t idx)
+{
+    if (!use_index())
+    {
+        return;
+    }
+    auto &h = handlers_[idx];
+    auto it = groups_.begin();
+    while (it != groups_.end() && it->mask != h.mask)
+    {
+        ++it;
+    }
+    if (it == groups_.end())
+    {
+        groups_.emplace_back();
+        it = groups_.end() - 1;
+        it->mask = h.mask;
+    }
+    it->byId[h.id & h.mask].push_back(idx);
+}
+
+template<int NUM_PRIO>
+void DispatchFlowBase<NUM_PRIO>::index_remove(size_t idx)
+{
+    if (!use_index())
+    {
+        return;
+    }
+    auto &h = handlers_[idx];
+    for (auto it = groups_.begin(); it != groups_.end(); ++it)
+    {
+        if (it->mask != h.mask)
+        {
+            continue;
+        }
+        auto bucket = it->byId.find(h.id & h.mask);
+        HASSERT(bucket != it->byId.end());
+        auto &v = bucket->second;
+        v.erase(std::find(v.begin(), v.end(), idx));
+        if (v.empty())
+        {
+            it->byId.erase(bucket);
+            if (it->byId.empty())
+            {
+                groups_.erase(it);
+            }
+        }
+        return;
+    }
+}
+#endif
+
+template<int NUM_PRIO>
+size_t DispatchFlowBase<NUM_PRIO>::num_candidates()
+{
+#ifdef DISPATCH_FLOW_INDEX
+    if (use_index())
+    {
+        return matches_.size();
+    }
+#endif
+    return handlers_.size();
+}
+
+template<int NUM_PRIO>
+typename DispatchFlowBase<NUM_PRIO>::HandlerInfo *
+DispatchFlowBase<NUM_PRIO>::candidate(size_t i)
+{
+#ifdef DISPATCH_FLOW_INDEX
+    if (use_index())
+    {
+        i = matches_[i];
+    }
+#endif
+    if (i >= handlers_.size() || !handlers_[i].handler)
+    {
+        return nullptr;
+    }
+    return &handlers_[i];
+}
+
 template<int NUM_PRIO>
 void DispatchFlowBase<NUM_PRIO>::register_handler(UntypedHandler *handler,
                                                   ID id, ID mask)
@@ -349,6 +509,9 @@ void DispatchFlowBase<NUM_PRIO>::register_handler(UntypedHandler *handler,
     handlers_[idx].handler = handler;
     handlers_[idx].id = id;
     handlers_[idx].mask = mask;
+#ifdef DISPATCH_FLOW_INDEX
+    index_add(idx);
+#endif
 }
 
 template<int NUM_PRIO>
@@ -369,6 +532,9 @@ DispatchFlowBase<NUM_PRIO>::unregister_handler(UntypedHandler *handler,
     if (lastHandlerToCall_ == handlers_[idx].handler) {
         lastHandlerToCall_ = nullptr;
     }
+#ifdef DISPATCH_FLOW_INDEX
+    index_remove(idx);
+#endif
     handlers_[idx].handler = nullptr;
     if (idx == handlers_.size() - 1)
     {
@@ -385,6 +551,9 @@ void DispatchFlowBase<NUM_PRIO>::unregister_handler_all(
     {
         if (handlers_[i].handler == handler)
         {
+#ifdef DISPATCH_FLOW_INDEX
+            index_remove(i);
+#endif
             handlers_[i].handler = nullptr;
         }
     }
@@ -399,6 +568,25 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::entry()
 {
     currentIndex_ = 0;
     lastHandlerToCall_ = nullptr;
+#ifdef DISPATCH_FLOW_INDEX
+    if (use_index())
+    {
+        ID id = get_message_id();
+        OSMutexLock l(&lock_);
+        matches_.clear();
+        for (auto &g : groups_)
+        {
+            auto it = g.byId.find(id & g.mask);
+            if (it != g.byId.end())
+            {
+                matches_.insert(
+                    matches_.end(), it->second.begin(), it->second.end());
+            }
+        }
+        // Keeps the same call order as the linear scan.
+        std::sort(matches_.begin(), matches_.end());
+    }
+#endif
     return call_immediately(STATE(iterate));
 }
 
@@ -408,13 +596,14 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
     ID id = get_message_id();
     {
         OSMutexLock l(&lock_);
-        for (; currentIndex_ < handlers_.size(); ++currentIndex_)
+        for (; currentIndex_ < num_candidates(); ++currentIndex_)
         {
-            auto &h = handlers_[currentIndex_];
-            if (!h.handler)
+            auto *hp = candidate(currentIndex_);
+            if (!hp)
             {
                 continue;
             }
+            auto &h = *hp;
             if (negateMatch_ && (id & h.mask) == (h.id & h.mask))
             {
                 continue;
@@ -426,7 +615,7 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
             break;
         }
     }
-    if (currentIndex_ >= handlers_.size())
+    if (currentIndex_ >= num_candidates())
     {
         return call_immediately(STATE(iteration_done));
     }
@@ -434,7 +623,8 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
     if (!lastHandlerToCall_)
     {
         // This was the first we found.
-        lastHandlerToCall_ = handlers_[currentIndex_].handler;
+        HandlerInfo *h = candidate(currentIndex_);
+        lastHandlerToCall_ = h ? h->handler : nullptr;
         ++currentIndex_;
         return again();
     }
@@ -446,7 +636,8 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
 template<int NUM_PRIO>
 StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::clone_done()
 {
-    lastHandlerToCall_ = handlers_[currentIndex_].handler;
+    HandlerInfo *h = candidate(currentIndex_);
+    lastHandlerToCall_ = h ? h->handler : nullptr;
     ++currentIndex_;
     return call_immediately(STATE(iterate));
 }
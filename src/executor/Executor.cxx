@@ -35,6 +35,8 @@
 
 #include "executor/Executor.hxx"
 
+#include <errno.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef __WINNT__
@@ -90,10 +92,22 @@ ExecutorBase::ExecutorBase()
         next_ = list;
         list = this;
     }
+#ifdef OSSELECTWAKEUP_EPOLL
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    HASSERT(epollFd_ >= 0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    // The wakeup eventfd is marked with fd == -1.
+    ev.data.u64 = 0;
+    ev.data.fd = -1;
+    HASSERT(!epoll_ctl(
+        epollFd_, EPOLL_CTL_ADD, selectHelper_.enable_eventfd(), &ev));
+#else
     FD_ZERO(&selectRead_);
     FD_ZERO(&selectWrite_);
     FD_ZERO(&selectExcept_);
     selectNFds_ = 0;
+#endif
 }
 
 /** Lookup an executor by its name.
@@ -326,6 +340,132 @@ void *ExecutorBase::entry()
     return NULL;
 }
 
+#ifdef OSSELECTWAKEUP_EPOLL
+
+void ExecutorBase::select(Selectable *job)
+{
+    int fd = job->fd_;
+    Selectable **slot = epoll_job(fd, job->type());
+    if (*slot)
+    {
+        LOG(FATAL,
+            "Multiple Selectables are waiting for the same fd %d type %u", fd,
+            job->selectType_);
+    }
+    Selectable **jobs = epollSlots_[fd].jobs;
+    bool registered = jobs[0] || jobs[1] || jobs[2];
+    *slot = job;
+    epoll_update(fd, registered);
+}
+
+bool ExecutorBase::is_selected(Selectable *job)
+{
+    unsigned fd = job->fd_;
+    return fd < epollSlots_.size() &&
+        epollSlots_[fd].jobs[job->type() - 1] != nullptr;
+}
+
+void ExecutorBase::unselect(Selectable *job)
+{
+    int fd = job->fd_;
+    if (!is_selected(job))
+    {
+        LOG(FATAL, "Tried to remove a non-active selectable: fd %d type %u", fd,
+            job->selectType_);
+    }
+    *epoll_job(fd, job->type()) = nullptr;
+    epoll_update(fd, true);
+}
+
+void ExecutorBase::epoll_update(int fd, bool registered)
+{
+    Selectable **jobs = epollSlots_[fd].jobs;
+    struct epoll_event ev;
+    ev.events = (jobs[Selectable::READ - 1] ? EPOLLIN : 0) |
+        (jobs[Selectable::WRITE - 1] ? EPOLLOUT : 0) |
+        (jobs[Selectable::EXCEPT - 1] ? EPOLLPRI : 0);
+    ev.data.u64 = 0;
+    ev.data.fd = fd;
+    if (!ev.events)
+    {
+        if (registered)
+        {
+            // Fails if the fd was closed already, which is fine.
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &ev);
+        }
+        return;
+    }
+    if (!epoll_ctl(epollFd_, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd,
+            &ev))
+    {
+        return;
+    }
+    if (errno == EEXIST)
+    {
+        // Stale registration of a closed fd that had a duplicate.
+        HASSERT(!epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev));
+        return;
+    }
+    if (errno == EPERM)
+    {
+        // Regular files and such do not support epoll; select would report
+        // them ready all the time.
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            if (jobs[i])
+            {
+                add(jobs[i]->wakeup_, jobs[i]->priority_);
+                jobs[i] = nullptr;
+            }
+        }
+        return;
+    }
+    LOG(FATAL, "epoll_ctl failed for fd %d: %s", fd, strerror(errno));
+}
+
+void ExecutorBase::wait_with_select(long long wait_length)
+{
+    if (!empty())
+    {
+        wait_length = 0;
+    }
+    long long max_sleep = MSEC_TO_NSEC(config_executor_max_sleep_msec());
+    if (wait_length > max_sleep)
+    {
+        wait_length = max_sleep;
+    }
+    static const int MAX_EVENTS = 16;
+    struct epoll_event events[MAX_EVENTS];
+    int ret =
+        selectHelper_.epoll_wait(epollFd_, events, MAX_EVENTS, wait_length);
+    for (int i = 0; i < ret; ++i)
+    {
+        int fd = events[i].data.fd;
+        if (fd < 0)
+        {
+            selectHelper_.clear_eventfd();
+            continue;
+        }
+        // Errors and hangups wake up every waiting selectable, like select
+        // would do.
+        uint32_t ev = events[i].events;
+        uint32_t all = EPOLLERR | EPOLLHUP;
+        static const uint32_t masks[3] = {EPOLLIN, EPOLLOUT, EPOLLPRI};
+        Selectable **jobs = epollSlots_[fd].jobs;
+        for (unsigned t = 0; t < 3; ++t)
+        {
+            if (jobs[t] && (ev & (masks[t] | all)))
+            {
+                add(jobs[t]->wakeup_, jobs[t]->priority_);
+                jobs[t] = nullptr;
+            }
+        }
+        epoll_update(fd, true);
+    }
+}
+
+#else
+
 void ExecutorBase::select(Selectable *job)
 {
     fd_set *s = get_select_set(job->type());
@@ -416,6 +556,8 @@ void ExecutorBase::wait_with_select(long long wait_length)
     selectNFds_ = max_fd;
 }
 
+#endif // OSSELECTWAKEUP_EPOLL
+
 #endif
 
 void ExecutorBase::shutdown()
@@ -434,4 +576,7 @@ ExecutorBase::~ExecutorBase()
     {
         shutdown();
     }
+#ifdef OSSELECTWAKEUP_EPOLL
+    ::close(epollFd_);
+#endif
 }
@@ -37,6 +37,7 @@
 #define _EXECUTOR_EXECUTOR_HXX_
 
 #include <functional>
+#include <vector>
 
 #include "executor/Executable.hxx"
 #include "executor/Notifiable.hxx"
@@ -201,6 +202,34 @@ private:
      * @param next_timer_nsec is the maximum time to sleep in nanoseconds. */
     void wait_with_select(long long next_timer_nsec);
 
+#ifdef OSSELECTWAKEUP_EPOLL
+    /// Selectables waiting for one file descriptor.
+    struct EpollSlot
+    {
+        /// The waiting selectable for each SelectType (at index type - 1), or
+        /// nullptr.
+        Selectable *jobs[3] = {nullptr, nullptr, nullptr};
+    };
+
+    /// @param fd is a file descriptor.
+    /// @param type a select type: READ, WRITE or EXCEPT
+    /// @return the place where the selectable waiting for fd with the given
+    /// type is stored.
+    Selectable **epoll_job(int fd, Selectable::SelectType type)
+    {
+        if ((unsigned)fd >= epollSlots_.size())
+        {
+            epollSlots_.resize(fd + 1);
+        }
+        return &epollSlots_[fd].jobs[type - 1];
+    }
+
+    /// Updates the epoll registration of a file descriptor after the
+    /// selectables waiting for it changed.
+    /// @param fd is the file descriptor.
+    /// @param registered is true if the fd is in the epoll set now.
+    void epoll_update(int fd, bool registered);
+#else
     /// Helper function.
     ///
     /// @param type a select type: READ, WRITE or EXCEPT
@@ -218,6 +247,7 @@ private:
         LOG(FATAL, "Unexpected select type %d", type);
         return nullptr;
     }
+#endif
 
     /** name of this Executor */
     const char *name_;
@@ -234,6 +264,12 @@ private:
     /** List of active timers. */
     ActiveTimers activeTimers_;
 
+#ifdef OSSELECTWAKEUP_EPOLL
+    /** epoll set of all the fds that are waited for. */
+    int epollFd_;
+    /** Waiting selectables, indexed by fd. */
+    std::vector<EpollSlot> epollSlots_;
+#else
     /** fd to select for read. */
     fd_set selectRead_;
     /** fd to select for write. */
@@ -244,6 +280,7 @@ private:
     int selectNFds_;
     /** Head of the linked list for the select calls. */
     TypedQueue<Selectable> selectables_;
+#endif
 
     /** Set to 1 when the executor thread has exited and it is safe to delete
      * *this. */
@@ -273,10 +310,27 @@ public:
     NO_THREAD() {}
 };
 
+/// Selects the queue type the executors use by default.
+template <unsigned NUM_PRIO> struct ExecutorQueue
+{
+#ifdef OSSELECTWAKEUP_EPOLL
+    /// Other threads add to the queue without locking, and the executor
+    /// thread sleeps in epoll_wait.
+    typedef QListLockFree<NUM_PRIO> type;
+#else
+    /// Locked queue with a semaphore.
+    typedef QListProtectedWait<NUM_PRIO> type;
+#endif
+};
+
 /// Implementation the ExecutorBase with a specific number of priority
 /// bands. The memory usage and scheduling cost is proportional to the number
 /// of priority bands, so it should be kept pretty low.
-template <unsigned NUM_PRIO>
+///
+/// QueueType is the queue of the executables waiting to run. It has to
+/// support insert, next, wait and timedwait like QListProtectedWait.
+template <unsigned NUM_PRIO,
+    class QueueType = typename ExecutorQueue<NUM_PRIO>::type>
 class Executor : public ExecutorBase
 {
 public:
@@ -406,7 +460,7 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Executor);
 
     /// Internal queue of executables waiting to be scheduled.
-    QListProtectedWait<NUM_PRIO> queue_;
+    QueueType queue_;
 };
 
 /** This class can be given an executor, and will notify itself when that
@@ -434,9 +488,9 @@ private:
     ExecutorBase* executor_;
 };
 
-template <unsigned NUM_PRIO>
+template <unsigned NUM_PRIO, class QueueType>
 /** Destructs the executor. Waits for the executor to run out of work first. */
-Executor<NUM_PRIO>::~Executor()
+Executor<NUM_PRIO, QueueType>::~Executor()
 {
     shutdown();
 }
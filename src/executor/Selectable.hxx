@@ -53,9 +53,9 @@ public:
     enum Limits
     {
         /// Largest FD we accept (otherwise crash with error).
-        MAX_FD = (1 << 14) - 1,
+        MAX_FD = (1 << 20) - 1,
         /// Largest priority we accept (otherwise we clip).
-        MAX_PRIO = (1 << 16) - 1,
+        MAX_PRIO = (1 << 10) - 1,
     };
 
     /// Constructor. @param parent is the executable that will be woken up when
@@ -121,10 +121,10 @@ private:
     /// What to watch the file for. See @ref SelectType
     unsigned selectType_ : 2;
     /// File descriptor to watch.
-    unsigned fd_ : 14;
+    unsigned fd_ : 20;
     /// When the select condition is met, the Executable will be scheduled at
     /// this priority.
-    unsigned priority_ : 16;
+    unsigned priority_ : 10;
     /// This executable will be scheduled on the executor when the select
     /// condition is met.
     Executable *wakeup_;
@@ -36,6 +36,9 @@
 #include "executor/Executor.hxx"
 #include "os/os.h"
 
+#include <string.h>
+#include <algorithm>
+
 Timer::~Timer()
 {
     HASSERT(!isActive_);
@@ -62,10 +65,303 @@ void Timer::run()
     }
 }
 
+/** Storage of the hierarchical timer wheel.
+ *
+ * Time is quantized into ticks of 2^20 nsec (about 1 msec). Level 0 has one
+ * slot for every tick of the next 256 ticks; level L (1..3) has 64 slots, each
+ * covering 2^(8 + 6 * (L-1)) ticks. Timers that are even further in the future
+ * are kept in a single overflow slot. Whenever the current tick crosses the
+ * boundary of a slot on a higher level, the timers of that slot are cascaded
+ * (re-inserted) into the lower levels. The slots are unsorted singly linked
+ * lists; the expiration time of the timers is not quantized, only their
+ * placement. */
+struct ActiveTimers::Wheel
+{
+    enum
+    {
+        /// log2 of the tick length in nanoseconds.
+        TICK_SHIFT = 20,
+        /// log2 of the number of slots on level 0.
+        L0_BITS = 8,
+        /// log2 of the number of slots on the higher levels.
+        LN_BITS = 6,
+        /// How many levels there are (not counting the overflow slot).
+        NUM_LEVELS = 4,
+        /// Number of slots on level 0.
+        L0_SIZE = 1 << L0_BITS,
+        /// Number of slots on each higher level.
+        LN_SIZE = 1 << LN_BITS,
+        /// Index of the slot for timers too far in the future for any level.
+        OVERFLOW_SLOT = L0_SIZE + (NUM_LEVELS - 1) * LN_SIZE,
+        /// Total number of slots.
+        NUM_SLOTS = OVERFLOW_SLOT + 1,
+    };
+
+    Wheel(long long now)
+        : curTick_(to_tick(now))
+    {
+        memset(slots_, 0, sizeof(slots_));
+        memset(count_, 0, sizeof(count_));
+    }
+
+    /// @return the tick in which a given time falls.
+    /// @param nsec is a time in nanoseconds.
+    static long long to_tick(long long nsec)
+    {
+        return nsec < 0 ? 0 : nsec >> TICK_SHIFT;
+    }
+
+    /// @return how many bits of the tick a slot on the given level covers.
+    /// @param level is 1..NUM_LEVELS-1.
+    static unsigned level_shift(unsigned level)
+    {
+        return L0_BITS + (level - 1) * LN_BITS;
+    }
+
+    /// @return the level to which a slot belongs (NUM_LEVELS for the overflow
+    /// slot).
+    /// @param slot is the slot index.
+    static unsigned level_of(unsigned slot)
+    {
+        if (slot < L0_SIZE)
+        {
+            return 0;
+        }
+        return 1 + (slot - L0_SIZE) / LN_SIZE;
+    }
+
+    /// @return the slot where a timer with a given deadline belongs.
+    /// @param when is the deadline in nanoseconds.
+    unsigned slot_for(long long when)
+    {
+        long long tick = to_tick(when);
+        if (tick < curTick_)
+        {
+            tick = curTick_;
+        }
+        long long delta = tick - curTick_;
+        if (delta < L0_SIZE)
+        {
+            return tick & (L0_SIZE - 1);
+        }
+        for (unsigned level = 1; level < NUM_LEVELS; ++level)
+        {
+            unsigned shift = level_shift(level);
+            if (delta < (1LL << (shift + LN_BITS)))
+            {
+                return L0_SIZE + (level - 1) * LN_SIZE +
+                    ((tick >> shift) & (LN_SIZE - 1));
+            }
+        }
+        return OVERFLOW_SLOT;
+    }
+
+    /// Heads of the singly linked lists of timers.
+    QMember *slots_[NUM_SLOTS];
+    /// Number of timers on each level (last is the overflow slot).
+    unsigned count_[NUM_LEVELS + 1];
+    /// All timers in level 0 expire in the tick range [curTick_, curTick_ +
+    /// L0_SIZE). Everything before curTick_ is already expired.
+    long long curTick_;
+};
+
+ActiveTimers::ActiveTimers(ExecutorBase *executor)
+    : executor_(executor)
+    , isPending_(0)
+{
+}
+
 ActiveTimers::~ActiveTimers()
 {
 }
 
+void ActiveTimers::enable_timer_wheel()
+{
+    OSMutexLock l(&lock_);
+    if (wheel_)
+    {
+        return;
+    }
+    wheel_.reset(new Wheel(OSTime::get_monotonic()));
+    while (activeTimers_.next)
+    {
+        Timer *t = static_cast<Timer *>(activeTimers_.next);
+        activeTimers_.next = t->next;
+        t->next = nullptr;
+        wheel_insert_locked(t);
+    }
+}
+
+void ActiveTimers::wheel_insert_locked(Timer *timer)
+{
+    unsigned slot = wheel_->slot_for(timer->when_);
+    timer->wheelSlot_ = slot;
+    timer->next = wheel_->slots_[slot];
+    wheel_->slots_[slot] = timer;
+    ++wheel_->count_[Wheel::level_of(slot)];
+}
+
+void ActiveTimers::wheel_remove_locked(Timer *timer)
+{
+    unsigned slot = timer->wheelSlot_;
+    QMember **last = &wheel_->slots_[slot];
+    while (*last && *last != timer)
+    {
+        last = &((*last)->next);
+    }
+    HASSERT(*last == timer);
+    *last = timer->next;
+    timer->next = nullptr;
+    --wheel_->count_[Wheel::level_of(slot)];
+}
+
+void ActiveTimers::wheel_cascade_locked(unsigned slot)
+{
+    QMember *head = wheel_->slots_[slot];
+    wheel_->slots_[slot] = nullptr;
+    while (head)
+    {
+        Timer *t = static_cast<Timer *>(head);
+        head = t->next;
+        t->next = nullptr;
+        --wheel_->count_[Wheel::level_of(slot)];
+        wheel_insert_locked(t);
+    }
+}
+
+long long ActiveTimers::wheel_next_timeout_locked(long long now)
+{
+    Wheel *w = wheel_.get();
+    long long now_tick = Wheel::to_tick(now);
+    bool found_timer = false;
+    while (true)
+    {
+        // Expires the due timers from the current level 0 slot.
+        QMember **last = &w->slots_[w->curTick_ & (Wheel::L0_SIZE - 1)];
+        while (*last)
+        {
+            Timer *t = static_cast<Timer *>(*last);
+            if (t->when_ <= now)
+            {
+                *last = t->next;
+                --w->count_[0];
+                expire_locked(t);
+                found_timer = true;
+            }
+            else
+            {
+                last = &t->next;
+            }
+        }
+        if (w->curTick_ >= now_tick)
+        {
+            break;
+        }
+        // Advances the current tick. Skips over stretches of time where the
+        // lower levels are empty.
+        long long next_tick = w->curTick_ + 1;
+        if (!w->count_[0])
+        {
+            unsigned bits = Wheel::L0_BITS;
+            for (unsigned level = 1;
+                 level <= Wheel::NUM_LEVELS && !w->count_[level]; ++level)
+            {
+                bits = level < Wheel::NUM_LEVELS ? bits + Wheel::LN_BITS : 64;
+            }
+            if (bits >= 64)
+            {
+                // The wheel is empty.
+                next_tick = now_tick;
+            }
+            else
+            {
+                next_tick = ((w->curTick_ >> bits) + 1) << bits;
+            }
+            if (next_tick > now_tick)
+            {
+                next_tick = now_tick;
+            }
+        }
+        w->curTick_ = next_tick;
+        if ((next_tick & (Wheel::L0_SIZE - 1)) == 0)
+        {
+            // Crossed a level 1 slot boundary, and maybe higher ones too.
+            for (unsigned level = 1; level < Wheel::NUM_LEVELS; ++level)
+            {
+                unsigned idx = (next_tick >> Wheel::level_shift(level)) &
+                    (Wheel::LN_SIZE - 1);
+                wheel_cascade_locked(
+                    Wheel::L0_SIZE + (level - 1) * Wheel::LN_SIZE + idx);
+                if (idx)
+                {
+                    break;
+                }
+                if (level == Wheel::NUM_LEVELS - 1)
+                {
+                    wheel_cascade_locked(Wheel::OVERFLOW_SLOT);
+                }
+            }
+        }
+    }
+    if (found_timer)
+    {
+        return 0;
+    }
+
+    // Computes when the executor needs to wake up next: either the earliest
+    // timer on level 0, or the next time a non-empty slot has to be cascaded.
+    long long wakeup = INT64_MAX;
+    if (w->count_[0])
+    {
+        for (unsigned i = 0; i < Wheel::L0_SIZE; ++i)
+        {
+            QMember *head = w->slots_[(w->curTick_ + i) & (Wheel::L0_SIZE - 1)];
+            if (!head)
+            {
+                continue;
+            }
+            for (; head; head = head->next)
+            {
+                wakeup = std::min(wakeup, static_cast<Timer *>(head)->when_);
+            }
+            break;
+        }
+    }
+    for (unsigned level = 1; level < Wheel::NUM_LEVELS; ++level)
+    {
+        if (!w->count_[level])
+        {
+            continue;
+        }
+        unsigned shift = Wheel::level_shift(level);
+        for (unsigned i = 1; i <= Wheel::LN_SIZE; ++i)
+        {
+            long long slot_start = (w->curTick_ >> shift) + i;
+            unsigned slot = Wheel::L0_SIZE + (level - 1) * Wheel::LN_SIZE +
+                (slot_start & (Wheel::LN_SIZE - 1));
+            if (w->slots_[slot])
+            {
+                wakeup = std::min(
+                    wakeup, (slot_start << shift) << Wheel::TICK_SHIFT);
+                break;
+            }
+        }
+    }
+    if (w->count_[Wheel::NUM_LEVELS])
+    {
+        unsigned shift = Wheel::level_shift(Wheel::NUM_LEVELS);
+        wakeup = std::min(wakeup,
+            (((w->curTick_ >> shift) + 1) << shift) << Wheel::TICK_SHIFT);
+    }
+    if (wakeup == INT64_MAX)
+    {
+        // Wakes up the timer service every now and then. It won't make any
+        // difference.
+        return SEC_TO_NSEC(3600);
+    }
+    return wakeup - now;
+}
+
 void ActiveTimers::notify()
 {
     if (!isPending_)
@@ -82,25 +378,33 @@ void ActiveTimers::run()
     // call.
 }
 
+void ActiveTimers::expire_locked(Timer *timer)
+{
+    timer->next = nullptr;
+    timer->isActive_ = 0;
+    timer->isExpired_ = 1;
+    // Puts it on the executor.
+    executor_->add(timer, timer->priority_);
+}
+
 long long ActiveTimers::get_next_timeout()
 {
     OSMutexLock l(&lock_);
 
+    long long now = OSTime::get_monotonic();
+    if (wheel_)
+    {
+        return wheel_next_timeout_locked(now);
+    }
     QMember **last = &activeTimers_.next;
     Timer *current_timer = static_cast<Timer *>(*last);
-    long long now = OSTime::get_monotonic();
     bool found_timer = false;
     while (current_timer && current_timer->when_ <= now)
     {
         // Deques next timer.
         found_timer = true;
         *last = current_timer->next;
-        current_timer->next = nullptr;
-
-        current_timer->isActive_ = 0;
-        current_timer->isExpired_ = 1;
-        // Puts it on the executor.
-        executor_->add(current_timer, current_timer->priority_);
+        expire_locked(current_timer);
         // Takes the next timer.
         current_timer = static_cast<Timer *>(*last);
     }
@@ -124,6 +428,17 @@ long long ActiveTimers::get_next_timeout()
 
 bool ActiveTimers::empty() {
     OSMutexLock l(&lock_);
+    if (wheel_)
+    {
+        for (unsigned c : wheel_->count_)
+        {
+            if (c)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 
     QMember **last = &activeTimers_.next;
     Timer *current_timer = static_cast<Timer *>(*last);
@@ -141,6 +456,12 @@ void ActiveTimers::insert_locked(Timer *timer)
     HASSERT(timer);
     HASSERT(timer->next == nullptr);
 
+    if (wheel_)
+    {
+        wheel_insert_locked(timer);
+        notify();
+        return;
+    }
     QMember **last = &activeTimers_.next;
     Timer *current_timer = static_cast<Timer *>(*last);
     while (current_timer && current_timer->when_ <= timer->when_)
@@ -160,6 +481,11 @@ void ActiveTimers::insert_locked(Timer *timer)
 void ActiveTimers::remove_locked(Timer *timer)
 {
     HASSERT(timer);
+    if (wheel_)
+    {
+        wheel_remove_locked(timer);
+        return;
+    }
     // Removes the timer from the queue.
     QMember **last = &activeTimers_.next;
     while (*last && *last != timer)
@@ -35,6 +35,8 @@
 #ifndef _EXECUTOR_TIMER_HXX_
 #define _EXECUTOR_TIMER_HXX_
 
+#include <memory>
+
 #include "executor/Notifiable.hxx"
 #include "utils/Buffer.hxx"
 #include "utils/QMember.hxx"
@@ -44,18 +46,20 @@ class Timer;
 class ExecutorBase;
 
 /** Class that manages the list of active timers. The Executor uses this class
- * tightly in its sleep-execute loop. */
+ * tightly in its sleep-execute loop.
+ *
+ * By default the active timers are kept in a sorted linked list. This has no
+ * memory overhead, but scheduling, updating and removing a timer needs to
+ * walk the list. Executors that run hundreds or more timers should call
+ * enable_timer_wheel(), which switches to a hierarchical timer wheel where
+ * these operations take constant time (on average). */
 class ActiveTimers : public Executable
 {
 public:
     /// Constructor.
     ///
     /// @param executor parent that will use this instance.
-    ActiveTimers(ExecutorBase *executor)
-        : executor_(executor)
-        , isPending_(0)
-    {
-    }
+    ActiveTimers(ExecutorBase *executor);
 
     ~ActiveTimers();
 
@@ -76,20 +80,33 @@ public:
     void schedule_timer(::Timer *timer);
 
     /** Updates the expiration time of an already scheduled timer. This call is
-     * somewhat expensive, because it needs to walk the entire queue of active
-     * timers. May wake up the executor.
+     * somewhat expensive in list mode, because it needs to walk the entire
+     * queue of active timers. May wake up the executor.
      *
      * @param timer is the timer whose next execution time has been updated. It
      * must already be scheduled. */
     void update_timer(::Timer *timer);
 
     /** Deletes an already scheduled but not yet expired timer. This call is
-     * somewhat expensive, because it needs to walk the entire queue of active
-     * timers. Asserts that the timer is in fact not yet expired.
+     * somewhat expensive in list mode, because it needs to walk the entire
+     * queue of active timers. Asserts that the timer is in fact not yet
+     * expired.
      *
      * @param timer is the timer to delete. */
     void remove_timer(::Timer *timer);
 
+    /** Switches the storage of the active timers from the sorted list to a
+     * hierarchical timer wheel. Costs about 450 pointers of RAM. Timers that
+     * are already scheduled are moved over. Calling it multiple times is a
+     * no-op. */
+    void enable_timer_wheel();
+
+    /** @return true if the timers are stored in a timer wheel. */
+    bool is_timer_wheel()
+    {
+        return wheel_.get() != nullptr;
+    }
+
     /** @returns the executor on which the timers will be scheduled. */
     ExecutorBase *executor()
     {
@@ -113,12 +130,41 @@ private:
      * @param timer what to insert into the active list. */
     void insert_locked(::Timer *timer);
 
+    /** Takes a timer out of the active list and puts it onto the executor.
+     * Caller must hold the lock and must have unlinked the timer already.
+     * @param timer the timer that expired. */
+    void expire_locked(::Timer *timer);
+
+    struct Wheel;
+
+    /** Inserts a timer into the slot of the timer wheel that is determined by
+     * its deadline. Caller must hold the lock.
+     * @param timer what to insert. */
+    void wheel_insert_locked(::Timer *timer);
+
+    /** Removes a timer from the timer wheel. Caller must hold the lock.
+     * @param timer what to remove. Must be in the timer wheel. */
+    void wheel_remove_locked(::Timer *timer);
+
+    /** Re-inserts all timers of one wheel slot. Caller must hold the lock.
+     * @param slot is the index of the wheel slot to cascade. */
+    void wheel_cascade_locked(unsigned slot);
+
+    /** Implementation of get_next_timeout() for the timer wheel. Expires all
+     * timers that are due. Caller must hold the lock.
+     * @param now is the current time in nanoseconds.
+     * @return nanoseconds to sleep until the executor has to call this
+     * function again. */
+    long long wheel_next_timeout_locked(long long now);
+
     /// Parent.
     ExecutorBase *executor_;
     /// Protects the timer list.
     OSMutex lock_;
     /// List of timers that are scheduled.
     QMember activeTimers_;
+    /// Timer wheel, if enabled. When non-null, activeTimers_ is not used.
+    std::unique_ptr<Wheel> wheel_;
     /// 1 if we in the executor's queue.
     unsigned isPending_ : 1;
 
@@ -145,6 +191,7 @@ public:
         , isExpired_(0)
         , isCancelled_(0)
         , tcRequestStop_(0)
+        , wheelSlot_(0)
     {
     }
 
@@ -296,6 +343,9 @@ private:
     unsigned isCancelled_ : 1;
     /** For children: 1 if a repeated timer should stop sending wakeups. */
     unsigned tcRequestStop_ : 1;
+    /** Which slot of the timer wheel this timer is linked into. Used only when
+     * the ActiveTimers is in timer wheel mode. */
+    unsigned wheelSlot_ : 10;
 
     DISALLOW_COPY_AND_ASSIGN(Timer);
 };
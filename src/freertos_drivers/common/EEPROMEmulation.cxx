@@ -103,6 +103,12 @@ void EEPROMEmulation::mount()
         }
     }
 
+    /* do we index the slots in RAM to speed up reads */
+    if (INDEX_IN_RAM)
+    {
+        build_slot_index();
+    }
+
     /* do we shadow_ the data in RAM to speed up reads */
     if (SHADOW_IN_RAM)
     {
@@ -114,6 +120,34 @@ void EEPROMEmulation::mount()
 
         /* turn on shadowing */
         shadowInRam_ = true;
+
+        /* the index is not needed anymore */
+        delete[] slotIndex_;
+        slotIndex_ = nullptr;
+    }
+}
+
+/** Fills in the slot index from the slots of the active sector.
+ */
+void EEPROMEmulation::build_slot_index()
+{
+    unsigned count = fblock_count();
+    if (!slotIndex_)
+    {
+        slotIndex_ = new uint16_t[count];
+    }
+    memset(slotIndex_, 0, count * sizeof(uint16_t));
+
+    /* later slots override earlier ones */
+    for (unsigned block_index = slot_first();
+         block_index < rawBlockCount_ - availableSlots_;
+         ++block_index)
+    {
+        unsigned fblock = *block(activeSector_, block_index) >> 16;
+        if (fblock < count)
+        {
+            slotIndex_[fblock] = block_index;
+        }
     }
 }
 
@@ -213,6 +247,10 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
                            (data[(i * 2) + 0] << 0);
         }
         flash_program(activeSector_, rawBlockCount_ - availableSlots_, slot_data, BLOCK_SIZE);
+        if (slotIndex_)
+        {
+            slotIndex_[index] = rawBlockCount_ - availableSlots_;
+        }
         --availableSlots_;
     }
     else
@@ -229,7 +267,7 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
         unsigned available_slots = slot_count();
 
         /* move any existing data over */
-        for (unsigned int fblock = 0; fblock < (file_size() / BYTES_PER_BLOCK); ++fblock)
+        for (unsigned int fblock = 0; fblock < fblock_count(); ++fblock)
         {
             uint32_t slot_data[BLOCK_SIZE / sizeof(uint32_t)];
             if (fblock == index) // the new data to be written
@@ -248,6 +286,10 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
                 if (!read_fblock(fblock, read_data))
                 {
                     /* nothing to write, this is the default "erased" value */
+                    if (slotIndex_)
+                    {
+                        slotIndex_[fblock] = 0;
+                    }
                     continue;
                 }
                 for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
@@ -259,6 +301,11 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
             }
             /* commit the write */
             flash_program(new_sector, rawBlockCount_ - available_slots, slot_data, BLOCK_SIZE);
+            if (slotIndex_)
+            {
+                /* the old slot of this block will not be read anymore */
+                slotIndex_[fblock] = rawBlockCount_ - available_slots;
+            }
             --available_slots;
         }
         /* finalize the data move and write */
@@ -287,6 +334,25 @@ void EEPROMEmulation::read(unsigned int offset, void *buf, size_t len)
     }
 
     uint8_t *byte_data = (uint8_t *)buf;
+
+    if (slotIndex_)
+    {
+        while (len)
+        {
+            unsigned int lsa = offset & (BYTES_PER_BLOCK - 1);
+            size_t copy_size = len < (BYTES_PER_BLOCK - lsa) ?
+                               len : (BYTES_PER_BLOCK - lsa);
+            uint8_t data[BYTES_PER_BLOCK];
+            read_fblock(offset / BYTES_PER_BLOCK, data);
+            memcpy(byte_data, data + lsa, copy_size);
+
+            offset    += copy_size;
+            len       -= copy_size;
+            byte_data += copy_size;
+        }
+        return;
+    }
+
     memset(byte_data, 0xff, len); // default if data not found
 
     for (unsigned block_index = slot_first();
@@ -306,11 +372,7 @@ void EEPROMEmulation::read(unsigned int offset, void *buf, size_t len)
         }
         // Reads the block
         uint8_t data[BYTES_PER_BLOCK];
-        for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
-        {
-            data[(i * 2) + 0] = (address[i] >> 0) & 0xFF;
-            data[(i * 2) + 1] = (address[i] >> 8) & 0xFF;
-        }
+        load_slot(block_index, data);
         // Copies the right part into the output buffer.
         unsigned slotofs, bufofs;
         if (slot_offset < offset)
@@ -352,6 +414,17 @@ bool EEPROMEmulation::read_fblock(unsigned int index, uint8_t data[])
         }
         return false;
     }
+    else if (slotIndex_)
+    {
+        unsigned raw_block = slotIndex_[index];
+        if (!raw_block)
+        {
+            memset(data, 0xFF, BYTES_PER_BLOCK);
+            return false;
+        }
+        load_slot(raw_block, data);
+        return true;
+    }
     else
     {
         /* default data value if not found */
@@ -366,11 +439,7 @@ bool EEPROMEmulation::read_fblock(unsigned int index, uint8_t data[])
             if (index == (*address >> 16))
             {
                 /* found the data */
-                for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
-                {
-                    data[(i * 2) + 0] = (address[i] >> 0) & 0xFF;
-                    data[(i * 2) + 1] = (address[i] >> 8) & 0xFF;
-                }
+                load_slot(raw_block, data);
                 return true;
             }
         }
@@ -378,3 +447,18 @@ bool EEPROMEmulation::read_fblock(unsigned int index, uint8_t data[])
 
     return false;
 }
+
+/** Decodes the data payload of a slot in the active sector.
+ * @param raw_block raw block index of the slot within the active sector
+ * @param data location to place read data, array size must be @ref
+ *           BYTES_PER_BLOCK large
+ */
+void EEPROMEmulation::load_slot(unsigned raw_block, uint8_t data[])
+{
+    const uint32_t *address = block(activeSector_, raw_block);
+    for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
+    {
+        data[(i * 2) + 0] = (address[i] >> 0) & 0xFF;
+        data[(i * 2) + 1] = (address[i] >> 8) & 0xFF;
+    }
+}
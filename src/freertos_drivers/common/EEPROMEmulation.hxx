@@ -101,6 +101,13 @@ extern const char __eeprom_end;
  *  be allocated in RAM that will be pre-filled with the entire eeprom
  *  data. Dramatically speeds up reads, because reads will not have to go
  *  through the log anymore.
+ *  @param INDEX_IN_RAM: a boolean, if set to true, a RAM index will be kept
+ *  with the location of the latest slot of every data block. Reads will look
+ *  up the slot in the index instead of scanning the log. The index takes two
+ *  bytes for every BYTES_PER_BLOCK bytes of the file, so it is smaller than
+ *  the shadow when BYTES_PER_BLOCK is larger than 2. When SHADOW_IN_RAM is
+ *  also set, the index is only used during mount to fill the shadow, then
+ *  freed.
  *  @param file_size: The total number of bytes held by the emulated eeprom
  *  file. Reads from address 0 .. file_size - 1 will be valid. Must be smaller
  *  than half of one sector, but should be realistically about 35% of the
@@ -142,6 +149,7 @@ protected:
      */
     ~EEPROMEmulation()
     {
+        delete[] slotIndex_;
     }
 
     /** Mount the EEPROM file.  Should be called during construction of the
@@ -196,6 +204,11 @@ private:
      */
     static const bool SHADOW_IN_RAM;
 
+    /** Keep an index of the slots in RAM. This will increase read performance
+     * at the expense of two bytes of RAM for every data block.
+     */
+    static const bool INDEX_IN_RAM;
+
 protected:
     /** magic marker for an intact block */
     static const uint32_t MAGIC_INTACT;
@@ -237,6 +250,22 @@ private:
      */
     bool read_fblock(unsigned int index, uint8_t data[]);
 
+    /** Decodes the data payload of a slot in the active sector.
+     * @param raw_block raw block index of the slot within the active sector
+     * @param data location to place read data, array size must be @ref
+     *           BYTES_PER_BLOCK large
+     */
+    void load_slot(unsigned raw_block, uint8_t data[]);
+
+    /** Fills in the slot index from the slots of the active sector. */
+    void build_slot_index();
+
+    /** @return number of data blocks in the file. */
+    unsigned fblock_count()
+    {
+        return (file_size() + BYTES_PER_BLOCK - 1) / BYTES_PER_BLOCK;
+    }
+
     /** Get the next active sector pointer.
      * @return sector index for the next sector to use.
      */
@@ -324,6 +353,11 @@ protected:
     /** pointer to RAM for shadowing EEPROM. */
     uint8_t *shadow_{nullptr};
 
+    /** For each data block, the raw block index of its latest slot in the
+     * active sector, or zero if the block has no slot (zero is a metadata
+     * block). nullptr if the index is not in use. */
+    uint16_t *slotIndex_{nullptr};
+
 
     /** Default constructor.
      */
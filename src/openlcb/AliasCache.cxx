@@ -33,7 +33,7 @@
 
 #include "openlcb/AliasCache.hxx"
 
-#include "os/OS.hxx"
+#include "utils/macros.h"
 
 namespace openlcb
 {
@@ -42,13 +42,396 @@ namespace openlcb
 
 const NodeID AliasCache::RESERVED_ALIAS_NODE_ID = 1;
 
+/// Index that keeps the alias and Node ID mappings in balanced trees.
+class AliasCache::TreeIndex : public AliasCache::Index
+{
+public:
+    /// Constructor.
+    /// @param entries maximum number of entries to hold
+    TreeIndex(size_t entries)
+        : aliasMap(entries)
+        , idMap(entries)
+    {
+    }
+
+    Metadata *find(NodeAlias alias) OVERRIDE
+    {
+        AliasMap::Iterator it = aliasMap.find(alias);
+        return it == aliasMap.end() ? NULL : (*it).second;
+    }
+
+    Metadata *find(NodeID id) OVERRIDE
+    {
+        IdMap::Iterator it = idMap.find(id);
+        return it == idMap.end() ? NULL : (*it).second;
+    }
+
+    void insert(Metadata *metadata) OVERRIDE
+    {
+        aliasMap[metadata->alias] = metadata;
+        idMap[metadata->id] = metadata;
+    }
+
+    void erase(Metadata *metadata) OVERRIDE
+    {
+        aliasMap.erase(metadata->alias);
+        idMap.erase(metadata->id);
+    }
+
+    void clear() OVERRIDE
+    {
+        idMap.clear();
+        aliasMap.clear();
+    }
+
+    size_t size() OVERRIDE
+    {
+        return aliasMap.size();
+    }
+
+private:
+    /** Short hand for the alias Map type */
+    typedef Map <NodeAlias, Metadata*> AliasMap;
+    
+    /** Short hand for the ID Map type */
+    typedef Map <NodeID, Metadata*> IdMap;
+
+    /** Map of alias to corresponding Metadata */
+    AliasMap aliasMap;
+    
+    /** Map of Node ID to corresponding Metadata */
+    IdMap idMap;
+};
+
+/// Index that scans the entry pool. Unused entries have an alias of
+/// zero. Several entries may have the same Node ID; a flag per entry tells
+/// which one the Node ID maps to, so that lookups give the same result as
+/// the tree index.
+class AliasCache::LinearIndex : public AliasCache::Index
+{
+public:
+    /// Constructor.
+    /// @param pool array of all entries
+    /// @param entries number of entries in pool
+    LinearIndex(Metadata *pool, size_t entries)
+        : pool(pool)
+        , idMapped(new bool[entries])
+        , entries(entries)
+    {
+        clear();
+    }
+
+    ~LinearIndex()
+    {
+        delete [] idMapped;
+    }
+
+    Metadata *find(NodeAlias alias) OVERRIDE
+    {
+        for (size_t i = 0; i < entries; ++i)
+        {
+            if (pool[i].alias == alias)
+            {
+                return pool + i;
+            }
+        }
+        return NULL;
+    }
+
+    Metadata *find(NodeID id) OVERRIDE
+    {
+        for (size_t i = 0; i < entries; ++i)
+        {
+            if (idMapped[i] && pool[i].id == id)
+            {
+                return pool + i;
+            }
+        }
+        return NULL;
+    }
+
+    void insert(Metadata *metadata) OVERRIDE
+    {
+        unmap_id(metadata->id);
+        idMapped[metadata - pool] = true;
+    }
+
+    void erase(Metadata *metadata) OVERRIDE
+    {
+        unmap_id(metadata->id);
+    }
+
+    void clear() OVERRIDE
+    {
+        for (size_t i = 0; i < entries; ++i)
+        {
+            idMapped[i] = false;
+        }
+    }
+
+    size_t size() OVERRIDE
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < entries; ++i)
+        {
+            if (pool[i].alias != 0)
+            {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+private:
+    /** Removes the Node ID mapping. @param id is the Node ID. */
+    void unmap_id(NodeID id)
+    {
+        for (size_t i = 0; i < entries; ++i)
+        {
+            if (idMapped[i] && pool[i].id == id)
+            {
+                idMapped[i] = false;
+            }
+        }
+    }
+
+    /** array of all entries */
+    Metadata *pool;
+    /** true for the entry that lookups by Node ID return */
+    bool *idMapped;
+    /** number of entries in pool */
+    size_t entries;
+};
+
+/// Index that keeps two open-addressing hash tables (linear probing, at most
+/// 50% load) of 16-bit offsets into the entry pool. The keys are not stored
+/// in the tables; they are read from the pool entries.
+class AliasCache::HashIndex : public AliasCache::Index
+{
+public:
+    /// Constructor.
+    /// @param pool array of all entries
+    /// @param entries number of entries in pool
+    HashIndex(Metadata *pool, size_t entries)
+        : pool(pool)
+        , count(0)
+    {
+        HASSERT(entries < EMPTY);
+        bits = 1;
+        while ((size_t(1) << bits) < entries * 2)
+        {
+            ++bits;
+        }
+        mask = (1u << bits) - 1;
+        aliasTable = new uint16_t[mask + 1];
+        idTable = new uint16_t[mask + 1];
+        clear();
+    }
+
+    ~HashIndex()
+    {
+        delete [] aliasTable;
+        delete [] idTable;
+    }
+
+    Metadata *find(NodeAlias alias) OVERRIDE
+    {
+        return find_in<AliasKey>(aliasTable, alias);
+    }
+
+    Metadata *find(NodeID id) OVERRIDE
+    {
+        return find_in<IdKey>(idTable, id);
+    }
+
+    void insert(Metadata *metadata) OVERRIDE
+    {
+        if (insert_in<AliasKey>(aliasTable, metadata))
+        {
+            ++count;
+        }
+        insert_in<IdKey>(idTable, metadata);
+    }
+
+    void erase(Metadata *metadata) OVERRIDE
+    {
+        if (erase_in<AliasKey>(aliasTable, metadata->alias))
+        {
+            --count;
+        }
+        erase_in<IdKey>(idTable, metadata->id);
+    }
+
+    void clear() OVERRIDE
+    {
+        for (unsigned i = 0; i <= mask; ++i)
+        {
+            aliasTable[i] = EMPTY;
+            idTable[i] = EMPTY;
+        }
+        count = 0;
+    }
+
+    size_t size() OVERRIDE
+    {
+        return count;
+    }
+
+private:
+    /** Marks an empty slot in the hash tables. */
+    static constexpr uint16_t EMPTY = 0xFFFF;
+
+    /** Key traits for the alias table. */
+    struct AliasKey
+    {
+        typedef NodeAlias type;
+        static NodeAlias get(const Metadata &m)
+        {
+            return m.alias;
+        }
+        static unsigned hash(NodeAlias alias, unsigned bits)
+        {
+            return (uint32_t(alias) * 0x9E3779B1u) >> (32 - bits);
+        }
+    };
+
+    /** Key traits for the Node ID table. */
+    struct IdKey
+    {
+        typedef NodeID type;
+        static NodeID get(const Metadata &m)
+        {
+            return m.id;
+        }
+        static unsigned hash(NodeID id, unsigned bits)
+        {
+            return (id * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+        }
+    };
+
+    /** @return the slot where the probing for key starts. */
+    template <class K> unsigned home(typename K::type key)
+    {
+        return K::hash(key, bits);
+    }
+
+    /** Looks up a key in a table.
+     * @param table is the hash table to search
+     * @param key is the key to look for
+     * @return entry, or NULL if not found. */
+    template <class K>
+    Metadata *find_in(uint16_t *table, typename K::type key)
+    {
+        for (unsigned i = home<K>(key);; i = (i + 1) & mask)
+        {
+            uint16_t ofs = table[i];
+            if (ofs == EMPTY)
+            {
+                return NULL;
+            }
+            if (K::get(pool[ofs]) == key)
+            {
+                return pool + ofs;
+            }
+        }
+    }
+
+    /** Adds an entry to a table, replacing the entry with the same key if
+     * there is one.
+     * @param table is the hash table to add to
+     * @param metadata is the entry to add
+     * @return true if the table grew, false if an entry was replaced. */
+    template <class K> bool insert_in(uint16_t *table, Metadata *metadata)
+    {
+        typename K::type key = K::get(*metadata);
+        for (unsigned i = home<K>(key);; i = (i + 1) & mask)
+        {
+            uint16_t ofs = table[i];
+            if (ofs == EMPTY || K::get(pool[ofs]) == key)
+            {
+                table[i] = metadata - pool;
+                return ofs == EMPTY;
+            }
+        }
+    }
+
+    /** Removes a key from a table. Uses backward shift deletion, so there
+     * are no tombstones.
+     * @param table is the hash table to remove from
+     * @param key is the key to remove
+     * @return true if the key was found. */
+    template <class K> bool erase_in(uint16_t *table, typename K::type key)
+    {
+        unsigned i = home<K>(key);
+        while (true)
+        {
+            uint16_t ofs = table[i];
+            if (ofs == EMPTY)
+            {
+                return false;
+            }
+            if (K::get(pool[ofs]) == key)
+            {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        // Moves back every entry of the run that does not have its home
+        // slot between the hole and its current position.
+        for (unsigned j = (i + 1) & mask; table[j] != EMPTY;
+             j = (j + 1) & mask)
+        {
+            unsigned k = home<K>(K::get(pool[table[j]]));
+            if (((j - k) & mask) >= ((j - i) & mask))
+            {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i] = EMPTY;
+        return true;
+    }
+
+    /** array of all entries */
+    Metadata *pool;
+    /** maps alias to offset in pool */
+    uint16_t *aliasTable;
+    /** maps Node ID to offset in pool */
+    uint16_t *idTable;
+    /** number of slots in each table minus one */
+    unsigned mask;
+    /** log2 of the number of slots in each table */
+    unsigned bits;
+    /** number of aliases in aliasTable */
+    size_t count;
+};
+
+constexpr uint16_t AliasCache::HashIndex::EMPTY;
+
+AliasCache::Index *AliasCache::create_index(IndexType type, size_t entries)
+{
+    switch (type)
+    {
+        case INDEX_LINEAR:
+            return new LinearIndex(pool, entries);
+        case INDEX_HASH:
+            return new HashIndex(pool, entries);
+        default:
+            return new TreeIndex(entries);
+    }
+}
+
 void AliasCache::clear()
 {
-    idMap.clear();
-    aliasMap.clear();
+    index->clear();
     /* initialize the freeList */
+    freeList = NULL;
+    oldest = NULL;
+    newest = NULL;
     for (size_t i = 0; i < entries; ++i)
     {
+        pool[i].id = 0;
+        pool[i].alias = 0;
         pool[i].prev = NULL;
         pool[i].next = freeList;
         freeList = pool + i;
@@ -64,19 +447,17 @@ void AliasCache::add(NodeID id, NodeAlias alias)
     HASSERT(id != 0);
     HASSERT(alias != 0);
     
-    Metadata *insert;
-
-    AliasMap::Iterator it = aliasMap.find(alias);
-    if (it != aliasMap.end())
+    Metadata *insert = index->find(alias);
+    if (insert)
     {
         /* we already have a mapping for this alias, so lets remove it */
-        insert = (*it).second;
+        NodeID old_id = insert->id;
         remove(alias);
         
         if (removeCallback)
         {
             /* tell the interface layer that we removed this mapping */
-            (*removeCallback)(insert->id, insert->alias, context);
+            (*removeCallback)(old_id, alias, context);
         }
     }
 
@@ -102,8 +483,7 @@ void AliasCache::add(NodeID id, NodeAlias alias)
         }
         oldest = oldest->newer;
 
-        aliasMap.erase(insert->alias);
-        idMap.erase(insert->id);
+        index->erase(insert);
 
         if (removeCallback)
         {
@@ -112,12 +492,10 @@ void AliasCache::add(NodeID id, NodeAlias alias)
         }
     }
         
-    insert->timestamp = OSTime::get_monotonic();
     insert->id = id;
     insert->alias = alias;
 
-    aliasMap[alias] = insert;
-    idMap[id] = insert;
+    index->insert(insert);
 
     /* update the time based list */
     insert->newer = NULL;
@@ -147,13 +525,11 @@ void AliasCache::add(NodeID id, NodeAlias alias)
  */
 void AliasCache::remove(NodeAlias alias)
 {
-    AliasMap::Iterator it = aliasMap.find(alias);
+    Metadata *metadata = index->find(alias);
 
-    if (it != aliasMap.end())
+    if (metadata)
     {
-        Metadata *metadata = (*it).second;
-        aliasMap.erase(it);
-        idMap.erase(metadata->id);
+        index->erase(metadata);
         
         if (metadata->newer)
         {
@@ -172,6 +548,8 @@ void AliasCache::remove(NodeAlias alias)
             oldest = metadata->newer;
         }
     
+        metadata->id = 0;
+        metadata->alias = 0;
         metadata->next = freeList;
         freeList = metadata;
     }
@@ -196,13 +574,11 @@ NodeAlias AliasCache::lookup(NodeID id)
 {
     HASSERT(id != 0);
 
-    IdMap::Iterator it = idMap.find(id);
+    Metadata *metadata = index->find(id);
 
-    if (it != idMap.end())
+    if (metadata)
     {
-        Metadata *metadata = (*it).second;
-        
-        /* update timestamp */
+        /* move to the front of the LRU list */
         touch(metadata);
         return metadata->alias;
     }
@@ -219,13 +595,11 @@ NodeID AliasCache::lookup(NodeAlias alias)
 {
     HASSERT(alias != 0);
 
-    AliasMap::Iterator it = aliasMap.find(alias);
+    Metadata *metadata = index->find(alias);
 
-    if (it != aliasMap.end())
+    if (metadata)
     {
-        Metadata *metadata = (*it).second;
-        
-        /* update timestamp */
+        /* move to the front of the LRU list */
         touch(metadata);
         return metadata->id;
     }
@@ -269,13 +643,11 @@ NodeAlias AliasCache::generate()
     return alias;
 }
 
-/** Update the time stamp for a given entry.
+/** Moves an entry to the front of the least-recently-used list.
  * @param  metadata metadata associated with the entry
  */
 void AliasCache::touch(Metadata* metadata)
 {
-    metadata->timestamp = OSTime::get_monotonic();
-
     if (metadata != newest)
     {
         if (metadata == oldest)
@@ -48,26 +48,43 @@ namespace openlcb
  * is no mutual exclusion locking mechanism built into this class.  Mutual
  * exclusion must be handled by the user as needed.
  *
- * @todo the class uses RBTree, consider a version that is a linear search for
- * a small number of entries.
+ * The entries are kept in a least-recently-used list. Lookups by alias and by
+ * Node ID go through an index, whose implementation can be selected at
+ * construction time (see @ref IndexType).
  */
 class AliasCache
 {
 public:
+    /// Selects the data structure used for looking up entries.
+    enum IndexType
+    {
+        /// Two balanced trees (alias and Node ID). O(log n) lookup. This is
+        /// the default.
+        INDEX_TREE,
+        /// No index at all; lookups scan the entries. Smallest RAM
+        /// footprint (one byte per entry), suggested for caches with up to
+        /// about 8 entries.
+        INDEX_LINEAR,
+        /// Two open-addressing hash tables of 16-bit entry indexes. O(1)
+        /// lookup at 8 to 16 bytes of RAM per entry; suggested for gateways
+        /// tracking many remote aliases. At most 65535 entries.
+        INDEX_HASH,
+    };
+
     /** Constructor.
      * @param seed starting seed for generation of aliases
      * @param entries maximum number of entries in this cache
      * @param remove_callback callback to call when we remove a mapping from
      *        the cache however it will not be called in the remove() method
      * @param context context pointer to pass to remove_callback
+     * @param index_type selects the lookup data structure
      */
     AliasCache(NodeID seed, size_t _entries,
                void (*remove_callback)(NodeID id, NodeAlias alias, void *) = NULL,
-               void *context = NULL)
+               void *context = NULL, IndexType index_type = INDEX_TREE)
         : pool(new Metadata[_entries]),
           freeList(NULL),
-          aliasMap(_entries),
-          idMap(_entries),
+          index(create_index(index_type, _entries)),
           oldest(NULL),
           newest(NULL),
           seed(seed),
@@ -139,6 +156,7 @@ public:
     /** Default destructor */
     ~AliasCache()
     {
+        delete index;
         delete [] pool;
     }
 
@@ -146,18 +164,12 @@ public:
     int check_consistency();
 
 private:
-    enum
-    {
-        /** marks an unused mapping */
-        UNUSED_MASK = 0x10000000
-    };
-
-    /** Interesting information about a given cache entry. */
+    /** Interesting information about a given cache entry. An entry that is
+     * not in use has an alias of zero. */
     struct Metadata
     {
         NodeID id = 0; /**< 48-bit NMRAnet Node ID */
         NodeAlias alias = 0; /**< NMRAnet alias */
-        long long timestamp; /**< time stamp of last usage */
         union
         {
             Metadata *prev; /**< unused */
@@ -170,23 +182,50 @@ private:
         };
     };
 
+    /** Lookup structure from alias and from Node ID to the Metadata. The
+     * implementations are in AliasCache.cxx. */
+    class Index
+    {
+    public:
+        virtual ~Index()
+        {
+        }
+
+        /** @return the entry with the given alias, or NULL. */
+        virtual Metadata *find(NodeAlias alias) = 0;
+        /** @return the entry with the given Node ID, or NULL. */
+        virtual Metadata *find(NodeID id) = 0;
+        /** Adds the alias and the Node ID of an entry to the index. If the
+         * Node ID is already present, the existing mapping is replaced. */
+        virtual void insert(Metadata *metadata) = 0;
+        /** Removes the mapping of the entry's alias and the mapping of the
+         * entry's Node ID from the index. The Node ID mapping is removed
+         * even if it points to another entry with the same Node ID. */
+        virtual void erase(Metadata *metadata) = 0;
+        /** Removes all mappings. */
+        virtual void clear() = 0;
+        /** @return how many aliases are in the index. */
+        virtual size_t size() = 0;
+    };
+
+    class TreeIndex;
+    class LinearIndex;
+    class HashIndex;
+
+    /** Instantiates the index implementation.
+     * @param type which implementation to create
+     * @param entries the maximum number of entries in the cache
+     * @return newly allocated index. */
+    Index *create_index(IndexType type, size_t entries);
+
     /** pointer to allocated Metadata pool */
     Metadata *pool;
     
     /** list of unused mapping entries */
     Metadata *freeList;
     
-    /** Short hand for the alias Map type */
-    typedef Map <NodeAlias, Metadata*> AliasMap;
-    
-    /** Short hand for the ID Map type */
-    typedef Map <NodeID, Metadata*> IdMap;
-
-    /** Map of alias to corresponding Metadata */
-    AliasMap aliasMap;
-    
-    /** Map of Node ID to corresponding Metadata */
-    IdMap idMap;
+    /** Lookup structure for aliases and Node IDs. */
+    Index *index;
     
     /** oldest untouched entry */
     Metadata *oldest;
@@ -206,7 +245,7 @@ private:
     /** context pointer to pass in with remove_callback */
     void *context;
 
-    /** Update the time stamp for a given entry.
+    /** Moves an entry to the front of the least-recently-used list.
      * @param  metadata metadata associated with the entry
      */
     void touch(Metadata* metadata);
@@ -52,8 +52,22 @@ namespace openlcb
    GridConnect protocol, performs routing decisions on the frames and sends out
    to the appropriate ports.
 
-   TODO: need to process consumer and producer identified messages.
-   TODO: need to exclude CHECK ID frames from the source address learning.
+   The router learns from the traffic which port every node alias is
+   reachable on (from the source address of the frames, except CHECK ID
+   frames), and which ports have consumers for which events (from the
+   Consumer Identified and Consumer Range Identified messages). Addressed
+   frames are sent only to the port of the destination node once it is
+   known; PCERs are sent only to the ports that have a consumer for the
+   event. All other frames are forwarded to every port.
+
+   Since the nodes announce their consumers upon startup and in response to
+   Identify Events, the router has to be running before the nodes on its
+   ports start up, or an Identify Events Global has to be sent after it
+   started, to learn all consumers.
+
+   For each port the router counts how many frames it forwarded to that
+   port, and how many frames it suppressed (i.e. that a non-routing hub
+   would have sent to the port).
  */
 class GcCanRoutingHub : public HubPortInterface
 {
@@ -62,6 +76,15 @@ public:
     typedef Buffer<value_type> buffer_type;
     typedef FlowInterface<buffer_type> port_type;
 
+    /// Traffic statistics of a port.
+    struct PortStats
+    {
+        /// Number of frames sent to this port.
+        unsigned forwarded{0};
+        /// Number of frames not sent to this port due to routing decisions.
+        unsigned suppressed{0};
+    };
+
     GcCanRoutingHub(Service *s)
         : deliveryFlow_(s, this)
     {
@@ -80,15 +103,19 @@ public:
             b->unref();
             return;
         }
-        const string &p = *b->data();
-        for (unsigned i = 0; i < p.size(); ++i)
+        const char *p = b->data()->data();
+        size_t len = b->data()->size();
+        while (len)
         {
-            if (it->second.segmenter_.consume_byte(p[i]))
+            if (it->second.segmenter_.consume_data(&p, &len))
             {
                 // We have a frame.
-                string ret;
-                it->second.segmenter_.frame_buffer(&ret);
-                LOG(VERBOSE, "sending frame: %s", ret.c_str());
+                if (LOGLEVEL >= VERBOSE)
+                {
+                    string ret;
+                    it->second.segmenter_.frame_buffer(&ret);
+                    LOG(VERBOSE, "sending frame: %s", ret.c_str());
+                }
                 auto *cb = deliveryFlow_.alloc();
                 HASSERT(it->second.segmenter_.parse_frame_to_output(
                     cb->data()->mutable_frame()));
@@ -129,6 +156,20 @@ public:
         pendingRemove_.push_back(port);
     }
 
+    /// @param port is a registered port.
+    /// @return the traffic statistics of port. All zeros if the port is not
+    /// registered.
+    PortStats get_port_stats(HubPortInterface *port)
+    {
+        OSMutexLock l(&lock_);
+        auto it = ports_.find(port);
+        if (it == ports_.end())
+        {
+            return PortStats();
+        }
+        return it->second.stats_;
+    }
+
 private:
     class PortParser;
     typedef std::map<void *, PortParser> PortsMap;
@@ -278,33 +319,19 @@ private:
             }
             if (has_event)
             {
-                switch (mti & ~Defs::MTI_MODIFIER_MASK)
+                // Only the consumers matter for where the PCERs need to go;
+                // producer identified messages are just forwarded.
+                if ((mti & ~Defs::MTI_MODIFIER_MASK) ==
+                    (Defs::MTI_CONSUMER_IDENTIFIED_VALID &
+                        ~Defs::MTI_MODIFIER_MASK))
                 {
-                    case Defs::MTI_CONSUMER_IDENTIFIED_VALID &
-                        ~Defs::MTI_MODIFIER_MASK:
-                        parent_->routingTable_.register_consumer(
-                            message()->data()->skipMember_, event_);
-                        break;
-                    case Defs::MTI_PRODUCER_IDENTIFIED_VALID &
-                        ~Defs::MTI_MODIFIER_MASK:
-                        parent_->routingTable_.register_producer(
-                            message()->data()->skipMember_, event_);
-                        break;
-                    default:
-                        break;
+                    parent_->routingTable_.register_consumer(
+                        message()->data()->skipMember_, event_);
                 }
-                switch (mti)
+                else if (mti == Defs::MTI_CONSUMER_IDENTIFIED_RANGE)
                 {
-                    case Defs::MTI_PRODUCER_IDENTIFIED_RANGE:
-                        parent_->routingTable_.register_producer_range(
-                            message()->data()->skipMember_, event_);
-                        break;
-                    case Defs::MTI_CONSUMER_IDENTIFIED_RANGE:
-                        parent_->routingTable_.register_consumer_range(
-                            message()->data()->skipMember_, event_);
-                        break;
-                    default:
-                        break;
+                    parent_->routingTable_.register_consumer_range(
+                        message()->data()->skipMember_, event_);
                 }
             }
             // Now: we have a non-event global message or a message with an
@@ -328,6 +355,10 @@ private:
                 {
                     forward_to_port();
                 }
+                else if (is_destination(nextIt_))
+                {
+                    nextIt_->second.stats_.suppressed++;
+                }
             }
             else
             {
@@ -343,9 +374,26 @@ private:
         {
             OSMutexLock l(&parent_->lock_);
             forward_to_port();
+            for (auto it = parent_->ports_.begin(); it != parent_->ports_.end();
+                 ++it)
+            {
+                if (it != nextIt_ && is_destination(it))
+                {
+                    it->second.stats_.suppressed++;
+                }
+            }
             return done_processing();
         }
 
+        /// @param it is a port entry.
+        /// @return true if a hub without routing would send the current frame
+        /// to this port.
+        bool is_destination(PortsMap::iterator it)
+        {
+            return !it->second.inactive_ &&
+                it->first != message()->data()->skipMember_;
+        }
+
         Action done_processing()
         {
             if (gcBuf_)
@@ -364,6 +412,7 @@ private:
             {
                 if (nextIt_->second.canPort_ == message()->data()->skipMember_)
                     return;
+                nextIt_->second.stats_.forwarded++;
                 nextIt_->second.canPort_->send(message()->ref(), priority());
             }
             else
@@ -374,6 +423,7 @@ private:
                         nextIt_->second.hubPort_);
                 if (hpi == message()->data()->skipMember_)
                     return;
+                nextIt_->second.stats_.forwarded++;
                 ensure_gc_buf_available();
                 nextIt_->second.hubPort_->send(gcBuf_->ref());
             }
@@ -425,6 +475,8 @@ private:
         GcStreamParser segmenter_;
         CanHubPortInterface *canPort_{nullptr};
         HubPortInterface *hubPort_{nullptr};
+        /// Traffic statistics of this port.
+        PortStats stats_;
     };
     /// Keyed by the skipMember_ value of the incoming data from a given port.
     std::map<void *, PortParser> ports_;
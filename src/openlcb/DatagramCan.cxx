@@ -36,6 +36,7 @@
 
 #include "openlcb/DatagramDefs.hxx"
 #include "openlcb/IfCanImpl.hxx"
+#include "nmranet_config.h"
 
 namespace openlcb
 {
@@ -44,6 +45,10 @@ namespace openlcb
 /// ack/nack response message.
 long long DATAGRAM_RESPONSE_TIMEOUT_NSEC = SEC_TO_NSEC(3);
 
+/// Defines how long a partially received incoming datagram is kept waiting
+/// for its next frame.
+long long DATAGRAM_REASSEMBLY_TIMEOUT_NSEC = SEC_TO_NSEC(3);
+
 /// Datagram client implementation for CANbus-based datagram protocol.
 ///
 /// This flow is responsible for the outgoing CAN datagram framing, and listens
@@ -435,7 +440,7 @@ public:
 
         srcAlias_ = (id & CanDefs::SRC_MASK) >> CanDefs::SRC_SHIFT;
 
-        uint64_t buffer_key = id & (CanDefs::DST_MASK | CanDefs::SRC_MASK);
+        uint32_t buffer_key = id & (CanDefs::DST_MASK | CanDefs::SRC_MASK);
 
         dst_.alias = buffer_key >> (CanDefs::DST_SHIFT);
         dstNode_ = nullptr;
@@ -450,37 +455,41 @@ public:
             return release_and_exit();
         }
 
-        DatagramPayload *buf = nullptr;
+        PendingDatagram *pending = nullptr;
         bool last_frame = true;
 
         switch (can_frame_type)
         {
             case 2:
-                // Single-frame datagram. Let's allocate one small buffer for
-                // it.
-                localBuffer_.clear();
-                localBuffer_.reserve(f->can_dlc);
-                buf = &localBuffer_;
-                break;
+                // Single-frame datagram.
+                localBuffer_.assign(
+                    reinterpret_cast<const char *>(&f->data[0]), f->can_dlc);
+                release();
+                return allocate_and_call(
+                    if_can()->dispatcher(), STATE(datagram_complete));
             case 3:
             {
                 // Datagram first frame
-                auto it = pendingBuffers_.find(buffer_key);
-                if (it != pendingBuffers_.end())
+                pending = find_pending(buffer_key);
+                if (pending)
                 {
-                    pendingBuffers_.erase(it);
+                    free_pending(pending);
+                    pending = nullptr;
                     /** Frames came out of order or more than one datagram is
                      * being sent to the same dst. */
                     errorCode_ = DatagramClient::RESEND_OK |
                                  DatagramClient::OUT_OF_ORDER;
                     break;
                 }
-
-                buf = &pendingBuffers_[buffer_key];
-                buf->clear();
-
-                // Datagram first frame. Get a full buffer.
-                buf->reserve(72);
+                pending = alloc_pending(buffer_key);
+                if (!pending)
+                {
+                    // All reassembly buffers are in use.
+                    ++stats_.rejectedFull;
+                    errorCode_ = DatagramClient::RESEND_OK |
+                        DatagramClient::BUFFER_UNAVAILABLE;
+                    break;
+                }
                 last_frame = false;
                 break;
             }
@@ -491,20 +500,7 @@ public:
             case 5:
             {
                 // Datagram last frame
-                auto it = pendingBuffers_.find(buffer_key);
-                if (it != pendingBuffers_.end())
-                {
-                    buf = &it->second;
-                    if (last_frame)
-                    {
-                        localBuffer_.clear();
-                        // Moves ownership of the allocated data to the local
-                        // buffer.
-                        localBuffer_.swap(*buf);
-                        buf = &localBuffer_;
-                        pendingBuffers_.erase(it);
-                    }
-                }
+                pending = find_pending(buffer_key);
                 break;
             }
             default:
@@ -512,22 +508,21 @@ public:
                 return release_and_exit();
         }
 
-        if (!buf)
+        if (!errorCode_ && !pending)
         {
             errorCode_ =
                 DatagramClient::RESEND_OK | DatagramClient::OUT_OF_ORDER;
         }
-        else if (buf->size() + f->can_dlc > DatagramDefs::MAX_SIZE)
+        else if (pending && pending->size + f->can_dlc > DatagramDefs::MAX_SIZE)
         {
             // Too long datagram arrived.
             LOG(WARNING, "AsyncDatagramCan: too long incoming datagram arrived."
                          " Size: %d",
-                (int)(buf->size() + f->can_dlc));
+                (int)(pending->size + f->can_dlc));
             errorCode_ = DatagramClient::PERMANENT_ERROR;
             // Since we reject the datagram, let's not keep the buffer
-            // around. This call should not crash if the buffer was already
-            // deleted.
-            pendingBuffers_.erase(buffer_key);
+            // around.
+            free_pending(pending);
         }
 
         if (errorCode_)
@@ -538,18 +533,24 @@ public:
                                      STATE(send_rejection));
         }
 
-        // Copies new data into buf.
-        buf->append(reinterpret_cast<const char *>(&f->data[0]), f->can_dlc);
+        // Copies new data into the reassembly buffer.
+        memcpy(pending->data + pending->size, &f->data[0], f->can_dlc);
+        pending->size += f->can_dlc;
         release();
         if (last_frame)
         {
-            HASSERT(buf == &localBuffer_);
             // Datagram is complete; let's send it to higher level If.
+            localBuffer_.assign(
+                reinterpret_cast<const char *>(pending->data), pending->size);
+            free_pending(pending);
+            ++stats_.completed;
             return allocate_and_call(if_can()->dispatcher(),
                                      STATE(datagram_complete));
         }
         else
         {
+            pending->deadline =
+                os_get_time_monotonic() + DATAGRAM_REASSEMBLY_TIMEOUT_NSEC;
             return exit();
         }
     }
@@ -595,9 +596,150 @@ public:
         return exit();
     }
 
+    /// @return the reassembly statistics.
+    CanDatagramReassemblyStats stats()
+    {
+        CanDatagramReassemblyStats ret = stats_;
+        ret.pending = 0;
+        for (unsigned i = 0; i < numPending_; ++i)
+        {
+            if (pending_[i].key)
+            {
+                ++ret.pending;
+            }
+        }
+        return ret;
+    }
+
 private:
+    /// A multi-frame datagram being reassembled.
+    struct PendingDatagram
+    {
+        /// Source and destination alias bits of the CAN frame ID. 0 if this
+        /// buffer is free.
+        uint32_t key;
+        /// Number of payload bytes received so far.
+        uint8_t size;
+        /// Monotonic time when the datagram will be dropped if no more frames
+        /// arrive.
+        long long deadline;
+        /// Payload bytes received so far.
+        uint8_t data[DatagramDefs::MAX_SIZE];
+    };
+
+    /// Timer that drops the partial datagrams whose deadline passed.
+    class ExpiryTimer : public ::Timer
+    {
+    public:
+        /// @param parent is the owning parser flow.
+        ExpiryTimer(CanDatagramParser *parent)
+            : ::Timer(parent->service()->executor()->active_timers())
+            , parent_(parent)
+        {
+        }
+
+        long long timeout() OVERRIDE
+        {
+            return parent_->expire_pending(true);
+        }
+
+    private:
+        /// Owning parser flow.
+        CanDatagramParser *parent_;
+    };
+
+    /// @param key is the source and destination alias bits of the CAN frame
+    /// ID.
+    /// @return the reassembly buffer for this key, or nullptr if there is
+    /// none.
+    PendingDatagram *find_pending(uint32_t key)
+    {
+        for (unsigned i = 0; i < numPending_; ++i)
+        {
+            if (pending_[i].key == key)
+            {
+                return &pending_[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /// Takes a free reassembly buffer and starts the expiry timer if needed.
+    /// @param key is the source and destination alias bits of the CAN frame
+    /// ID.
+    /// @return the buffer, or nullptr if all buffers are in use.
+    PendingDatagram *alloc_pending(uint32_t key)
+    {
+        PendingDatagram *p = find_pending(0);
+        if (!p)
+        {
+            // Maybe the timer did not get to run yet.
+            expire_pending(false);
+            p = find_pending(0);
+            if (!p)
+            {
+                return nullptr;
+            }
+        }
+        p->key = key;
+        p->size = 0;
+        if (!timerRunning_)
+        {
+            timerRunning_ = true;
+            timer_.start(DATAGRAM_REASSEMBLY_TIMEOUT_NSEC);
+        }
+        return p;
+    }
+
+    /// Releases a reassembly buffer.
+    /// @param p is the buffer to release.
+    void free_pending(PendingDatagram *p)
+    {
+        p->key = 0;
+    }
+
+    /// Drops the reassembly buffers whose deadline passed.
+    /// @param from_timer is true when called from the expiry timer. Only then
+    /// does the timer stop; otherwise it may still be scheduled or expired
+    /// and waiting on the executor.
+    /// @return the time until the next deadline in nsec, or Timer::NONE if
+    /// there are no more pending datagrams.
+    long long expire_pending(bool from_timer)
+    {
+        long long now = os_get_time_monotonic();
+        long long next = INT64_MAX;
+        for (unsigned i = 0; i < numPending_; ++i)
+        {
+            PendingDatagram *p = &pending_[i];
+            if (!p->key)
+            {
+                continue;
+            }
+            if (p->deadline <= now)
+            {
+                LOG(INFO, "Dropping incomplete incoming datagram from alias "
+                          "%03x.",
+                    (unsigned)((p->key & CanDefs::SRC_MASK) >>
+                        CanDefs::SRC_SHIFT));
+                free_pending(p);
+                ++stats_.timedOut;
+                continue;
+            }
+            next = std::min(next, p->deadline);
+        }
+        if (next == INT64_MAX)
+        {
+            if (from_timer)
+            {
+                timerRunning_ = false;
+            }
+            return ::Timer::NONE;
+        }
+        return next - now;
+    }
+
     /// A local buffer that owns the datagram payload bytes after we took the
-    /// entry from the pending buffers map.
+    /// entry from the pending buffers.
     DatagramPayload localBuffer_;
 
     Node *dstNode_;
@@ -607,19 +749,24 @@ private:
     /// be forwarded to the upper layer in this case.
     uint16_t errorCode_;
 
-    /** Open datagram buffers. Keyed by (dstid | srcid), value is a datagram
-     * payload. When a payload is finished, it should be moved into the final
-     * datagram message using swap() to avoid memory copies.
-     * @TODO(balazs.racz) we need some kind of timeout-based release mechanism
-     * in here. */
-    StlMap<uint64_t, DatagramPayload> pendingBuffers_;
+    /// Fixed set of reassembly buffers, allocated at construction.
+    std::unique_ptr<PendingDatagram[]> pending_;
+    /// Number of entries in pending_.
+    unsigned numPending_;
+    /// Drops the partial datagrams after their deadline.
+    ExpiryTimer timer_{this};
+    /// True if timer_ is started.
+    bool timerRunning_{false};
+    /// Reassembly statistics.
+    CanDatagramReassemblyStats stats_;
 };
 CanDatagramService::CanDatagramService(IfCan *iface,
                                        int num_registry_entries,
                                        int num_clients)
     : DatagramService(iface, num_registry_entries)
+    , parser_(new CanDatagramParser(if_can()))
 {
-    if_can()->add_owned_flow(new CanDatagramParser(if_can()));
+    if_can()->add_owned_flow(parser_);
     for (int i = 0; i < num_clients; ++i)
     {
         auto *client_flow = new CanDatagramClient(if_can());
@@ -633,13 +780,29 @@ Executable *TEST_CreateCanDatagramParser(IfCan *if_can)
     return new CanDatagramParser(if_can);
 }
 
+CanDatagramReassemblyStats TEST_GetCanDatagramParserStats(Executable *parser)
+{
+    return static_cast<CanDatagramParser *>(parser)->stats();
+}
+
+CanDatagramReassemblyStats CanDatagramService::reassembly_stats()
+{
+    return parser_->stats();
+}
+
 CanDatagramService::~CanDatagramService()
 {
 }
 
 CanDatagramParser::CanDatagramParser(IfCan *iface)
     : CanFrameStateFlow(iface)
+    , pending_(new PendingDatagram[config_num_datagram_reassembly_buffers()])
+    , numPending_(config_num_datagram_reassembly_buffers())
 {
+    for (unsigned i = 0; i < numPending_; ++i)
+    {
+        pending_[i].key = 0;
+    }
     if_can()->frame_dispatcher()->register_handler(this, CAN_FILTER, CAN_MASK);
 }
 
@@ -647,6 +810,10 @@ CanDatagramParser::~CanDatagramParser()
 {
     if_can()->frame_dispatcher()->unregister_handler(this, CAN_FILTER,
                                                      CAN_MASK);
+    if (timerRunning_)
+    {
+        timer_.cancel();
+    }
 }
 
 } // namespace openlcb
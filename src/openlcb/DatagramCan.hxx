@@ -41,6 +41,27 @@
 namespace openlcb
 {
 
+/// Defines how long a partially received incoming datagram is kept waiting
+/// for its next frame.
+extern long long DATAGRAM_REASSEMBLY_TIMEOUT_NSEC;
+
+class CanDatagramParser;
+
+/// Statistics about the reassembly of incoming multi-frame datagrams.
+struct CanDatagramReassemblyStats
+{
+    /// Number of multi-frame datagrams that were completely received.
+    unsigned completed{0};
+    /// Number of partial datagrams that were dropped because their next
+    /// frame did not arrive in time.
+    unsigned timedOut{0};
+    /// Number of datagrams rejected because all reassembly buffers were in
+    /// use.
+    unsigned rejectedFull{0};
+    /// Number of partial datagrams currently being reassembled.
+    unsigned pending{0};
+};
+
 /// Implementation of the DatagramService with the CANbus-specific OpenLCB
 /// datagram protocol. This service is responsible for fragmenting outgoing
 /// datagram messages to the CANbus, assembling incoming datagram frames into
@@ -61,11 +82,23 @@ public:
     {
         return static_cast<IfCan *>(iface());
     }
+
+    /// @return statistics about the incoming datagram reassembly. Must be
+    /// called on the interface's executor.
+    CanDatagramReassemblyStats reassembly_stats();
+
+private:
+    /// Flow assembling incoming datagram frames. Owned by the interface.
+    CanDatagramParser *parser_;
 };
 
 /// Creates a CAN datagram parser flow. Exposed for testing only.
 Executable *TEST_CreateCanDatagramParser(IfCan *if_can);
 
+/// @return the reassembly statistics of a CAN datagram parser flow created
+/// by TEST_CreateCanDatagramParser. Exposed for testing only.
+CanDatagramReassemblyStats TEST_GetCanDatagramParserStats(Executable *parser);
+
 } // namespace openlcb
 
 #endif // _NMRANET_DATAGRAMCAN_HXX_
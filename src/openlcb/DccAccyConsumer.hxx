@@ -38,6 +38,7 @@
 
 #include "openlcb/TractionDefs.hxx"
 #include "openlcb/EventHandlerTemplates.hxx"
+#include "dcc/AccessoryScheduler.hxx"
 #include "dcc/PacketFlowInterface.hxx"
 
 namespace openlcb
@@ -66,6 +67,18 @@ public:
         memset(isStateKnown_, 0, sizeof(isStateKnown_));
     }
 
+    /// Constructs a listener for DCC accessory control that hands the
+    /// commands to an accessory scheduler instead of sending packets directly.
+    /// @param node is the virtual node that will be listening for events and
+    /// responding to Identify messages.
+    /// @param scheduler coalesces and repeats the accessory commands and
+    /// interleaves them with the locomotive refresh.
+    DccAccyConsumer(Node *node, dcc::AccessoryScheduler *scheduler)
+        : DccAccyConsumer(node, (dcc::PacketFlowInterface *)nullptr)
+    {
+        scheduler_ = scheduler;
+    }
+
     ~DccAccyConsumer()
     {
         EventRegistry::instance()->unregister_handler(this);
@@ -110,6 +123,11 @@ public:
             lastSetState_[eventOfs_] &= ~m;
         }
 
+        if (scheduler_)
+        {
+            scheduler_->send_accessory(dccAddress_, onOff_);
+            return;
+        }
         dcc::PacketFlowInterface::message_type *pkt;
         mainBufferPool->alloc(&pkt);
         pkt->data()->add_dcc_basic_accessory(dccAddress_, onOff_);
@@ -216,6 +234,8 @@ private:
     Node *node_;
     /// Track to send DCC packets to.
     dcc::PacketFlowInterface* track_;
+    /// If not null, the accessory commands go here instead of track_.
+    dcc::AccessoryScheduler *scheduler_{nullptr};
 };
 
 } // namespace openlcb
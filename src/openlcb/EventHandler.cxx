@@ -40,10 +40,10 @@ namespace openlcb
 EventRegistry *EventRegistry::instance_ = nullptr;
 
 AsyncMutex event_handler_mutex;
-WriteHelper event_write_helper1;
-WriteHelper event_write_helper2;
-WriteHelper event_write_helper3;
-WriteHelper event_write_helper4;
+EVENT_HANDLER_LOCAL WriteHelper event_write_helper1;
+EVENT_HANDLER_LOCAL WriteHelper event_write_helper2;
+EVENT_HANDLER_LOCAL WriteHelper event_write_helper3;
+EVENT_HANDLER_LOCAL WriteHelper event_write_helper4;
 BarrierNotifiable event_barrier;
 
 EventRegistry::EventRegistry()
@@ -108,11 +108,13 @@ public:
 
 // These allow event handlers to produce up to four messages per
 // invocation. They are locked by the event-handler_mutex and always available
-// at the entry to an event handler function.
-extern WriteHelper event_write_helper1;
-extern WriteHelper event_write_helper2;
-extern WriteHelper event_write_helper3;
-extern WriteHelper event_write_helper4;
+// at the entry to an event handler function. With EVENT_PARALLEL_DISPATCH
+// every thread has its own copy, which is always available at the entry to an
+// event handler function running on that thread.
+extern EVENT_HANDLER_LOCAL WriteHelper event_write_helper1;
+extern EVENT_HANDLER_LOCAL WriteHelper event_write_helper2;
+extern EVENT_HANDLER_LOCAL WriteHelper event_write_helper3;
+extern EVENT_HANDLER_LOCAL WriteHelper event_write_helper4;
 
 /// Abstract base class for all event handlers. Instances of this class can
 /// get registered with the event service to receive notifications of incoming
@@ -230,6 +232,22 @@ class EventIterator;
 ///
 /// @TODO(balazs.racz) transition to the usual Singleton class instead of
 /// hand-initialized singleton pointer.
+#ifdef EVENT_PARALLEL_DISPATCH
+/// Gets notified when an event handler is removed from the registry.
+class EventUnregisterListener
+{
+public:
+    virtual ~EventUnregisterListener()
+    {
+    }
+
+    /// Called after all entries of a handler were removed from the
+    /// registry. Returns when no call of the handler is running or will be
+    /// made anymore. @param handler is the unregistered handler.
+    virtual void handler_unregistered(EventHandler *handler) = 0;
+};
+#endif
+
 class EventRegistry
 {
 public:
@@ -254,6 +272,8 @@ public:
     virtual void register_handler(const EventRegistryEntry &entry,
                                   unsigned mask) = 0;
     /// Removes all registered instances of a given event handler pointer.
+    /// When this returns, the handler will not be called anymore, and it may
+    /// be deleted.
     virtual void unregister_handler(EventHandler *handler) = 0;
 
     /// Creates a new event iterator. Caller takes ownership of object.
@@ -262,16 +282,42 @@ public:
     /// Returns a monotonically increasing number that will change every time
     /// the set of registered event handlers change. Whenever this number
     /// changes, the iterators are invalidated and must be cleared.
+    /// Implementations whose iterators work on a snapshot (like
+    /// FlatEventHandlers) never change this number.
     unsigned get_epoch()
     {
         return dirtyCounter_;
     }
 
+#ifdef EVENT_PARALLEL_DISPATCH
+    /// Sets who gets notified of the unregistered handlers. @param l is the
+    /// listener, or nullptr.
+    void set_unregister_listener(EventUnregisterListener *l)
+    {
+        unregisterListener_ = l;
+    }
+#endif
+
 protected:
     EventRegistry();
 
+    /// Implementations must call this function at the end of
+    /// unregister_handler, without holding any lock. With parallel dispatch
+    /// it waits until no call of the handler is running on a dispatch
+    /// thread, and cancels the calls that are queued. @param handler is the
+    /// unregistered handler.
+    void unregistered(EventHandler *handler)
+    {
+#ifdef EVENT_PARALLEL_DISPATCH
+        if (unregisterListener_)
+        {
+            unregisterListener_->handler_unregistered(handler);
+        }
+#endif
+    }
+
     /// Implementations must call this function from register and unregister
-    /// handler to mark iterators being invalidated.
+    /// handler if these invalidate the iterators.
     void set_dirty()
     {
         ++dirtyCounter_;
@@ -284,6 +330,11 @@ private:
     /// change (and thus the event iterators are invalidated).
     unsigned dirtyCounter_ = 0;
 
+#ifdef EVENT_PARALLEL_DISPATCH
+    /// Gets notified of the unregistered handlers, may be null.
+    EventUnregisterListener *unregisterListener_ = nullptr;
+#endif
+
     DISALLOW_COPY_AND_ASSIGN(EventRegistry);
 };
 
@@ -34,6 +34,8 @@
 
 #include "openlcb/EventHandlerContainer.hxx"
 
+#include <climits>
+
 namespace openlcb
 {
 
@@ -47,20 +49,25 @@ void TreeEventHandlers::register_handler(const EventRegistryEntry &entry,
 
 void TreeEventHandlers::unregister_handler(EventHandler *handler)
 {
-    AtomicHolder h(this);
-    set_dirty();
     bool found = false;
-    for (auto r = handlers_.begin(); r != handlers_.end(); ++r) {
-        for (auto it = r->second.begin(); it != r->second.end(); ++it) {
-            if (it->handler == handler)
-            {
-                r->second.erase(it);
-                found = true;
+    {
+        AtomicHolder h(this);
+        set_dirty();
+        for (auto r = handlers_.begin(); r != handlers_.end(); ++r) {
+            for (auto it = r->second.begin(); it != r->second.end(); ++it) {
+                if (it->handler == handler)
+                {
+                    r->second.erase(it);
+                    found = true;
+                }
             }
         }
     }
-    if (found) return;
-    DIE("tried to unregister a handler that was not registered");
+    if (!found)
+    {
+        DIE("tried to unregister a handler that was not registered");
+    }
+    unregistered(handler);
 }
 
 /// Class representing the iteration state on the binary tree-based event
@@ -146,4 +153,250 @@ TreeEventHandlers::TreeEventHandlers()
 {
 }
 
+const uint32_t FlatEventHandlers::EMPTY_SLOT;
+
+FlatEventHandlers::FlatEventHandlers()
+    : snapshots_(new Snapshot(entries_))
+{
+}
+
+void FlatEventHandlers::register_handler(const EventRegistryEntry &entry,
+                                         unsigned mask)
+{
+    HASSERT(mask <= 64);
+    OSMutexLock l(&lock_);
+    entries_.emplace_back(entry, mask);
+    __atomic_store_n(&dirty_, 1, __ATOMIC_RELEASE);
+    snapshots_.reclaim_locked();
+}
+
+void FlatEventHandlers::unregister_handler(EventHandler *handler)
+{
+    {
+        OSMutexLock l(&lock_);
+        auto it = std::remove_if(entries_.begin(), entries_.end(),
+            [handler](const Entry &e) { return e.entry.handler == handler; });
+        if (it == entries_.end())
+        {
+            DIE("tried to unregister a handler that was not registered");
+        }
+        entries_.erase(it, entries_.end());
+        // Frees the snapshots of finished iterations first, so that there are
+        // fewer to update.
+        snapshots_.reclaim_locked();
+        // Iterations that are in progress must not return this handler
+        // anymore.
+        snapshots_.for_each([handler](Snapshot *s) {
+            for (Entry &e : s->entries)
+            {
+                if (e.entry.handler == handler)
+                {
+                    __atomic_store_n(&e.dead, 1, __ATOMIC_RELAXED);
+                }
+            }
+        });
+        __atomic_store_n(&dirty_, 1, __ATOMIC_RELEASE);
+    }
+    unregistered(handler);
+}
+
+FlatEventHandlers::Snapshot::Snapshot(const std::vector<Entry> &sorted_entries)
+    : entries(sorted_entries)
+{
+    // Sizes the index to have at least twice as many slots as entries.
+    indexBits = 4;
+    while ((1U << indexBits) < entries.size() * 2)
+    {
+        ++indexBits;
+    }
+    index.assign(1U << indexBits, EMPTY_SLOT);
+    unsigned slot_mask = index.size() - 1;
+    uint64_t present_masks[2] = {0, 0};
+    for (unsigned i = 0; i < entries.size(); ++i)
+    {
+        const Entry &e = entries[i];
+        unsigned slot = bucket(e.entry.event, e.mask);
+        while (index[slot] != EMPTY_SLOT)
+        {
+            slot = (slot + 1) & slot_mask;
+        }
+        index[slot] = i;
+        present_masks[e.mask >> 6] |= 1ULL << (e.mask & 63);
+    }
+    for (unsigned m = 0; m <= 64; ++m)
+    {
+        if (present_masks[m >> 6] & (1ULL << (m & 63)))
+        {
+            masks.push_back(m);
+        }
+    }
+}
+
+void FlatEventHandlers::publish_locked()
+{
+    if (!dirty_)
+    {
+        return; // Someone else has rebuilt it already.
+    }
+    std::sort(entries_.begin(), entries_.end(),
+        [](const Entry &a, const Entry &b) {
+            return a.entry.event < b.entry.event;
+        });
+    snapshots_.publish_locked(new Snapshot(entries_));
+    __atomic_store_n(&dirty_, 0, __ATOMIC_RELEASE);
+}
+
+FlatEventHandlers::Snapshot *FlatEventHandlers::acquire()
+{
+    if (__atomic_load_n(&dirty_, __ATOMIC_ACQUIRE))
+    {
+        OSMutexLock l(&lock_);
+        publish_locked();
+    }
+    return snapshots_.acquire();
+}
+
+/// Class representing the iteration state on the flat event handler registry.
+class FlatEventHandlers::Iterator : public EventIterator
+{
+public:
+    Iterator(FlatEventHandlers *parent)
+        : parent_(parent)
+        , snapshot_(nullptr)
+    {
+        clear_iteration();
+    }
+
+    ~Iterator()
+    {
+        clear_iteration();
+    }
+
+    EventRegistryEntry *next_entry() OVERRIDE
+    {
+        if (!snapshot_)
+        {
+            return nullptr;
+        }
+        // First phase: hash lookups of the entries that contain rangeStart_.
+        while (maskIndex_ < snapshot_->masks.size())
+        {
+            unsigned mask = snapshot_->masks[maskIndex_];
+            uint64_t start = 0;
+            if (mask < 64)
+            {
+                start = rangeStart_ & ~((1ULL << mask) - 1);
+            }
+            if (slot_ == EMPTY_SLOT)
+            {
+                if (!exactLookup_ && start == rangeStart_)
+                {
+                    // Will be found by the scan phase.
+                    ++maskIndex_;
+                    continue;
+                }
+                slot_ = snapshot_->bucket(start, mask);
+            }
+            uint32_t idx = snapshot_->index[slot_];
+            if (idx == EMPTY_SLOT)
+            {
+                // End of the probe chain.
+                ++maskIndex_;
+                slot_ = EMPTY_SLOT;
+                continue;
+            }
+            slot_ = (slot_ + 1) & (snapshot_->index.size() - 1);
+            Entry &e = snapshot_->entries[idx];
+            if (e.mask == mask && e.entry.event == start && is_live(e))
+            {
+                return &e.entry;
+            }
+        }
+        // Second phase: linear scan of the entries starting within the range.
+        while (scanIndex_ < scanEnd_)
+        {
+            Entry &e = snapshot_->entries[scanIndex_++];
+            if (is_live(e))
+            {
+                return &e.entry;
+            }
+        }
+        // The caller is done with the last returned entry by now, so the
+        // snapshot can be released.
+        clear_iteration();
+        return nullptr;
+    }
+
+    void clear_iteration() OVERRIDE
+    {
+        if (snapshot_)
+        {
+            parent_->release(snapshot_);
+            snapshot_ = nullptr;
+        }
+        maskIndex_ = UINT_MAX;
+        slot_ = EMPTY_SLOT;
+        scanIndex_ = scanEnd_ = 0;
+    }
+
+    void init_iteration(EventReport *r) OVERRIDE
+    {
+        clear_iteration();
+        snapshot_ = parent_->acquire();
+        maskIndex_ = 0;
+        slot_ = EMPTY_SLOT;
+        rangeStart_ = r->event;
+        exactLookup_ = (r->mask == 0);
+        if (exactLookup_)
+        {
+            scanIndex_ = scanEnd_ = 0;
+            return;
+        }
+        uint64_t range_end = r->event + r->mask;
+        if (range_end < r->event)
+        {
+            range_end = UINT64_MAX;
+        }
+        auto &v = snapshot_->entries;
+        scanIndex_ = std::lower_bound(v.begin(), v.end(), rangeStart_,
+                         [](const Entry &e, uint64_t k) {
+                             return e.entry.event < k;
+                         }) - v.begin();
+        scanEnd_ = std::upper_bound(v.begin(), v.end(), range_end,
+                       [](uint64_t k, const Entry &e) {
+                           return k < e.entry.event;
+                       }) - v.begin();
+    }
+
+private:
+    /// @return true if the handler of an entry was not unregistered yet.
+    static bool is_live(Entry &e)
+    {
+        return !__atomic_load_n(&e.dead, __ATOMIC_RELAXED);
+    }
+
+    FlatEventHandlers *parent_;
+    /// The snapshot held for the current iteration, or nullptr if there is
+    /// no iteration in progress.
+    Snapshot *snapshot_;
+    /// First event ID we are looking for.
+    uint64_t rangeStart_;
+    /// Index into snapshot_->masks for the hash lookup phase.
+    unsigned maskIndex_;
+    /// Next slot to probe in the hash index, or EMPTY_SLOT if the probing for
+    /// the current mask has not started yet.
+    uint32_t slot_;
+    /// Next entry to return in the scan phase.
+    unsigned scanIndex_;
+    /// End of the entries to return in the scan phase.
+    unsigned scanEnd_;
+    /// true if the incoming report is for a single event.
+    bool exactLookup_;
+};
+
+EventIterator *FlatEventHandlers::create_iterator()
+{
+    return new Iterator(this);
+}
+
 } // namespace openlcb
@@ -46,8 +46,10 @@
 //#define LOGLEVEL VERBOSE
 #endif
 
+#include "os/OS.hxx"
 #include "utils/Atomic.hxx"
 #include "utils/logging.h"
+#include "utils/SnapshotPublisher.hxx"
 #include "utils/SortedListMap.hxx"
 #include "openlcb/EventHandler.hxx"
 #include "openlcb/EventHandlerTemplates.hxx"
@@ -141,6 +143,7 @@ class VectorEventHandlers : public EventRegistry {
       } predicate(handler);
       handlers_.remove_if(predicate);
       set_dirty();
+      unregistered(handler);
   }
 
  private:
@@ -189,6 +192,142 @@ private:
     MaskLookupMap handlers_;
 };
 
+/// EventRegistry implementation that keeps all event handlers in a single flat
+/// vector sorted by event ID, with an open-addressing hash index keyed by
+/// (aligned event ID, mask width).
+///
+/// A single event (e.g. an incoming PCER) is looked up by one hash probe for
+/// every distinct mask width that is in use, so the lookup cost does not
+/// depend on how many handlers are registered. A range of events (identify
+/// global, range identified) is resolved by probing the hash index for the
+/// entries that contain the beginning of the range and then scanning the
+/// sorted vector for the entries that start inside of the range.
+///
+/// Registration and unregistration are cheap; they only change a master copy
+/// under a mutex. The iterators work on an immutable snapshot of the sorted
+/// vector and the index, which is rebuilt from the master copy when an
+/// iteration starts after a change. The snapshot is published RCU-style with
+/// a @ref SnapshotPublisher, as in @ref RoutingLogic: an iteration acquires
+/// the current snapshot without taking any lock, and old snapshots are freed
+/// once no iteration holds them anymore (epoch-based reclamation). Thus an
+/// iteration never blocks and is never invalidated by a concurrent
+/// registration; get_epoch() does not change. A long iteration (e.g. a
+/// paced identify all) keeps only its own snapshot allocated, so memory and
+/// the cost of unregistration stay bounded by the number of iterators. Handlers registered during an
+/// iteration are not returned by that iteration. Handlers unregistered
+/// during an iteration are not returned either: their entries are marked
+/// dead in every snapshot that is still in use.
+///
+/// This makes the structure suitable for nodes with many thousands of
+/// handlers, like gateways, and for nodes where handlers are registered and
+/// unregistered all the time, like command stations.
+class FlatEventHandlers : public EventRegistry
+{
+public:
+    FlatEventHandlers();
+
+    EventIterator *create_iterator() OVERRIDE;
+    void register_handler(const EventRegistryEntry &entry,
+                          unsigned mask) OVERRIDE;
+    void unregister_handler(EventHandler *handler) OVERRIDE;
+
+    /// @return the number of registry entries.
+    size_t size()
+    {
+        OSMutexLock l(&lock_);
+        return entries_.size();
+    }
+
+    /// @return the number of old snapshots that are not freed yet.
+    size_t num_retired_snapshots()
+    {
+        OSMutexLock l(&lock_);
+        return snapshots_.num_retired_locked();
+    }
+
+private:
+    class Iterator;
+    friend class Iterator;
+
+    /// One registration in the flat table.
+    struct Entry
+    {
+        Entry(const EventRegistryEntry &e, unsigned m)
+            : entry(e)
+            , mask(m)
+        {
+        }
+        /// What the handler registered with.
+        EventRegistryEntry entry;
+        /// How many low bits of the event ID are wildcard (0..64).
+        uint8_t mask;
+        /// Non-zero if the handler was unregistered after this snapshot was
+        /// published. Accessed with atomic operations.
+        uint8_t dead{0};
+    };
+
+    /// Marks an empty slot in the hash index.
+    static const uint32_t EMPTY_SLOT = 0xFFFFFFFFu;
+
+    /// Immutable lookup structure used by the iterators. Only the dead flags
+    /// of the entries are changed after publication.
+    struct Snapshot : public PublishedSnapshot
+    {
+        /// Builds the lookup structure.
+        /// @param sorted_entries are all registrations, sorted by event ID.
+        Snapshot(const std::vector<Entry> &sorted_entries);
+
+        /// Computes the bucket in the hash index.
+        /// @param event is the (aligned) event ID of the entry.
+        /// @param mask is the number of wildcard bits of the entry.
+        /// @return index in the hash table where to start probing.
+        unsigned bucket(uint64_t event, unsigned mask) const
+        {
+            uint64_t h =
+                (event ^ (uint64_t(mask) << 56)) * 0x9E3779B97F4A7C15ULL;
+            return h >> (64 - indexBits);
+        }
+
+        /// All registered entries, sorted by event ID.
+        std::vector<Entry> entries;
+        /// Open-addressing (linear probing) hash table of indexes into
+        /// entries, with at most 50% load factor.
+        std::vector<uint32_t> index;
+        /// The distinct mask values that occur in entries, ascending.
+        std::vector<uint8_t> masks;
+        /// log2 of index.size().
+        uint8_t indexBits;
+    };
+
+    /// Rebuilds the snapshot from the master copy if needed, publishes it,
+    /// and frees the old snapshots that no iterator can see anymore. Must be
+    /// called with the lock held.
+    void publish_locked();
+
+    /// Takes a reference to the current snapshot. Does not take the lock
+    /// unless the snapshot needs to be rebuilt.
+    /// @return the snapshot, which stays valid until release is called.
+    Snapshot *acquire();
+
+    /// Drops a reference taken by acquire.
+    /// @param s is what acquire returned.
+    void release(Snapshot *s)
+    {
+        snapshots_.release(s);
+    }
+
+    /// Protects the master copy and the retired snapshots.
+    OSMutex lock_;
+    /// All registered entries (master copy). Sorted by event ID when dirty_
+    /// is zero.
+    std::vector<Entry> entries_;
+    /// Snapshot used by the iterators, and the old ones that may still be in
+    /// use.
+    SnapshotPublisher<Snapshot> snapshots_;
+    /// Non-zero if the master copy has changed since the snapshot was built.
+    unsigned dirty_{0};
+};
+
 }; /* namespace openlcb */
 
 #endif  // _NMRANET_EVENTHANDLERCONTAINER_HXX_
@@ -13,6 +13,7 @@
 #include "openlcb/EventHandlerContainer.hxx"
 #include "openlcb/Defs.hxx"
 #include "openlcb/EndianHelper.hxx"
+#include "nmranet_config.h"
 
 namespace openlcb
 {
@@ -21,18 +22,20 @@ namespace openlcb
 EventService *EventService::instance = nullptr;
 static AsyncMutex event_caller_mutex;
 
-EventService::EventService(ExecutorBase *e) : Service(e)
+EventService::EventService(ExecutorBase *e, RegistryType registry)
+    : Service(e)
 {
     HASSERT(instance == nullptr);
     instance = this;
-    impl_.reset(new Impl(this));
+    impl_.reset(new Impl(this, registry));
 }
 
-EventService::EventService(If *iface) : Service(iface->executor())
+EventService::EventService(If *iface, RegistryType registry)
+    : Service(iface->executor())
 {
     HASSERT(instance == nullptr);
     instance = this;
-    impl_.reset(new Impl(this));
+    impl_.reset(new Impl(this, registry));
     register_interface(iface);
 }
 
@@ -55,38 +58,420 @@ void EventService::register_interface(If *iface)
         EventService::Impl::MTI_MASK_ADDRESSED_ALL));
 }
 
-EventService::Impl::Impl(EventService *service) : callerFlow_(service)
+EventService::Impl::Impl(
+    EventService *service, EventService::RegistryType registry_type)
+    : callerFlow_(service)
 {
+    if (config_event_identify_rate() > 0)
+    {
+        identifyFlow_.reset(new IdentifyResponseFlow(service,
+            config_event_identify_rate(), config_event_identify_priority(),
+            config_event_identify_merge_ranges() == CONSTANT_TRUE));
+        callerFlow_.set_identify_flow(identifyFlow_.get());
+    }
+    if (registry_type == EventService::REGISTRY_DEFAULT)
+    {
 #ifdef TARGET_LPC11Cxx
-    registry.reset(new VectorEventHandlers());
+        registry_type = EventService::REGISTRY_VECTOR;
+#elif defined(__linux__) || defined(__MACH__)
+        registry_type = EventService::REGISTRY_FLAT;
 #else
-    registry.reset(new TreeEventHandlers());
+        registry_type = EventService::REGISTRY_TREE;
+#endif
+    }
+    switch (registry_type)
+    {
+        case EventService::REGISTRY_VECTOR:
+            registry.reset(new VectorEventHandlers());
+            break;
+        case EventService::REGISTRY_FLAT:
+            registry.reset(new FlatEventHandlers());
+            break;
+        case EventService::REGISTRY_TREE:
+        default:
+            registry.reset(new TreeEventHandlers());
+            break;
+    }
+#ifdef EVENT_PARALLEL_DISPATCH
+    unsigned num_lanes = config_event_dispatch_threads();
+    if (num_lanes > 0)
+    {
+        lanePool_.reset(new FixedPool(
+            sizeof(Buffer<EventHandlerCall>), num_lanes * CALLS_PER_LANE));
+        for (unsigned i = 0; i < num_lanes; ++i)
+        {
+            lanes_.emplace_back(new EventDispatchLane(this));
+            if (identifyFlow_)
+            {
+                lanes_.back()->callerFlow_.set_identify_flow(
+                    identifyFlow_.get());
+            }
+        }
+        registry->set_unregister_listener(this);
+    }
 #endif
 }
 
 EventService::Impl::~Impl()
 {
+#ifdef EVENT_PARALLEL_DISPATCH
+    registry->set_unregister_listener(nullptr);
+#endif
+}
+
+#ifdef EVENT_PARALLEL_DISPATCH
+void EventService::Impl::lane_call_queued(EventHandler *handler)
+{
+    OSMutexLock l(&laneLock_);
+    ++laneCalls_[handler].queued;
+}
+
+bool EventService::Impl::lane_call_start(EventHandler *handler)
+{
+    OSMutexLock l(&laneLock_);
+    auto it = laneCalls_.find(handler);
+    HASSERT(it != laneCalls_.end() && it->second.queued > 0);
+    LaneCalls &c = it->second;
+    --c.queued;
+    if (c.cancelled)
+    {
+        --c.cancelled;
+        if (!c.queued)
+        {
+            laneCalls_.erase(it);
+        }
+        return false;
+    }
+    c.running = true;
+    c.thread = os_thread_self();
+    return true;
+}
+
+void EventService::Impl::lane_call_end(EventHandler *handler)
+{
+    Notifiable *waiter;
+    {
+        OSMutexLock l(&laneLock_);
+        auto it = laneCalls_.find(handler);
+        HASSERT(it != laneCalls_.end() && it->second.running);
+        LaneCalls &c = it->second;
+        c.running = false;
+        waiter = c.waiter;
+        c.waiter = nullptr;
+        if (!c.queued)
+        {
+            laneCalls_.erase(it);
+        }
+    }
+    if (waiter)
+    {
+        waiter->notify();
+    }
+}
+
+void EventService::Impl::handler_unregistered(EventHandler *handler)
+{
+    SyncNotifiable n;
+    {
+        OSMutexLock l(&laneLock_);
+        auto it = laneCalls_.find(handler);
+        if (it == laneCalls_.end())
+        {
+            return;
+        }
+        LaneCalls &c = it->second;
+        // The calls that are sent later are for a new registration.
+        c.cancelled = c.queued;
+        if (!c.running || c.thread == os_thread_self())
+        {
+            // Unregistered from its own call; the lane does not touch the
+            // handler after the call returns.
+            return;
+        }
+        c.waiter = &n;
+    }
+    n.wait_for_notification();
+}
+
+bool EventService::Impl::lanes_busy()
+{
+    if (lanes_.empty())
+    {
+        return false;
+    }
+    if (lanePool_->free_items() != lanes_.size() * CALLS_PER_LANE)
+    {
+        return true;
+    }
+    for (auto &l : lanes_)
+    {
+        if (!l->callerFlow_.is_waiting())
+        {
+            return true;
+        }
+    }
+    return false;
 }
+#endif
 
 StateFlowBase::Action EventCallerFlow::entry()
 {
+    if (laneOwner_)
+    {
+        return call_immediately(STATE(perform_call));
+    }
     return allocate_and_call(STATE(perform_call), &event_caller_mutex);
 }
 
 StateFlowBase::Action EventCallerFlow::perform_call()
 {
-    n_.reset(this);
     EventHandlerCall *c = message()->data();
-    (c->registry_entry->handler->*(c->fn))(*c->registry_entry, c->rep, &n_);
+    EventHandler *handler = c->registry_entry->handler;
+#ifdef EVENT_PARALLEL_DISPATCH
+    if (laneOwner_ && !laneOwner_->lane_call_start(handler))
+    {
+        // The handler was unregistered since this call was queued.
+        return release_and_exit();
+    }
+#endif
+    n_.reset(this);
+    if (identifyFlow_ && c->fn == &EventHandler::handle_identify_global)
+    {
+        WriteHelper::set_interceptor(identifyFlow_);
+    }
+    (handler->*(c->fn))(*c->registry_entry, c->rep, &n_);
+#ifdef EVENT_PARALLEL_DISPATCH
+    if (laneOwner_)
+    {
+        laneOwner_->lane_call_end(handler);
+    }
+#endif
     return wait_and_call(STATE(call_done));
 }
 
 StateFlowBase::Action EventCallerFlow::call_done()
 {
-    event_caller_mutex.Unlock();
+    WriteHelper::set_interceptor(nullptr);
+    if (!laneOwner_)
+    {
+        event_caller_mutex.Unlock();
+    }
     return release_and_exit();
 }
 
+IdentifyResponseFlow::IdentifyResponseFlow(
+    Service *service, unsigned rate, unsigned priority, bool merge_ranges)
+    : StateFlowBase(service)
+    , period_(SEC_TO_NSEC(1) / rate)
+    , priority_(priority)
+    , mergeRanges_(merge_ranges)
+{
+    pending_.reserve(QUEUE_SIZE);
+    start_flow(STATE(next_message));
+}
+
+/// @return true if mti is a producer or consumer identified message.
+static bool is_identified(Defs::MTI mti)
+{
+    switch (mti)
+    {
+        case Defs::MTI_CONSUMER_IDENTIFIED_RANGE:
+        case Defs::MTI_CONSUMER_IDENTIFIED_UNKNOWN:
+        case Defs::MTI_CONSUMER_IDENTIFIED_VALID:
+        case Defs::MTI_CONSUMER_IDENTIFIED_INVALID:
+        case Defs::MTI_CONSUMER_IDENTIFIED_RESERVED:
+        case Defs::MTI_PRODUCER_IDENTIFIED_RANGE:
+        case Defs::MTI_PRODUCER_IDENTIFIED_UNKNOWN:
+        case Defs::MTI_PRODUCER_IDENTIFIED_VALID:
+        case Defs::MTI_PRODUCER_IDENTIFIED_INVALID:
+        case Defs::MTI_PRODUCER_IDENTIFIED_RESERVED:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool IdentifyResponseFlow::intercept(Node *node, Defs::MTI mti,
+    const WriteHelper::payload_type &buffer, Notifiable *done)
+{
+    if (!is_identified(mti) || buffer.size() != 8)
+    {
+        return false;
+    }
+    Pending p{node, mti, NetworkToEventID(buffer.data())};
+    bool wakeup;
+    {
+        AtomicHolder h(this);
+        if (pending_.size() < QUEUE_SIZE && blocked_.empty())
+        {
+            pending_.push_back(p);
+        }
+        else
+        {
+            blocked_.push_back({p, done});
+            done = nullptr;
+        }
+        wakeup = idle_;
+        idle_ = false;
+    }
+    if (done)
+    {
+        done->notify();
+    }
+    if (wakeup)
+    {
+        notify();
+    }
+    return true;
+}
+
+StateFlowBase::Action IdentifyResponseFlow::next_message()
+{
+    bool found;
+    {
+        AtomicHolder h(this);
+        found = take_next(&current_);
+        if (!found)
+        {
+            idle_ = true;
+        }
+    }
+    for (Notifiable *n : toNotify_)
+    {
+        n->notify();
+    }
+    toNotify_.clear();
+    if (!found)
+    {
+        return wait();
+    }
+    return call_immediately(STATE(wait_for_rate));
+}
+
+StateFlowBase::Action IdentifyResponseFlow::wait_for_rate()
+{
+    long long now = os_get_time_monotonic();
+    // After an idle period up to MAX_BURST messages go out back-to-back.
+    long long earliest = now - period_ * (MAX_BURST - 1);
+    if (nextSendTime_ < earliest)
+    {
+        nextSendTime_ = earliest;
+    }
+    if (nextSendTime_ > now)
+    {
+        return sleep_and_call(
+            &timer_, nextSendTime_ - now, STATE(alloc_buffer));
+    }
+    return call_immediately(STATE(alloc_buffer));
+}
+
+StateFlowBase::Action IdentifyResponseFlow::alloc_buffer()
+{
+    return allocate_and_call(current_.node->iface()->global_message_write_flow(),
+        STATE(send_buffer));
+}
+
+StateFlowBase::Action IdentifyResponseFlow::send_buffer()
+{
+    auto *f = current_.node->iface()->global_message_write_flow();
+    auto *b = get_allocation_result(f);
+    b->data()->reset(current_.mti, current_.node->node_id(),
+        eventid_to_buffer(current_.event));
+    b->set_done(n_.reset(this));
+    f->send(b, priority_);
+    nextSendTime_ += period_;
+    return wait_and_call(STATE(next_message));
+}
+
+bool IdentifyResponseFlow::take_next(Pending *out)
+{
+    if (pending_.empty())
+    {
+        return false;
+    }
+    *out = pending_.front();
+    unsigned count = 1;
+    if (mergeRanges_)
+    {
+        count = merge_range(out);
+    }
+    if (count == 1)
+    {
+        pending_.erase(pending_.begin());
+    }
+    // Makes space for the blocked messages.
+    unsigned i = 0;
+    while (i < blocked_.size() && pending_.size() < QUEUE_SIZE)
+    {
+        pending_.push_back(blocked_[i].msg);
+        toNotify_.push_back(blocked_[i].done);
+        ++i;
+    }
+    blocked_.erase(blocked_.begin(), blocked_.begin() + i);
+    return true;
+}
+
+unsigned IdentifyResponseFlow::merge_range(Pending *out)
+{
+    Defs::MTI range_mti;
+    switch (out->mti)
+    {
+        case Defs::MTI_PRODUCER_IDENTIFIED_UNKNOWN:
+            range_mti = Defs::MTI_PRODUCER_IDENTIFIED_RANGE;
+            break;
+        case Defs::MTI_CONSUMER_IDENTIFIED_UNKNOWN:
+            range_mti = Defs::MTI_CONSUMER_IDENTIFIED_RANGE;
+            break;
+        default:
+            return 1;
+    }
+    // Finds the largest aligned block around the front message that is
+    // completely in the queue.
+    unsigned best = 1;
+    for (unsigned size = 2; size <= QUEUE_SIZE; size *= 2)
+    {
+        EventId base = out->event & ~(EventId)(size - 1);
+        uint32_t seen = 0;
+        for (const Pending &p : pending_)
+        {
+            if (p.node == out->node && p.mti == out->mti &&
+                (p.event & ~(EventId)(size - 1)) == base)
+            {
+                seen |= 1u << (p.event - base);
+            }
+        }
+        if (seen != (uint32_t)((1ull << size) - 1))
+        {
+            break;
+        }
+        best = size;
+    }
+    if (best == 1)
+    {
+        return 1;
+    }
+    EventId base = out->event & ~(EventId)(best - 1);
+    unsigned count = 0;
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+        if (it->node == out->node && it->mti == out->mti &&
+            (it->event & ~(EventId)(best - 1)) == base)
+        {
+            it = pending_.erase(it);
+            ++count;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    out->mti = range_mti;
+    // The bit above the block tells whether the mask bits are encoded as
+    // ones or zeros; see DecodeRange.
+    out->event = (base & best) ? base : base | (best - 1);
+    return count;
+}
+
 EventIteratorFlow::EventIteratorFlow(If *async_if, EventService *event_service,
                                      unsigned mti_value, unsigned mti_mask)
     : IncomingMessageStateFlow(async_if)
@@ -108,6 +493,16 @@ EventIteratorFlow::~EventIteratorFlow()
 /// Returns true if there are outstanding events that are not yet handled.
 bool EventService::event_processing_pending()
 {
+    if (impl()->identifyFlow_ && impl()->identifyFlow_->is_busy())
+    {
+        return true;
+    }
+#ifdef EVENT_PARALLEL_DISPATCH
+    if (impl()->lanes_busy())
+    {
+        return true;
+    }
+#endif
     for (auto &f : impl()->ownedFlows_)
     {
         if (!f->is_waiting())
@@ -275,9 +670,39 @@ StateFlowBase::Action EventIteratorFlow::iterate_next()
 
         return exit();
     }
+#ifdef EVENT_PARALLEL_DISPATCH
+    if (!eventService_->impl()->lanes_.empty())
+    {
+        return dispatch_to_lane(entry);
+    }
+#endif
     return dispatch_event(entry);
 }
 
+#ifdef EVENT_PARALLEL_DISPATCH
+StateFlowBase::Action EventIteratorFlow::dispatch_to_lane(
+    const EventRegistryEntry *entry)
+{
+    lane_ = eventService_->impl()->lane_for(entry->handler);
+    laneEntry_ = entry;
+    return allocate_and_call(
+        lane_, STATE(lane_allocated), eventService_->impl()->lanePool_.get());
+}
+
+StateFlowBase::Action EventIteratorFlow::lane_allocated()
+{
+    auto *b = get_allocation_result(lane_);
+    // The iteration moves on before the call is executed, so the call gets
+    // copies of the arguments.
+    b->data()->reset_copy(laneEntry_, &eventReport_, fn_);
+    // The incoming message is released once all calls are done.
+    b->set_done(incomingDone_ ? incomingDone_->new_child() : nullptr);
+    eventService_->impl()->lane_call_queued(laneEntry_->handler);
+    lane_->send(b, priority());
+    return call_immediately(STATE(iterate_next));
+}
+#endif
+
 StateFlowBase::Action EventIteratorFlow::dispatch_event(const EventRegistryEntry *entry)
 {
     Buffer<EventHandlerCall> *b;
@@ -67,11 +67,32 @@ class EventIteratorFlow;
 class EventService : public Service
 {
 public:
-    /** Creates a global event service with no interfaces registered. */
-    EventService(ExecutorBase *e);
+    /// Selects the data structure used for the registry of event handlers.
+    enum RegistryType
+    {
+        /// Chooses the registry based on the target platform.
+        REGISTRY_DEFAULT,
+        /// Every handler gets every call. Smallest code and RAM footprint.
+        REGISTRY_VECTOR,
+        /// Handlers are in sorted lists, one per registration mask width.
+        REGISTRY_TREE,
+        /// Handlers are in a flat sorted array with a hashed index. Lookup
+        /// cost is independent of the number of handlers; suggested for nodes
+        /// with thousands of producers/consumers. Iteration works on a
+        /// snapshot and is not restarted by (un)registrations. Default on
+        /// Linux and Mac hosts.
+        REGISTRY_FLAT,
+    };
+
+    /** Creates a global event service with no interfaces registered.
+     * @param e is the executor to run the event service flows on.
+     * @param registry selects the event registry implementation. */
+    EventService(ExecutorBase *e, RegistryType registry = REGISTRY_DEFAULT);
     /** Creates a global event service that runs on an interface's thread and
-     * registers the interface. */
-    EventService(If *iface);
+     * registers the interface.
+     * @param iface is the interface to register.
+     * @param registry selects the event registry implementation. */
+    EventService(If *iface, RegistryType registry = REGISTRY_DEFAULT);
     ~EventService();
 
     /** Registers this global event handler with an interface. This operation
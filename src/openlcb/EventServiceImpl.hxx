@@ -38,6 +38,7 @@
 #define _NMRANET_EVENTSERVICEIMPL_HXX_
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "openlcb/EventService.hxx"
@@ -65,6 +66,136 @@ struct EventHandlerCall
         this->rep = rep;
         this->fn = fn;
     }
+#ifdef EVENT_PARALLEL_DISPATCH
+    /// Sets the arguments to copies of entry and rep, so that the call may
+    /// outlive the iteration that produced it. @param entry is the handler
+    /// to call. @param rep is the event report. @param fn is the handler
+    /// function to call.
+    void reset_copy(const EventRegistryEntry *entry, const EventReport *rep,
+                    EventHandlerFunction fn)
+    {
+        entryCopy = *entry;
+        reportCopy = *rep;
+        reset(&entryCopy, &reportCopy, fn);
+    }
+
+    /// Storage for the registry entry when set by reset_copy.
+    EventRegistryEntry entryCopy{nullptr, 0};
+    /// Storage for the event report when set by reset_copy.
+    EventReport reportCopy;
+#endif
+};
+
+/// Sends the producer/consumer identified messages that the event handlers
+/// generate in response to an Identify Events message, at a limited rate.
+///
+/// While an identify call is running, the EventCallerFlow installs this
+/// object as the WriteHelper interceptor. Identified messages are copied
+/// into a bounded queue, and the write helper is released right away; when
+/// the queue is full, the write helper (and with it the iteration over the
+/// handlers) waits until there is space. The queue is drained into the
+/// global write flow of the originating node's interface at the configured
+/// rate and queue priority, waiting for each message to reach the physical
+/// layer.
+///
+/// If range merging is enabled, aligned blocks of queued identified messages
+/// with unknown state from the same node are sent as one range identified
+/// message.
+class IdentifyResponseFlow : public StateFlowBase,
+                             public WriteHelper::Interceptor,
+                             private Atomic
+{
+public:
+    /// Maximum number of messages waiting to be sent.
+    static const unsigned QUEUE_SIZE = 32;
+    /// Number of messages that may be sent back-to-back after an idle
+    /// period.
+    static const unsigned MAX_BURST = 4;
+
+    /// Constructor.
+    /// @param service defines the executor to run on.
+    /// @param rate is the maximum number of messages per second.
+    /// @param priority is the queue priority of the outgoing messages.
+    /// @param merge_ranges enables merging messages into range identified
+    /// messages.
+    IdentifyResponseFlow(
+        Service *service, unsigned rate, unsigned priority, bool merge_ranges);
+
+    bool intercept(Node *node, Defs::MTI mti,
+        const WriteHelper::payload_type &buffer, Notifiable *done) OVERRIDE;
+
+    /// @return true if there are messages waiting to be sent.
+    bool is_busy()
+    {
+        AtomicHolder h(this);
+        return !idle_;
+    }
+
+private:
+    /// A queued identified message.
+    struct Pending
+    {
+        /// Originating node.
+        Node *node;
+        /// Message type.
+        Defs::MTI mti;
+        /// Event ID (or encoded range) of the message.
+        EventId event;
+    };
+
+    /// A message that did not fit into the queue.
+    struct Blocked
+    {
+        /// The message.
+        Pending msg;
+        /// Notified when the message made it into the queue.
+        Notifiable *done;
+    };
+
+    /// Picks the next message to send, or waits for one.
+    Action next_message();
+    /// Waits until the rate limit allows sending.
+    Action wait_for_rate();
+    /// Allocates a buffer from the write flow.
+    Action alloc_buffer();
+    /// Sends the current message.
+    Action send_buffer();
+
+    /// Takes the next message off the queue. Must be called with the lock
+    /// held.
+    /// @param out will be filled with the message to send.
+    /// @return false if the queue is empty.
+    bool take_next(Pending *out);
+
+    /// Replaces the message at the front of the queue with a range
+    /// identified message if it is part of an aligned block of queued
+    /// messages. Must be called with the lock held.
+    /// @param out holds the front message and will be updated.
+    /// @return the number of queued messages covered by out.
+    unsigned merge_range(Pending *out);
+
+    /// Queued messages in arrival order.
+    std::vector<Pending> pending_;
+    /// Messages waiting for space in the queue.
+    std::vector<Blocked> blocked_;
+    /// Write helpers to release after taking the lock.
+    std::vector<Notifiable *> toNotify_;
+    /// The message being sent.
+    Pending current_;
+    /// Earliest time for sending the next message.
+    long long nextSendTime_{0};
+    /// Minimum time between two messages.
+    long long period_;
+    /// Queue priority of the outgoing messages.
+    unsigned priority_;
+    /// True if identified messages may be merged into ranges.
+    bool mergeRanges_;
+    /// True while the flow is waiting for messages.
+    bool idle_{false};
+    /// Implements the rate limit.
+    StateFlowTimer timer_{this};
+    /// Notified when the outgoing message reached the physical layer.
+    BarrierNotifiable n_;
 };
 
 /// Control flow that calls individual event handlers one at a time and waits
@@ -72,11 +203,29 @@ struct EventHandlerCall
 /// handler. In essence this control flow behaves as a global lock for the
 /// event handlers being called. This global lock is necessary, because the
 /// event handlers are using global buffers for holding the outgoing packets.
+///
+/// The dispatch lanes (see @ref EventDispatchLane) use one instance each
+/// without the global lock; there the per-thread copies of the global
+/// buffers are protected by the lane's flow calling one handler at a time.
 class EventCallerFlow : public StateFlow<Buffer<EventHandlerCall>, QList<5>>
 {
 public:
-    EventCallerFlow(Service *service)
-        : StateFlow<Buffer<EventHandlerCall>, QList<5>>(service) {};
+    /// Constructor. @param service defines the executor to call the
+    /// handlers on. @param lane_owner is the event service implementation if
+    /// this flow is a dispatch lane; then the calls do not hold the global
+    /// event handler lock. nullptr for the event service's own caller flow.
+    EventCallerFlow(Service *service, EventService::Impl *lane_owner = nullptr)
+        : StateFlow<Buffer<EventHandlerCall>, QList<5>>(service)
+        , laneOwner_(lane_owner)
+    {
+    }
+
+    /// Sets where the identified messages of identify calls go. @param flow
+    /// is the rate limiting flow, or nullptr to send them directly.
+    void set_identify_flow(IdentifyResponseFlow *flow)
+    {
+        identifyFlow_ = flow;
+    }
 
 private:
     virtual Action entry() OVERRIDE;
@@ -84,15 +233,48 @@ private:
     Action call_done();
 
     BarrierNotifiable n_;
+    /// Takes the identified messages of identify calls, if not null.
+    IdentifyResponseFlow *identifyFlow_{nullptr};
+    /// The event service implementation if this flow is a dispatch lane,
+    /// nullptr if the calls hold the global event handler lock.
+    EventService::Impl *laneOwner_;
 };
 
+#ifdef EVENT_PARALLEL_DISPATCH
+/// A thread that calls a subset of the event handlers. The event service
+/// sends every handler's calls to the same lane, chosen by hashing the
+/// handler pointer, which keeps the calls of each handler in order. See
+/// config_event_dispatch_threads().
+class EventDispatchLane
+{
+public:
+    /// @param owner is the event service implementation.
+    EventDispatchLane(EventService::Impl *owner)
+        : executor_("event_dispatch", 0, 2048)
+        , service_(&executor_)
+        , callerFlow_(&service_, owner)
+    {
+    }
+
+    /// Thread of this lane.
+    Executor<1> executor_;
+    /// Service for the flows of this lane.
+    Service service_;
+    /// Calls the handlers of this lane one at a time.
+    EventCallerFlow callerFlow_;
+};
+#endif
+
 /// PImpl class for the EventService. This class creates and owns all
 /// components necessary to the correct operation of the EventService but does
 /// not need to appear on the application-facing API.
 class EventService::Impl
+#ifdef EVENT_PARALLEL_DISPATCH
+    : public EventUnregisterListener
+#endif
 {
 public:
-    Impl(EventService *service);
+    Impl(EventService *service, EventService::RegistryType registry_type);
     ~Impl();
 
     /// The implementation of the event registry.
@@ -106,6 +288,75 @@ public:
     /// calls need to be sent to this flow.
     EventCallerFlow callerFlow_;
 
+    /// Rate limits the responses to Identify Events messages. Null if rate
+    /// limiting is disabled.
+    std::unique_ptr<IdentifyResponseFlow> identifyFlow_;
+
+#ifdef EVENT_PARALLEL_DISPATCH
+    /// How many handler calls may be in flight for each dispatch lane.
+    static const unsigned CALLS_PER_LANE = 8;
+
+    /// @param handler is an event handler.
+    /// @return the flow that calls handler, on the handler's dispatch lane.
+    EventCallerFlow *lane_for(EventHandler *handler)
+    {
+        // The multiplication spreads the aligned pointer bits to the top.
+        uint64_t h = reinterpret_cast<uintptr_t>(handler) *
+            UINT64_C(0x9E3779B97F4A7C15);
+        return &lanes_[(h >> 32) % lanes_.size()]->callerFlow_;
+    }
+
+    /// @return true if there are handler calls in flight on the lanes.
+    bool lanes_busy();
+
+    /// Records that a call of a handler was sent to its lane. Called on the
+    /// event service's executor. @param handler is the handler to be called.
+    void lane_call_queued(EventHandler *handler);
+
+    /// Called by the lane before calling a handler.
+    /// @param handler is the handler to be called.
+    /// @return false if the call must be skipped, because the handler was
+    /// unregistered after the call was queued.
+    bool lane_call_start(EventHandler *handler);
+
+    /// Called by the lane when the handler function returned. @param
+    /// handler is the handler that was called.
+    void lane_call_end(EventHandler *handler);
+
+    /// Cancels the queued calls of the handler and waits until its running
+    /// call (if any) returns. If called from the handler's own call, there is
+    /// nothing to wait for. @param handler is the unregistered handler.
+    void handler_unregistered(EventHandler *handler) OVERRIDE;
+
+    /// Buffers of the handler calls sent to the lanes. Bounds the number of
+    /// calls in flight.
+    std::unique_ptr<FixedPool> lanePool_;
+    /// Threads that the handler calls are dispatched to. Empty if the
+    /// handlers are called on the event service's executor.
+    std::vector<std::unique_ptr<EventDispatchLane>> lanes_;
+
+    /// Calls of one handler that were sent to its dispatch lane.
+    struct LaneCalls
+    {
+        /// Number of calls sent to the lane and not started yet.
+        unsigned queued{0};
+        /// How many of the queued calls have to be skipped because the
+        /// handler was unregistered after they were sent.
+        unsigned cancelled{0};
+        /// True while the handler function is running on the lane.
+        bool running{false};
+        /// The lane thread running the handler function.
+        os_thread_t thread;
+        /// Notified when the running handler function returns. Set by
+        /// handler_unregistered.
+        Notifiable *waiter{nullptr};
+    };
+    /// Protects laneCalls_.
+    OSMutex laneLock_;
+    /// The handlers that have calls queued or running on a lane.
+    std::unordered_map<EventHandler *, LaneCalls> laneCalls_;
+#endif
+
     enum
     {
         // These address/mask should match all the messages carrying an event
@@ -136,6 +387,13 @@ protected:
 
 private:
     virtual Action dispatch_event(const EventRegistryEntry *entry);
+#ifdef EVENT_PARALLEL_DISPATCH
+    /// Sends the call of a handler to the handler's dispatch lane without
+    /// waiting for it to complete. @param entry is the handler to call.
+    Action dispatch_to_lane(const EventRegistryEntry *entry);
+    /// Fills in and sends the handler call once the buffer is allocated.
+    Action lane_allocated();
+#endif
     /// Called when there will be no more dispatch_event calls for this
     /// iteration.
     virtual void no_more_matches() {};
@@ -152,7 +410,7 @@ protected:
     /** This done notifiable holds a reference to the incoming message
      * buffer. We must not release this notifiable until we have completed
      * processing and freed all the buffers related to this iteration. */
-    Notifiable *incomingDone_;
+    BarrierNotifiable *incomingDone_;
     /// The epoch of the event registry at the start of the iteration. Used to
     /// recognize when the iterators are invalidated.
     unsigned eventRegistryEpoch_;
@@ -160,6 +418,13 @@ protected:
     BarrierNotifiable n_;
     EventHandlerFunction fn_;
 
+#ifdef EVENT_PARALLEL_DISPATCH
+    /// The lane that the call being dispatched goes to.
+    EventCallerFlow *lane_;
+    /// The handler being dispatched to lane_.
+    const EventRegistryEntry *laneEntry_;
+#endif
+
 #ifdef DEBUG_EVENT_PERFORMANCE
     static const int REPORT_COUNT = 100;
     /// How many events' cost are accumulated so far.
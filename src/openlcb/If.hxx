@@ -376,6 +376,14 @@ public:
     virtual bool matching_node(NodeHandle expected,
                                NodeHandle actual) = 0;
 
+    /** Fills in the missing fields of a node handle from the caches of the
+     * interface, without doing any network traffic. Fields that cannot be
+     * determined are left as zero.
+     * @param h is the node handle to update. */
+    virtual void canonicalize_handle(NodeHandle *h)
+    {
+    }
+
 protected:
     void remove_local_node_from_map(Node *node) {
         auto it = localNodes_.find(node->node_id());
@@ -707,7 +707,7 @@ void IfCan::add_addressed_message_support()
     if (addressedWriteFlow_)
         return;
     add_owned_flow(new FrameToAddressedMessageParser(this));
-    auto *f = new AddressedCanMessageWriteFlow(this);
+    auto *f = new NonBlockingAddressedCanMessageWriteFlow(this);
     addressedWriteFlow_ = f;
     add_owned_flow(f);
 }
@@ -119,10 +119,11 @@ public:
 
     bool matching_node(NodeHandle expected, NodeHandle actual) OVERRIDE;
 
+    void canonicalize_handle(NodeHandle *h) OVERRIDE;
+
     void delete_local_node(Node *node) override;
 
 private:
-    void canonicalize_handle(NodeHandle* h);
 
     friend class CanFrameWriteFlow; // accesses the device and the hubport.
 
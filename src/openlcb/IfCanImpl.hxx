@@ -40,6 +40,9 @@
 #include "openlcb/IfImpl.hxx"
 #include "openlcb/AliasAllocator.hxx"
 
+#include <map>
+#include <vector>
+
 namespace openlcb
 {
 
@@ -292,8 +295,10 @@ protected:
         HASSERT(dst_.id || dst_.alias); // We must have some kind of address.
         if (dst_.id)
         {
-            dstAlias_ = if_can()->remote_aliases()->lookup(dst_.id);
-            if (dstAlias_ == NOT_RESPONDING)
+            // dstAlias_ is too narrow to hold NOT_RESPONDING.
+            NodeAlias cached = if_can()->remote_aliases()->lookup(dst_.id);
+            dstAlias_ = cached;
+            if (cached == NOT_RESPONDING)
             {
                 LOG(INFO, "AddressedWriteFlow: Could not resolve destination "
                           "address %012" PRIx64
@@ -340,7 +345,10 @@ protected:
         }
     }
 
-    Action find_remote_alias()
+    /** Called when the destination alias is not known. The default
+     * implementation blocks this flow until the lookup completes or times
+     * out. */
+    virtual Action find_remote_alias()
     {
         aliasListener_.RegisterLocalHandler();
         srcAlias_ =
@@ -507,6 +515,401 @@ protected:
 
     StateFlowTimer timer_;
 };
+
+/** Addressed write flow of the interface that never waits for an alias
+ * lookup. A message to a destination whose alias is not known gets parked,
+ * and one lookup (AME, then verify node ID global) runs per destination node
+ * ID; messages to the same node arriving meanwhile join the parked list. The
+ * flow keeps sending to destinations that are already resolved. When the
+ * lookup succeeds, the parked messages are put back into the queue of this
+ * flow in their original order; when it times out they are dropped. */
+class NonBlockingAddressedCanMessageWriteFlow
+    : public AddressedCanMessageWriteFlow
+{
+public:
+    NonBlockingAddressedCanMessageWriteFlow(IfCan *if_can)
+        : AddressedCanMessageWriteFlow(if_can)
+        , lookupListener_(this)
+    {
+    }
+
+    /// Stops the pending lookups. A lookup may be sleeping on its timer or
+    /// be queued on the executor, so this waits until every lookup got off
+    /// the executor. Must not be called on the interface's executor while
+    /// there are lookups pending.
+    ~NonBlockingAddressedCanMessageWriteFlow()
+    {
+        if (lookups_.empty())
+        {
+            return;
+        }
+        ExecutorBase *executor = service()->executor();
+        HASSERT(os_thread_self() != executor->thread_handle());
+        SyncNotifiable n;
+        BarrierNotifiable bn(&n);
+        executor->sync_run([this, &bn]() {
+            lookupListener_.unregister_handlers();
+            for (auto &it : lookups_)
+            {
+                it.second->shutdown(bn.new_child());
+            }
+            lookups_.clear();
+        });
+        bn.notify();
+        n.wait_for_notification();
+    }
+
+    /// @return the number of destination nodes that have a lookup in
+    /// progress or messages waiting to be re-sent. Must be called on the
+    /// interface's executor.
+    size_t num_pending_lookups()
+    {
+        return lookups_.size();
+    }
+
+protected:
+    Action send_to_hardware() OVERRIDE
+    {
+        NodeHandle &dst = nmsg()->dst;
+        if (dst.id && !lookups_.empty())
+        {
+            auto it = lookups_.find(dst.id);
+            if (it != lookups_.end())
+            {
+                PendingLookup *l = it->second;
+                if (message() == l->lastRequeued_)
+                {
+                    // Everything that was in the queue for this destination
+                    // when the lookup completed has been sent by now.
+                    remove_lookup(it);
+                    delete l;
+                }
+                else if (!dst.alias)
+                {
+                    auto *b =
+                        static_cast<Buffer<GenMessage> *>(transfer_message());
+                    if (!l->alias_)
+                    {
+                        l->park(b, priority());
+                        return exit();
+                    }
+                    // Resolved, but the parked messages to this destination
+                    // are still in the queue. Goes behind them.
+                    dst.alias = l->alias_;
+                    l->lastRequeued_ = b;
+                    send(b, priority());
+                    return exit();
+                }
+            }
+        }
+        return AddressedCanMessageWriteFlow::send_to_hardware();
+    }
+
+    Action find_remote_alias() OVERRIDE
+    {
+        NodeID id = nmsg()->dst.id;
+        PendingLookup *l = new PendingLookup(this, id, nmsg()->src.id);
+        if (lookups_.empty())
+        {
+            lookupListener_.register_handlers();
+        }
+        lookups_[id] = l;
+        l->park(static_cast<Buffer<GenMessage> *>(transfer_message()),
+            priority());
+        l->start();
+        return exit();
+    }
+
+private:
+    /// Alias lookup for one destination node ID, holding the messages that
+    /// wait for it.
+    class PendingLookup : public StateFlowBase
+    {
+    public:
+        /// @param parent is the write flow owning *this. @param dst is the
+        /// node ID to look up. @param src is the node ID to send the queries
+        /// from.
+        PendingLookup(NonBlockingAddressedCanMessageWriteFlow *parent,
+            NodeID dst, NodeID src)
+            : StateFlowBase(parent->if_can())
+            , parent_(parent)
+            , dst_(dst)
+            , src_(src)
+            , timer_(this)
+        {
+        }
+
+        ~PendingLookup()
+        {
+            for (auto &p : parked_)
+            {
+                p.first->unref();
+            }
+        }
+
+        /// Adds a message to the list waiting for this lookup. @param b is
+        /// the message (ownership is transferred). @param priority is the
+        /// priority to re-send it with.
+        void park(Buffer<GenMessage> *b, unsigned priority)
+        {
+            parked_.emplace_back(b, priority);
+        }
+
+        /// Starts the lookup.
+        void start()
+        {
+            start_flow(STATE(send_ame));
+        }
+
+        /// Stops the lookup and deletes *this once it is off the executor.
+        /// Must be called on the executor. @param done is notified after
+        /// *this was deleted.
+        void shutdown(Notifiable *done)
+        {
+            if (is_terminated())
+            {
+                // Resolved; only waits for the parent to get to
+                // lastRequeued_.
+                delete this;
+                done->notify();
+                return;
+            }
+            shutdownDone_ = done;
+            // Wakes up the timeout sleeps. Otherwise the flow is waiting for
+            // a buffer or queued on the executor, and will stop in its next
+            // state.
+            timer_.ensure_triggered();
+        }
+
+        /// Called when an alias definition arrives for the destination node.
+        /// @param alias is the alias of the destination node.
+        void resolved(NodeAlias alias)
+        {
+            if (alias_)
+            {
+                return;
+            }
+            alias_ = alias;
+            timer_.ensure_triggered();
+        }
+
+        /// Resolved alias, or zero while the lookup is in progress.
+        NodeAlias alias_{0};
+        /// The last message that was put back into the parent's queue after
+        /// the lookup completed.
+        Buffer<GenMessage> *lastRequeued_{nullptr};
+
+    private:
+        IfCan *if_can()
+        {
+            return parent_->if_can();
+        }
+
+        /// Deletes *this after shutdown was called. @return the action to
+        /// return from the state.
+        Action shut_down()
+        {
+            Notifiable *done = shutdownDone_;
+            Action a = delete_this();
+            done->notify();
+            return a;
+        }
+
+        Action send_ame()
+        {
+            if (shutdownDone_)
+            {
+                return shut_down();
+            }
+            srcAlias_ = if_can()->local_aliases()->lookup(src_);
+            if (!srcAlias_)
+            {
+                // No local alias -- the verify node ID global will allocate
+                // one.
+                return call_immediately(STATE(send_verify_nodeid_global));
+            }
+            return allocate_and_call(
+                if_can()->frame_write_flow(), STATE(fill_ame_frame));
+        }
+
+        Action fill_ame_frame()
+        {
+            auto *b = get_allocation_result(if_can()->frame_write_flow());
+            if (shutdownDone_)
+            {
+                b->unref();
+                return shut_down();
+            }
+            struct can_frame *f = b->data();
+            CanDefs::control_init(*f, srcAlias_, CanDefs::AME_FRAME, 0);
+            f->can_dlc = 6;
+            uint64_t rd = htobe64(dst_);
+            memcpy(f->data, reinterpret_cast<uint8_t *>(&rd) + 2, 6);
+            if_can()->frame_write_flow()->send(b);
+            if (alias_)
+            {
+                return call_immediately(STATE(lookup_done));
+            }
+            return sleep_and_call(&timer_,
+                ADDRESSED_MESSAGE_LOOKUP_TIMEOUT_NSEC,
+                STATE(send_verify_nodeid_global));
+        }
+
+        Action send_verify_nodeid_global()
+        {
+            if (shutdownDone_)
+            {
+                return shut_down();
+            }
+            if (alias_)
+            {
+                return call_immediately(STATE(lookup_done));
+            }
+            return allocate_and_call(if_can()->global_message_write_flow(),
+                STATE(fill_verify_nodeid_global));
+        }
+
+        Action fill_verify_nodeid_global()
+        {
+            auto *b =
+                get_allocation_result(if_can()->global_message_write_flow());
+            if (shutdownDone_)
+            {
+                b->unref();
+                return shut_down();
+            }
+            b->data()->reset(Defs::MTI_VERIFY_NODE_ID_GLOBAL, src_,
+                node_id_to_buffer(dst_));
+            if_can()->global_message_write_flow()->send(b);
+            if (alias_)
+            {
+                return call_immediately(STATE(lookup_done));
+            }
+            return sleep_and_call(&timer_,
+                ADDRESSED_MESSAGE_LOOKUP_TIMEOUT_NSEC, STATE(lookup_done));
+        }
+
+        Action lookup_done()
+        {
+            if (shutdownDone_)
+            {
+                return shut_down();
+            }
+            if (!alias_)
+            {
+                LOG(INFO, "AddressedWriteFlow: Could not resolve destination "
+                          "address %012" PRIx64 " to an alias on the bus. "
+                          "Dropping %u packets.",
+                    dst_, (unsigned)parked_.size());
+                if_can()->remote_aliases()->add(dst_, NOT_RESPONDING);
+                parent_->remove_lookup(parent_->lookups_.find(dst_));
+                return delete_this();
+            }
+            if_can()->remote_aliases()->add(dst_, alias_);
+            for (auto &p : parked_)
+            {
+                p.first->data()->dst.alias = alias_;
+                parent_->send(p.first, p.second);
+            }
+            lastRequeued_ = parked_.back().first;
+            parked_.clear();
+            // The parent deletes *this when it gets to lastRequeued_.
+            return exit();
+        }
+
+        /// Write flow owning *this.
+        NonBlockingAddressedCanMessageWriteFlow *parent_;
+        /// Node ID we are looking for.
+        NodeID dst_;
+        /// Node ID the queries are sent from.
+        NodeID src_;
+        /// Alias of the source node.
+        NodeAlias srcAlias_{0};
+        /// Messages waiting for the lookup, with their priorities.
+        std::vector<std::pair<Buffer<GenMessage> *, unsigned>> parked_;
+        /// Wakes us up from the timeout sleeps.
+        StateFlowTimer timer_;
+        /// Set by shutdown; notified when *this is deleted.
+        Notifiable *shutdownDone_{nullptr};
+    };
+
+    /// Listens to the alias definitions of the nodes we are looking for.
+    class LookupListener : public IncomingFrameHandler
+    {
+    public:
+        /// @param parent is the write flow owning *this.
+        LookupListener(NonBlockingAddressedCanMessageWriteFlow *parent)
+            : parent_(parent)
+        {
+        }
+
+        /// Starts receiving alias definition frames.
+        void register_handlers()
+        {
+            auto *d = parent_->if_can()->frame_dispatcher();
+            d->register_handler(this, AliasDefListener::CAN_FILTER1,
+                AliasDefListener::CAN_MASK1);
+            d->register_handler(this, AliasDefListener::CAN_FILTER2,
+                AliasDefListener::CAN_MASK2);
+            d->register_handler(this, AliasDefListener::CAN_FILTER3,
+                AliasDefListener::CAN_MASK3);
+        }
+
+        /// Stops receiving alias definition frames.
+        void unregister_handlers()
+        {
+            auto *d = parent_->if_can()->frame_dispatcher();
+            d->unregister_handler(this, AliasDefListener::CAN_FILTER1,
+                AliasDefListener::CAN_MASK1);
+            d->unregister_handler(this, AliasDefListener::CAN_FILTER2,
+                AliasDefListener::CAN_MASK2);
+            d->unregister_handler(this, AliasDefListener::CAN_FILTER3,
+                AliasDefListener::CAN_MASK3);
+        }
+
+        /// Handler callback for incoming messages.
+        void send(Buffer<CanMessageData> *message, unsigned priority) OVERRIDE
+        {
+            AutoReleaseBuffer<CanMessageData> ab(message);
+            struct can_frame *f = message->data();
+            if (f->can_dlc != 6)
+            {
+                // Not sending a node ID.
+                return;
+            }
+            NodeAlias alias = GET_CAN_FRAME_ID_EFF(*f) & CanDefs::SRC_MASK;
+            if (!alias)
+            {
+                return;
+            }
+            auto it = parent_->lookups_.find(data_to_node_id(f->data));
+            if (it != parent_->lookups_.end())
+            {
+                it->second->resolved(alias);
+            }
+        }
+
+    private:
+        /// Write flow owning *this.
+        NonBlockingAddressedCanMessageWriteFlow *parent_;
+    };
+
+    /// Removes a lookup from the map, without deleting it. @param it points
+    /// to the lookup.
+    void remove_lookup(std::map<NodeID, PendingLookup *>::iterator it)
+    {
+        lookups_.erase(it);
+        if (lookups_.empty())
+        {
+            lookupListener_.unregister_handlers();
+        }
+    }
+
+    /// Lookups by destination node ID.
+    std::map<NodeID, PendingLookup *> lookups_;
+    /// Receives the alias definitions for lookups_.
+    LookupListener lookupListener_;
+};
 } // namespace openlcb
 
 #endif //_NMRANET_IFCANIMPL_HXX_
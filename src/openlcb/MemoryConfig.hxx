@@ -38,6 +38,7 @@
 #include "openlcb/DatagramDefs.hxx"
 #include "openlcb/DatagramHandlerDefault.hxx"
 #include "openlcb/MemoryConfig.hxx"
+#include "openlcb/StreamDefs.hxx"
 #include "utils/Destructable.hxx"
 #include "utils/ConfigUpdateService.hxx"
 
@@ -75,6 +76,8 @@ struct MemoryConfigDefs {
         COMMAND_READ_REPLY        = 0x50, /**< reply to read data from address space */
         COMMAND_READ_FAILED       = 0x58, /**< failed to read data from address space */
         COMMAND_READ_STREAM       = 0x60, /**< command to read data using a stream */
+        COMMAND_READ_STREAM_REPLY = 0x70, /**< reply to read data using a stream */
+        COMMAND_READ_STREAM_FAILED= 0x78, /**< failed to read data using a stream */
         COMMAND_OPTIONS           = 0x80,
         COMMAND_OPTIONS_REPLY     = 0x82,
         COMMAND_INFORMATION       = 0x84,
@@ -192,7 +195,42 @@ struct MemoryConfigDefs {
         p.push_back(length);
         return p;
     }
-    
+
+    /// Creates a Read Stream command datagram.
+    /// @param space is the memory space to read from.
+    /// @param offset is the first address to read.
+    /// @param dst_stream_id is the stream ID of the receiver (the caller).
+    /// @param length is the number of bytes to read, or 0 to read until the
+    /// end of the space.
+    static DatagramPayload read_stream_datagram(uint8_t space,
+        uint32_t offset, uint8_t dst_stream_id, uint32_t length)
+    {
+        DatagramPayload p = read_datagram(space, offset, 0);
+        p[1] |= COMMAND_READ_STREAM;
+        p.pop_back();
+        p.push_back(StreamDefs::INVALID_STREAM_ID);
+        p.push_back(dst_stream_id);
+        p.push_back(0xff & (length >> 24));
+        p.push_back(0xff & (length >> 16));
+        p.push_back(0xff & (length >> 8));
+        p.push_back(0xff & (length));
+        return p;
+    }
+
+    /// Creates a Write Stream command datagram. The destination stream ID is
+    /// assigned by the target node when the stream is opened.
+    /// @param space is the memory space to write to.
+    /// @param offset is the first address to write.
+    static DatagramPayload write_stream_datagram(uint8_t space,
+        uint32_t offset)
+    {
+        DatagramPayload p = write_datagram(space, offset);
+        p[1] |= COMMAND_WRITE_STREAM;
+        p.push_back(StreamDefs::INVALID_STREAM_ID);
+        p.push_back(StreamDefs::INVALID_STREAM_ID);
+        return p;
+    }
+
 private:
     /** Do not instantiate this class. */
     MemoryConfigDefs();
@@ -516,6 +554,21 @@ public:
         HASSERT(client_ == client);
         client_ = nullptr;
     }
+
+    /// Registers a handler to forward the stream read and write commands
+    /// to. Without one, these commands are rejected as unimplemented.
+    void set_stream_handler(DatagramHandlerFlow *handler)
+    {
+        HASSERT(streamHandler_ == nullptr || streamHandler_ == handler);
+        streamHandler_ = handler;
+    }
+
+    /// Unregisters the previously registered stream handler.
+    void clear_stream_handler(DatagramHandlerFlow *handler)
+    {
+        HASSERT(streamHandler_ == handler);
+        streamHandler_ = nullptr;
+    }
     
 private:
     typedef MemorySpace::address_t address_t;
@@ -535,15 +588,34 @@ private:
 
         uint8_t cmd = bytes[1];
 
-        if ((cmd & MemoryConfigDefs::COMMAND_MASK) ==
-            MemoryConfigDefs::COMMAND_READ)
-        {
-            return call_immediately(STATE(handle_read));
-        }
-        else if ((cmd & MemoryConfigDefs::COMMAND_MASK) ==
-                 MemoryConfigDefs::COMMAND_WRITE)
+        switch (cmd & MemoryConfigDefs::COMMAND_MASK)
         {
-            return call_immediately(STATE(handle_write));
+            case MemoryConfigDefs::COMMAND_READ:
+                return call_immediately(STATE(handle_read));
+            case MemoryConfigDefs::COMMAND_WRITE:
+                return call_immediately(STATE(handle_write));
+            case MemoryConfigDefs::COMMAND_READ_STREAM:
+            case MemoryConfigDefs::COMMAND_WRITE_STREAM:
+                if (streamHandler_)
+                {
+                    streamHandler_->send(transfer_message());
+                    return exit();
+                }
+                return respond_reject(Defs::ERROR_UNIMPLEMENTED_SUBCMD);
+            case MemoryConfigDefs::COMMAND_READ_STREAM_REPLY:
+            case MemoryConfigDefs::COMMAND_READ_STREAM_FAILED:
+            case MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY:
+            case MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED:
+                // These carry the space in the low bits of the command byte,
+                // so they cannot go to the switch below.
+                if (client_)
+                {
+                    client_->send(transfer_message());
+                    return exit();
+                }
+                return respond_reject(Defs::ERROR_UNIMPLEMENTED_SUBCMD);
+            default:
+                break;
         }
         switch (cmd)
         {
@@ -597,8 +669,6 @@ private:
             }
             case MemoryConfigDefs::COMMAND_WRITE_REPLY:
             case MemoryConfigDefs::COMMAND_WRITE_FAILED:
-            case MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY:
-            case MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED:
             case MemoryConfigDefs::COMMAND_READ_REPLY:
             case MemoryConfigDefs::COMMAND_READ_FAILED:
             case MemoryConfigDefs::COMMAND_OPTIONS_REPLY:
@@ -693,9 +763,14 @@ private:
         response_.push_back(available_commands >> 8);
         response_.push_back(available_commands & 0xff);
         // Write lengths
-        response_.push_back(static_cast<char> (
-            MemoryConfigDefs::LENGTH_1 | MemoryConfigDefs::LENGTH_2 |
-            MemoryConfigDefs::LENGTH_4 | MemoryConfigDefs::LENGTH_ARBITRARY));
+        uint8_t write_lengths = MemoryConfigDefs::LENGTH_1 |
+            MemoryConfigDefs::LENGTH_2 | MemoryConfigDefs::LENGTH_4 |
+            MemoryConfigDefs::LENGTH_ARBITRARY;
+        if (streamHandler_)
+        {
+            write_lengths |= MemoryConfigDefs::LENGTH_STREAM;
+        }
+        response_.push_back(static_cast<char>(write_lengths));
 
         uint8_t min_space = 0xFF;
         uint8_t max_space = 0;
@@ -1089,6 +1164,8 @@ private:
     /// If there is a memory config client, we will forward response traffic to
     /// it.
     DatagramHandlerFlow* client_{nullptr};
+    /// Handler for the stream read and write commands.
+    DatagramHandlerFlow *streamHandler_{nullptr};
 
     /** Offset withing the current write/read datagram. This does not include
      * the offset from the incoming datagram. */
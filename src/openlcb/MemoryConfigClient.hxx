@@ -38,6 +38,7 @@
 #include "executor/CallableFlow.hxx"
 #include "openlcb/MemoryConfig.hxx"
 #include "openlcb/DatagramHandlerDefault.hxx"
+#include "openlcb/Stream.hxx"
 
 namespace openlcb
 {
@@ -62,26 +63,99 @@ struct MemoryConfigClientRequest : public CallableFlowRequestBase
         payload.clear();
     }
 
+    enum ReadStreamCmd
+    {
+        READ_STREAM
+    };
+
+    /// Sets up a command to read a memory space using a stream. Needs a
+    /// MemoryConfigClient with a StreamService.
+    /// @param ReadStreamCmd polymorphic matching arg; always set to
+    /// READ_STREAM.
+    /// @param d is the destination node to query
+    /// @param space is the memory space to read out
+    /// @param offset is the first address to read
+    /// @param length is the number of bytes to read; 0 to read until the end
+    /// of the space.
+    void reset(ReadStreamCmd, NodeHandle d, uint8_t space, uint32_t offset = 0,
+        uint32_t length = 0)
+    {
+        reset_base();
+        cmd = CMD_READ_STREAM;
+        memory_space = space;
+        dst = d;
+        address = offset;
+        size = length;
+        payload.clear();
+    }
+
+    enum WriteStreamCmd
+    {
+        WRITE_STREAM
+    };
+
+    /// Sets up a command to write a memory space using a stream. Needs a
+    /// MemoryConfigClient with a StreamService.
+    /// @param WriteStreamCmd polymorphic matching arg; always set to
+    /// WRITE_STREAM.
+    /// @param d is the destination node
+    /// @param space is the memory space to write
+    /// @param offset is the first address to write
+    /// @param data is the data to write.
+    void reset(WriteStreamCmd, NodeHandle d, uint8_t space, uint32_t offset,
+        string data)
+    {
+        reset_base();
+        cmd = CMD_WRITE_STREAM;
+        memory_space = space;
+        dst = d;
+        address = offset;
+        payload.swap(data);
+        size = payload.size();
+    }
+
     enum Command : uint8_t
     {
         CMD_READ,
-        CMD_WRITE
+        CMD_WRITE,
+        CMD_READ_STREAM,
+        CMD_WRITE_STREAM
     };
     Command cmd;
     uint8_t memory_space;
     /// Node to send the request to.
     NodeHandle dst;
+    /// First address to read or write (stream commands only).
+    uint32_t address;
+    /// Number of bytes to read or write (stream commands only).
+    uint32_t size;
     string payload;
 };
 
 class MemoryConfigClient : public CallableFlow<MemoryConfigClientRequest>
 {
 public:
-    MemoryConfigClient(Node *node, MemoryConfigHandler *memcfg)
+    /// Constructor.
+    /// @param node is the local node to send the requests from.
+    /// @param memcfg is the memory config handler of the local node.
+    /// @param streams is the stream transport to use for the stream
+    /// commands; may be nullptr if those are not needed.
+    /// @param max_buffer_size is the largest stream window to grant to the
+    /// remote node for stream reads.
+    MemoryConfigClient(Node *node, MemoryConfigHandler *memcfg,
+        StreamService *streams = nullptr,
+        uint16_t max_buffer_size = StreamReceiveRequest::DEFAULT_BUFFER_SIZE)
         : CallableFlow<MemoryConfigClientRequest>(memcfg->dg_service())
         , node_(node)
         , memoryConfigHandler_(memcfg)
+        , streams_(streams)
+        , maxBufferSize_(max_buffer_size)
     {
+        if (streams_)
+        {
+            streamSender_.reset(new StreamSender(streams_));
+            streamReceiver_.reset(new StreamReceiver(streams_));
+        }
     }
 
 private:
@@ -92,11 +166,188 @@ private:
         case MemoryConfigClientRequest::CMD_READ:
                 return allocate_and_call(
                     STATE(do_read), dg_service()->client_allocator());
+        case MemoryConfigClientRequest::CMD_READ_STREAM:
+        case MemoryConfigClientRequest::CMD_WRITE_STREAM:
+            if (!streams_)
+            {
+                break;
+            }
+            return allocate_and_call(
+                STATE(do_stream), dg_service()->client_allocator());
         default: break;
         }
         return return_with_error(Defs::ERROR_UNIMPLEMENTED_SUBCMD);
     }
 
+    Action do_stream()
+    {
+        dgClient_ = full_allocation_result(dg_service()->client_allocator());
+        memoryConfigHandler_->set_client(&responseFlow_);
+        streamError_ = 0;
+        if (request()->cmd == MemoryConfigClientRequest::CMD_READ_STREAM)
+        {
+            uint8_t id = streams_->alloc_stream_id();
+            if (id == StreamDefs::INVALID_STREAM_ID)
+            {
+                cleanup_read();
+                return return_with_error(Defs::ERROR_TEMPORARY);
+            }
+            // The receiver must be waiting before the remote node opens the
+            // stream.
+            mainBufferPool->alloc(&rxRequest_);
+            rxRequest_->data()->reset(
+                node_, request()->dst, id, maxBufferSize_);
+            rxRequest_->data()->done.reset(streamBn_.reset(this)->new_child());
+            streamReceiver_->send(rxRequest_->ref());
+        }
+        return allocate_and_call(
+            dg_service()->iface()->dispatcher(), STATE(send_stream_datagram));
+    }
+
+    Action send_stream_datagram()
+    {
+        auto *b = get_allocation_result(dg_service()->iface()->dispatcher());
+        b->set_done(bn_.reset(this));
+        if (request()->cmd == MemoryConfigClientRequest::CMD_READ_STREAM)
+        {
+            b->data()->reset(Defs::MTI_DATAGRAM, node_->node_id(),
+                request()->dst,
+                MemoryConfigDefs::read_stream_datagram(request()->memory_space,
+                    request()->address, rxRequest_->data()->localStreamId,
+                    request()->size));
+        }
+        else
+        {
+            b->data()->reset(Defs::MTI_DATAGRAM, node_->node_id(),
+                request()->dst,
+                MemoryConfigDefs::write_stream_datagram(
+                    request()->memory_space, request()->address));
+        }
+        isWaitingForTimer_ = 0;
+        responseCode_ = DatagramClient::OPERATION_PENDING;
+        dgClient_->write_datagram(b);
+        return wait_and_call(STATE(stream_datagram_sent));
+    }
+
+    Action stream_datagram_sent()
+    {
+        if (!(dgClient_->result() & DatagramClient::OPERATION_SUCCESS))
+        {
+            streamError_ = dgClient_->result() & 0xFFFF
+                ? dgClient_->result() & 0xFFFF
+                : Defs::ERROR_TEMPORARY;
+        }
+        if (request()->cmd == MemoryConfigClientRequest::CMD_WRITE_STREAM)
+        {
+            if (streamError_)
+            {
+                return stream_finish(streamError_);
+            }
+            return invoke_subflow_and_wait(streamSender_.get(),
+                STATE(write_stream_sent), node_, request()->dst,
+                &request()->payload);
+        }
+        if (streamError_)
+        {
+            streamReceiver_->cancel();
+        }
+        streamBn_.notify();
+        return wait_and_call(STATE(read_stream_received));
+    }
+
+    Action write_stream_sent()
+    {
+        auto *b = full_allocation_result(streamSender_.get());
+        int result = b->data()->resultCode;
+        // Gives back the data to the caller.
+        b->data()->payload.swap(request()->payload);
+        b->unref();
+        if (result)
+        {
+            return stream_finish(result);
+        }
+        return call_immediately(STATE(wait_for_stream_reply));
+    }
+
+    Action read_stream_received()
+    {
+        int result = rxRequest_->data()->resultCode;
+        request()->payload.swap(rxRequest_->data()->payload);
+        rxRequest_->unref();
+        rxRequest_ = nullptr;
+        if (streamError_)
+        {
+            return stream_finish(streamError_);
+        }
+        if (result)
+        {
+            return stream_finish(result);
+        }
+        return call_immediately(STATE(wait_for_stream_reply));
+    }
+
+    Action wait_for_stream_reply()
+    {
+        if (responseCode_ & DatagramClient::OPERATION_PENDING)
+        {
+            isWaitingForTimer_ = 1;
+            return sleep_and_call(
+                &timer_, SEC_TO_NSEC(3), STATE(stream_reply_timeout));
+        }
+        return call_immediately(STATE(stream_reply_timeout));
+    }
+
+    /// Parses the Read Stream Reply or Write Stream Reply datagram.
+    Action stream_reply_timeout()
+    {
+        isWaitingForTimer_ = 0;
+        if (responseCode_ & DatagramClient::OPERATION_PENDING)
+        {
+            return stream_finish(Defs::OPENMRN_TIMEOUT);
+        }
+        size_t len = responsePayload_.size();
+        const uint8_t *bytes = (const uint8_t *)responsePayload_.data();
+        unsigned ofs = (len >= 2 && (bytes[1] & 3)) ? 6 : 7;
+        if (len < ofs)
+        {
+            return stream_finish(Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT);
+        }
+        uint8_t cmd = bytes[1] & ~3;
+        bool is_read =
+            request()->cmd == MemoryConfigClientRequest::CMD_READ_STREAM;
+        uint8_t ok_cmd = is_read ? MemoryConfigDefs::COMMAND_READ_STREAM_REPLY
+                                 : MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY;
+        uint8_t failed_cmd = is_read
+            ? MemoryConfigDefs::COMMAND_READ_STREAM_FAILED
+            : MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED;
+        if (cmd == failed_cmd)
+        {
+            if (len < ofs + 2)
+            {
+                return stream_finish(
+                    Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT);
+            }
+            return stream_finish((bytes[ofs] << 8) | bytes[ofs + 1]);
+        }
+        if (cmd != ok_cmd)
+        {
+            return stream_finish(Defs::ERROR_OUT_OF_ORDER);
+        }
+        return stream_finish(0);
+    }
+
+    /// Releases the resources of a stream command and terminates the flow.
+    /// @param error is the result code to return.
+    Action stream_finish(int error)
+    {
+        cleanup_read();
+        if (error && request()->cmd == MemoryConfigClientRequest::CMD_READ_STREAM)
+        {
+            request()->payload.clear();
+        }
+        return return_with_error(error);
+    }
+
     Action do_read()
     {
         dgClient_ = full_allocation_result(dg_service()->client_allocator());
@@ -265,6 +516,10 @@ private:
             {
                 case MemoryConfigDefs::COMMAND_READ_REPLY:
                 case MemoryConfigDefs::COMMAND_READ_FAILED:
+                case MemoryConfigDefs::COMMAND_READ_STREAM_REPLY:
+                case MemoryConfigDefs::COMMAND_READ_STREAM_FAILED:
+                case MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY:
+                case MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED:
                 {
                     parent_->responseCode_ = 0;
                     message()->data()->payload.swap(parent_->responsePayload_);
@@ -290,6 +545,20 @@ private:
     Node *node_;
     /// Hook into the parent node's memory config handler service.
     MemoryConfigHandler *memoryConfigHandler_;
+    /// Stream transport for the stream commands, or nullptr.
+    StreamService *streams_;
+    /// Largest stream window to grant for stream reads.
+    uint16_t maxBufferSize_;
+    /// Sends the data of stream writes.
+    std::unique_ptr<StreamSender> streamSender_;
+    /// Receives the data of stream reads.
+    std::unique_ptr<StreamReceiver> streamReceiver_;
+    /// Request being processed by streamReceiver_; holds a reference.
+    Buffer<StreamReceiveRequest> *rxRequest_{nullptr};
+    /// Notified when the stream receiver is done.
+    BarrierNotifiable streamBn_;
+    /// Error code from sending the stream command datagram.
+    int streamError_;
     /// The allocated datagram client which we hold on for the time that we are
     /// querying.
     DatagramClient *dgClient_{nullptr};
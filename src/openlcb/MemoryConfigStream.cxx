@@ -0,0 +1,378 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file MemoryConfigStream.cxx
+ *
+ * Handles the stream-based read and write commands of the memory
+ * configuration protocol.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#include "openlcb/MemoryConfigStream.hxx"
+
+#include <algorithm>
+
+namespace openlcb
+{
+
+MemoryConfigStreamHandler::MemoryConfigStreamHandler(
+    MemoryConfigHandler *memcfg, StreamService *streams,
+    uint16_t max_buffer_size)
+    : DefaultDatagramHandler(memcfg->dg_service())
+    , memcfg_(memcfg)
+    , streams_(streams)
+    , maxBufferSize_(max_buffer_size)
+{
+    memcfg_->set_stream_handler(this);
+}
+
+MemoryConfigStreamHandler::~MemoryConfigStreamHandler()
+{
+    memcfg_->clear_stream_handler(this);
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::entry()
+{
+    const uint8_t *bytes = payload();
+    size_t len = size();
+    // Checked by the MemoryConfigHandler.
+    HASSERT(len >= 2);
+    uint8_t cmd = bytes[1];
+    isRead_ = (cmd & MemoryConfigDefs::COMMAND_MASK) ==
+        MemoryConfigDefs::COMMAND_READ_STREAM;
+    bool has_custom_space = !(cmd & ~MemoryConfigDefs::COMMAND_MASK);
+    unsigned ofs = has_custom_space ? 7 : 6;
+    // Source and destination stream ID, then the count for reads.
+    if (len < ofs + (isRead_ ? 6 : 2))
+    {
+        return respond_reject(Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT);
+    }
+    uint8_t space_number = has_custom_space
+        ? bytes[6]
+        : MemoryConfigDefs::COMMAND_MASK +
+            (cmd & ~MemoryConfigDefs::COMMAND_MASK);
+    dst_ = message()->data()->dst;
+    src_ = message()->data()->src;
+    space_ = memcfg_->registry()->lookup(dst_, space_number);
+    if (!space_ || !space_->set_node(dst_))
+    {
+        return respond_reject(MemoryConfigDefs::ERROR_SPACE_NOT_KNOWN);
+    }
+    requestHeaderLen_ = ofs - 1;
+    memcpy(requestHeader_, bytes + 1, requestHeaderLen_);
+    address_ = bytes[2];
+    address_ <<= 8;
+    address_ |= bytes[3];
+    address_ <<= 8;
+    address_ |= bytes[4];
+    address_ <<= 8;
+    address_ |= bytes[5];
+    dstStreamId_ = bytes[ofs + 1];
+    if (isRead_)
+    {
+        length_ = bytes[ofs + 2];
+        length_ <<= 8;
+        length_ |= bytes[ofs + 3];
+        length_ <<= 8;
+        length_ |= bytes[ofs + 4];
+        length_ <<= 8;
+        length_ |= bytes[ofs + 5];
+        address_t max = space_->max_address();
+        if (address_ > max)
+        {
+            return respond_reject(MemoryConfigDefs::ERROR_OUT_OF_BOUNDS);
+        }
+        size_t available = size_t(max - address_) + 1;
+        if (!length_ || length_ > available)
+        {
+            // Zero means reading until the end of the space.
+            length_ = available;
+        }
+        return respond_ok(DatagramClient::REPLY_PENDING);
+    }
+    if (space_->read_only())
+    {
+        return respond_reject(MemoryConfigDefs::ERROR_WRITE_TO_RO);
+    }
+    dstStreamId_ = streams_->alloc_stream_id();
+    if (dstStreamId_ == StreamDefs::INVALID_STREAM_ID)
+    {
+        return respond_reject(DatagramClient::RESEND_OK);
+    }
+    // The receiver has to be waiting by the time the requester sees the
+    // datagram acknowledged and opens the stream.
+    mainBufferPool->alloc(&rxRequest_);
+    rxRequest_->data()->reset(dst_, src_, dstStreamId_, maxBufferSize_);
+    rxRequest_->data()->drain = this;
+    rxRequest_->data()->done.reset(bn_.reset(this)->new_child());
+    receiver_.send(rxRequest_->ref());
+    return respond_ok(DatagramClient::REPLY_PENDING);
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::ok_response_sent()
+{
+    release();
+    currentOffset_ = 0;
+    chunkOffset_ = 0;
+    transferError_ = 0;
+    data_.clear();
+    if (isRead_)
+    {
+        string empty;
+        mainBufferPool->alloc(&txRequest_);
+        txRequest_->data()->reset(dst_, src_, &empty, dstStreamId_);
+        txRequest_->data()->refill = this;
+        txRequest_->data()->done.reset(bn_.reset(this)->new_child());
+        sender_.send(txRequest_->ref());
+        bn_.notify();
+        return wait_and_call(STATE(read_wakeup));
+    }
+    bn_.notify();
+    return wait_and_call(STATE(write_wakeup));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::read_wakeup()
+{
+    StreamSendRequest *req = txRequest_->data();
+    if (!req->needData)
+    {
+        return call_immediately(STATE(read_stream_done));
+    }
+    // One window worth of data at a time; the stream has to wait for the
+    // receiver anyway.
+    size_t chunk = std::min(size_t(req->bufferSize), length_ - currentOffset_);
+    if (transferError_)
+    {
+        chunk = 0;
+    }
+    data_.resize(chunk);
+    chunkOffset_ = 0;
+    return call_immediately(STATE(try_read));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::try_read()
+{
+    errorcode_t error = 0;
+    size_t count = 0;
+    if (chunkOffset_ < data_.size())
+    {
+        count = space_->read(address_ + currentOffset_,
+            (uint8_t *)&data_[chunkOffset_], data_.size() - chunkOffset_,
+            &error, this);
+        currentOffset_ += count;
+        chunkOffset_ += count;
+    }
+    if (error == MemorySpace::ERROR_AGAIN)
+    {
+        return wait();
+    }
+    if (error == MemoryConfigDefs::ERROR_OUT_OF_BOUNDS && currentOffset_)
+    {
+        // We can return a partial response.
+        length_ = currentOffset_;
+    }
+    else if (error)
+    {
+        // The stream is closed with what was read so far, then the error is
+        // reported.
+        transferError_ = error;
+        length_ = currentOffset_;
+    }
+    else if (count && chunkOffset_ < data_.size())
+    {
+        return again();
+    }
+    else if (chunkOffset_ < data_.size())
+    {
+        // The memory space did not return more data.
+        length_ = currentOffset_;
+    }
+    data_.resize(chunkOffset_);
+    StreamSendRequest *req = txRequest_->data();
+    req->payload.swap(data_);
+    req->needData = false;
+    sender_.notify();
+    return wait_and_call(STATE(read_wakeup));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::read_stream_done()
+{
+    int result = txRequest_->data()->resultCode;
+    uint32_t sent = txRequest_->data()->bytesSent;
+    txRequest_->unref();
+    txRequest_ = nullptr;
+    data_.clear();
+    if (result)
+    {
+        LOG(INFO, "MemoryConfig: stream read failed: 0x%x", result);
+        return send_error(result & 0xFFFF ? result : Defs::ERROR_TEMPORARY);
+    }
+    if (transferError_)
+    {
+        return send_error(transferError_);
+    }
+    start_response(MemoryConfigDefs::COMMAND_READ_STREAM_REPLY);
+    response_.push_back(StreamDefs::INVALID_STREAM_ID);
+    response_.push_back(dstStreamId_);
+    response_.push_back(0xff & (sent >> 24));
+    response_.push_back(0xff & (sent >> 16));
+    response_.push_back(0xff & (sent >> 8));
+    response_.push_back(0xff & (sent));
+    return send_response();
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::write_wakeup()
+{
+    if (!rxRequest_->data()->hasData)
+    {
+        return call_immediately(STATE(write_stream_done));
+    }
+    data_.clear();
+    data_.swap(rxRequest_->data()->payload);
+    chunkOffset_ = 0;
+    isLastChunk_ = 0;
+    return call_immediately(STATE(try_write));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::write_stream_done()
+{
+    int result = rxRequest_->data()->resultCode;
+    data_.clear();
+    data_.swap(rxRequest_->data()->payload);
+    rxRequest_->unref();
+    rxRequest_ = nullptr;
+    if (result)
+    {
+        LOG(INFO, "MemoryConfig: stream write failed: 0x%x", result);
+        data_.clear();
+        return send_error(result & 0xFFFF ? result : Defs::ERROR_TEMPORARY);
+    }
+    chunkOffset_ = 0;
+    isLastChunk_ = 1;
+    return call_immediately(STATE(try_write));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::try_write()
+{
+    // After an error the rest of the stream is received and dropped.
+    errorcode_t error = transferError_;
+    size_t count = 0;
+    if (!error && chunkOffset_ < data_.size())
+    {
+        count = space_->write(address_ + currentOffset_,
+            (const uint8_t *)data_.data() + chunkOffset_,
+            data_.size() - chunkOffset_, &error, this);
+        currentOffset_ += count;
+        chunkOffset_ += count;
+    }
+    if (error == MemorySpace::ERROR_AGAIN)
+    {
+        return wait();
+    }
+    if (!error && count && chunkOffset_ < data_.size())
+    {
+        return again();
+    }
+    if (!error && chunkOffset_ < data_.size())
+    {
+        // The memory space did not take all the data.
+        error = MemoryConfigDefs::ERROR_OUT_OF_BOUNDS;
+    }
+    data_.clear();
+    if (!isLastChunk_)
+    {
+        transferError_ = error;
+        receiver_.consumed();
+        return wait_and_call(STATE(write_wakeup));
+    }
+    if (error)
+    {
+        return send_error(error);
+    }
+    start_response(MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY);
+    response_.push_back(StreamDefs::INVALID_STREAM_ID);
+    response_.push_back(dstStreamId_);
+    return send_response();
+}
+
+void MemoryConfigStreamHandler::start_response(uint8_t cmd)
+{
+    response_.clear();
+    response_.push_back(MemoryConfigHandler::DATAGRAM_ID);
+    response_.push_back(
+        cmd | (requestHeader_[0] & ~MemoryConfigDefs::COMMAND_MASK));
+    response_.append((const char *)requestHeader_ + 1, requestHeaderLen_ - 1);
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::send_error(errorcode_t error)
+{
+    start_response(isRead_ ? MemoryConfigDefs::COMMAND_READ_STREAM_FAILED
+                           : MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED);
+    response_.push_back(error >> 8);
+    response_.push_back(error & 0xff);
+    return send_response();
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::send_response()
+{
+    return allocate_and_call(
+        STATE(client_allocated), dg_service()->client_allocator());
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::client_allocated()
+{
+    responseFlow_ = full_allocation_result(dg_service()->client_allocator());
+    return allocate_and_call(
+        dg_service()->iface()->dispatcher(), STATE(send_response_datagram));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::send_response_datagram()
+{
+    auto *b = get_allocation_result(dg_service()->iface()->dispatcher());
+    b->set_done(bn_.reset(this));
+    b->data()->reset(
+        Defs::MTI_DATAGRAM, dst_->node_id(), src_, EMPTY_PAYLOAD);
+    b->data()->payload.swap(response_);
+    responseFlow_->write_datagram(b);
+    return wait_and_call(STATE(response_flow_complete));
+}
+
+StateFlowBase::Action MemoryConfigStreamHandler::response_flow_complete()
+{
+    if (!(responseFlow_->result() & DatagramClient::OPERATION_SUCCESS))
+    {
+        LOG(WARNING,
+            "MemoryConfig: Failed to send response datagram. error code %x",
+            (unsigned)responseFlow_->result());
+    }
+    dg_service()->client_allocator()->typed_insert(responseFlow_);
+    responseFlow_ = nullptr;
+    return exit();
+}
+
+} // namespace openlcb
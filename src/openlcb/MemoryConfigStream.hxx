@@ -0,0 +1,160 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file MemoryConfigStream.hxx
+ *
+ * Handles the stream-based read and write commands of the memory
+ * configuration protocol.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#ifndef _OPENLCB_MEMORYCONFIGSTREAM_HXX_
+#define _OPENLCB_MEMORYCONFIGSTREAM_HXX_
+
+#include "openlcb/MemoryConfig.hxx"
+#include "openlcb/Stream.hxx"
+
+namespace openlcb
+{
+
+/// Serves the Read Stream and Write Stream commands of the memory
+/// configuration protocol from the memory spaces registered in a
+/// MemoryConfigHandler. The data is moved through an OpenLCB stream, which
+/// needs only one datagram round trip per transfer instead of one per 64
+/// bytes.
+///
+/// Usage: create one instance next to the MemoryConfigHandler; it registers
+/// itself for the stream commands. Only one transfer is served at a time;
+/// further commands wait in the queue.
+///
+/// Read Stream: the datagram is acknowledged and a stream is opened to the
+/// stream ID that the requester gave. The data is read from the memory space
+/// one stream window at a time, so only that much is held in memory even if
+/// the requester asks for the whole of a large space. Then a Read Stream
+/// Reply datagram tells the number of bytes sent.
+///
+/// Write Stream: a receiver is set up for the requester, the datagram is
+/// acknowledged, and the requester is expected to open the stream. Each
+/// block of received data is written into the memory space before the
+/// stream window is renewed. When the stream completes, a Write Stream Reply
+/// datagram is sent.
+class MemoryConfigStreamHandler : public DefaultDatagramHandler
+{
+public:
+    /// Constructor.
+    /// @param memcfg is the memory config handler whose memory spaces to
+    /// serve.
+    /// @param streams is the stream transport to use.
+    /// @param max_buffer_size is the largest stream window to grant for
+    /// writes.
+    MemoryConfigStreamHandler(MemoryConfigHandler *memcfg,
+        StreamService *streams,
+        uint16_t max_buffer_size = StreamReceiveRequest::DEFAULT_BUFFER_SIZE);
+
+    ~MemoryConfigStreamHandler();
+
+private:
+    typedef MemorySpace::address_t address_t;
+    typedef MemorySpace::errorcode_t errorcode_t;
+
+    Action entry() OVERRIDE;
+    Action ok_response_sent() OVERRIDE;
+
+    Action read_wakeup();
+    Action try_read();
+    Action read_stream_done();
+    Action write_wakeup();
+    Action write_stream_done();
+    Action try_write();
+
+    /// Sends a failure response datagram.
+    /// @param error is the error code to send.
+    Action send_error(errorcode_t error);
+    /// Sends the response datagram in response_.
+    Action send_response();
+    Action client_allocated();
+    Action send_response_datagram();
+    Action response_flow_complete();
+
+    /// Starts a response datagram with the same address and space as the
+    /// request. @param cmd is the base command byte of the response.
+    void start_response(uint8_t cmd);
+
+    /// The memory config handler that owns the memory spaces.
+    MemoryConfigHandler *memcfg_;
+    /// Stream transport.
+    StreamService *streams_;
+    /// Sends the data for stream reads.
+    StreamSender sender_{streams_};
+    /// Receives the data for stream writes.
+    StreamReceiver receiver_{streams_};
+    /// Request sent to sender_; holds a reference.
+    Buffer<StreamSendRequest> *txRequest_{nullptr};
+    /// Request sent to receiver_; holds a reference.
+    Buffer<StreamReceiveRequest> *rxRequest_{nullptr};
+    /// Used for sending out the response datagram.
+    DatagramClient *responseFlow_{nullptr};
+    /// Helper for waiting for child flows.
+    BarrierNotifiable bn_;
+    /// Local node of the current request.
+    Node *dst_;
+    /// Remote node of the current request.
+    NodeHandle src_;
+    /// Memory space of the current request.
+    MemorySpace *space_;
+    /// Chunk of data read from or to be written to the memory space.
+    string data_;
+    /// Response datagram to send.
+    DatagramPayload response_;
+    /// Command byte (low bits), address and space from the request.
+    uint8_t requestHeader_[6];
+    /// Number of bytes in requestHeader_.
+    uint8_t requestHeaderLen_;
+    /// 1 if the current request is a read, 0 if write.
+    uint8_t isRead_ : 1;
+    /// 1 if data_ holds the end of the written stream.
+    uint8_t isLastChunk_ : 1;
+    /// Stream ID of the receiver.
+    uint8_t dstStreamId_;
+    /// Largest stream window to grant.
+    uint16_t maxBufferSize_;
+    /// First address of the current request.
+    address_t address_;
+    /// Number of bytes to transfer.
+    size_t length_;
+    /// How many bytes were transferred to/from the memory space.
+    size_t currentOffset_;
+    /// How many bytes of data_ were transferred to/from the memory space.
+    size_t chunkOffset_;
+    /// Memory space error that ended the transfer early.
+    errorcode_t transferError_;
+};
+
+} // namespace openlcb
+
+#endif // _OPENLCB_MEMORYCONFIGSTREAM_HXX_
@@ -36,12 +36,17 @@
 #ifndef _NMRANET_ROUTNGLOGIC_HXX_
 #define _NMRANET_ROUTNGLOGIC_HXX_
 
-#include <set>
+#include <algorithm>
+#include <functional>
 #include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
+#include <vector>
 
 #include "os/OS.hxx"
 #include "openlcb/EventHandler.hxx"
+#include "utils/SnapshotPublisher.hxx"
 
 namespace openlcb
 {
@@ -61,6 +66,20 @@ uint8_t event_range_to_bit_count(EventId *event);
  *
  * The routing table contains which direction to send addressed packets as well
  * as filters for the event IDs that have listeners in a given port.
+ *
+ * The table is optimized for reading. All updates go into a master copy that
+ * is protected by a mutex. The lookups (which are on the forwarding path of
+ * every packet) use an immutable snapshot instead, which is rebuilt from the
+ * master copy upon the first lookup after a change. The snapshot is
+ * published RCU-style with a @ref SnapshotPublisher: readers never take the
+ * lock (except for the rebuild), and the old snapshots are freed by the
+ * writers once there are no more readers that might have seen them
+ * (epoch-based reclamation).
+ *
+ * In the snapshot the addresses are stored in an open-addressing hash table,
+ * and each port has a flat event filter: a bloom filter to quickly reject
+ * events that have no consumer, and a sorted vector of event IDs for every
+ * range width that occurs in the registrations of that port.
  */
 template <class Port, typename Address> class RoutingLogic
 {
@@ -68,9 +87,6 @@ public:
     RoutingLogic()
     {
     }
-    ~RoutingLogic()
-    {
-    }
 
     /** Clears all entries in the routing table related to a given port, as the
      * given port is being removed.
@@ -93,6 +109,9 @@ public:
                 it.second = nullptr;
             }
         }
+        addressesDirty_ = true;
+        eventsDirty_ = true;
+        set_dirty();
     }
 
     /** Declares that a given node ID is reachable via a specific port. Used
@@ -104,8 +123,25 @@ public:
      */
     void add_node_id_to_route(Port *port, Address source)
     {
+        if (!is_dirty())
+        {
+            // Fast path: this is called for every incoming packet, and most
+            // of the time the route is already known. When the master copy
+            // has unpublished changes, the snapshot may have a stale route.
+            ReadHolder h(this, false);
+            if (h->addresses_->lookup(source) == port)
+            {
+                return;
+            }
+        }
         OSMutexLock l(&lock_);
-        addressRoutingTable_[source] = port;
+        Port *&entry = addressRoutingTable_[source];
+        if (entry != port)
+        {
+            entry = port;
+            addressesDirty_ = true;
+            set_dirty();
+        }
     }
 
     /** Looks up which port an addressed packet should be sent to.
@@ -117,11 +153,8 @@ public:
      */
     Port *lookup_port_for_address(Address dest)
     {
-        OSMutexLock l(&lock_);
-        auto it = addressRoutingTable_.find(dest);
-        if (it == addressRoutingTable_.end())
-            return nullptr;
-        return it->second;
+        ReadHolder h(this, true);
+        return h->addresses_->lookup(dest);
     }
 
     /** Declares that there is a consumer for the given event ID on the given
@@ -132,8 +165,7 @@ public:
      * that port. */
     void register_consumer(Port *port, EventId event)
     {
-        OSMutexLock l(&lock_);
-        eventRoutingTable_[port].registeredConsumers_[0].insert(event);
+        register_consumer_bits(port, event, 0);
     }
 
     /** Declares that there is a consumer for the given event ID range on the
@@ -144,10 +176,8 @@ public:
      * method. */
     void register_consumer_range(Port *port, EventId encoded_range)
     {
-        OSMutexLock l(&lock_);
         uint8_t bit_count = event_range_to_bit_count(&encoded_range);
-        eventRoutingTable_[port].registeredConsumers_[bit_count].insert(
-            encoded_range);
+        register_consumer_bits(port, encoded_range, bit_count);
     }
 
     /** Declares that there is a producer for the given event ID on the given
@@ -184,37 +214,464 @@ public:
      * @return true if the given event has a consumer on the given port. */
     bool check_pcer(Port *port, EventId event)
     {
-        OSMutexLock l(&lock_);
-        auto ip = eventRoutingTable_.find(port);
-        if (ip == eventRoutingTable_.end())
+        ReadHolder h(this, true);
+        const PortFilter *f = h->find_port(port);
+        return f && f->covers(event, 0);
+    }
+
+private:
+    /// Immutable open-addressing hash table from address to port.
+    class AddressTable
+    {
+    public:
+        /// Creates the table from the master copy.
+        /// @param src the master address routing table.
+        AddressTable(const std::unordered_map<Address, Port *> &src)
         {
-            return false;
+            unsigned count = 0;
+            for (const auto &it : src)
+            {
+                if (it.second)
+                {
+                    ++count;
+                }
+            }
+            // At most 50% load factor.
+            bits_ = 1;
+            while ((1u << bits_) < count * 2)
+            {
+                ++bits_;
+            }
+            slots_.resize(1u << bits_);
+            for (const auto &it : src)
+            {
+                if (!it.second)
+                {
+                    continue;
+                }
+                unsigned i = bucket(it.first);
+                while (slots_[i].port)
+                {
+                    i = (i + 1) & (slots_.size() - 1);
+                }
+                slots_[i].address = it.first;
+                slots_[i].port = it.second;
+            }
         }
-        for (auto im = ip->second.registeredConsumers_.begin();
-             im != ip->second.registeredConsumers_.end(); ++im)
+
+        /// @param a is the address to look up.
+        /// @return the port for a, or nullptr if not known.
+        Port *lookup(Address a) const
         {
-            if (im->first == 0)
+            for (unsigned i = bucket(a); slots_[i].port;
+                 i = (i + 1) & (slots_.size() - 1))
             {
-                if (im->second.find(event) != im->second.end())
-                    return true;
+                if (slots_[i].address == a)
+                {
+                    return slots_[i].port;
+                }
             }
-            else if (im->first == 64)
+            return nullptr;
+        }
+
+    private:
+        /// @param a is an address. @return the home bucket of a.
+        unsigned bucket(Address a) const
+        {
+            uint64_t h =
+                uint64_t(std::hash<Address>()(a)) * 0x9E3779B97F4A7C15ULL;
+            return h >> (64 - bits_);
+        }
+
+        /// One entry of the hash table.
+        struct Slot
+        {
+            Address address{};
+            /// nullptr if this slot is empty.
+            Port *port{nullptr};
+        };
+        /// Hash table. Size is a power of two with at least one empty slot.
+        std::vector<Slot> slots_;
+        /// log2(slots_.size()).
+        unsigned bits_;
+    };
+
+    /// Immutable table of event registrations.
+    class FilterTable
+    {
+    public:
+        /// Type of a registration: number of mask bits (0..64) and the
+        /// (masked) base event ID.
+        typedef std::pair<uint8_t, EventId> Registration;
+
+        /// Creates the table.
+        /// @param regs the registrations, sorted.
+        FilterTable(const std::vector<Registration> &regs)
+        {
+            events_.reserve(regs.size());
+            for (const auto &r : regs)
             {
-                if (!im->second.empty())
-                    return true;
+                if (r.first >= 64)
+                {
+                    matchAll_ = true;
+                    continue;
+                }
+                if (segments_.empty() || segments_.back().bits != r.first)
+                {
+                    Segment seg;
+                    seg.bits = r.first;
+                    seg.begin = seg.end = events_.size();
+                    segments_.push_back(seg);
+                }
+                events_.push_back(r.second);
+                segments_.back().end = events_.size();
+            }
+            // About 16 bits per entry; two probes give a false positive rate
+            // of ~1.5%.
+            bloomBits_ = 6;
+            while ((1u << bloomBits_) < events_.size() * 16 && bloomBits_ < 24)
+            {
+                ++bloomBits_;
+            }
+            bloom_.resize((1u << bloomBits_) / 32);
+            for (const auto &seg : segments_)
+            {
+                for (unsigned i = seg.begin; i < seg.end; ++i)
+                {
+                    uint64_t h = hash(events_[i], seg.bits);
+                    unsigned b1 = probe1(h);
+                    unsigned b2 = probe2(h);
+                    bloom_[b1 >> 5] |= 1u << (b1 & 31);
+                    bloom_[b2 >> 5] |= 1u << (b2 & 31);
+                }
             }
-            else
+        }
+
+        /// Checks whether a registration in this table covers a given event
+        /// range.
+        /// @param base is the first event ID of the range.
+        /// @param bits how many low bits of the event ID are masked (0 for a
+        /// single event).
+        /// @return true if there is a registration in this table that covers
+        /// the range.
+        bool covers(EventId base, uint8_t bits) const
+        {
+            if (matchAll_)
             {
-                EventId masked_range =
-                    event & ~((UINT64_C(1) << im->first) - 1);
-                if (im->second.find(masked_range) != im->second.end())
+                return true;
+            }
+            for (const auto &seg : segments_)
+            {
+                if (seg.bits < bits)
+                {
+                    continue;
+                }
+                EventId masked = base & ~((UINT64_C(1) << seg.bits) - 1);
+                uint64_t h = hash(masked, seg.bits);
+                if (!bloom_test(probe1(h)) || !bloom_test(probe2(h)))
+                {
+                    continue;
+                }
+                if (std::binary_search(events_.begin() + seg.begin,
+                        events_.begin() + seg.end, masked))
+                {
                     return true;
+                }
             }
+            return false;
+        }
+
+    private:
+        /// @return the bloom filter hash of an event registration.
+        /// @param event is the (masked) event ID. @param bits is the mask
+        /// width.
+        static uint64_t hash(EventId event, uint8_t bits)
+        {
+            return (event ^ (uint64_t(bits) << 56)) * 0x9E3779B97F4A7C15ULL;
+        }
+
+        /// @return first bit index to test in the bloom filter. @param h hash.
+        unsigned probe1(uint64_t h) const
+        {
+            return h >> (64 - bloomBits_);
+        }
+
+        /// @return second bit index to test in the bloom filter. @param h
+        /// hash.
+        unsigned probe2(uint64_t h) const
+        {
+            return (h >> (64 - 2 * bloomBits_)) & ((1u << bloomBits_) - 1);
+        }
+
+        /// @param bit index in the bloom filter. @return true if it is set.
+        bool bloom_test(unsigned bit) const
+        {
+            return bloom_[bit >> 5] & (1u << (bit & 31));
+        }
+
+        /// Registrations of the same mask width; an index range in events_.
+        struct Segment
+        {
+            /// Number of masked bits (0..63).
+            uint8_t bits;
+            /// First index in events_.
+            unsigned begin;
+            /// One past the last index in events_.
+            unsigned end;
+        };
+
+        /// All registered (masked) event IDs, sorted within each segment.
+        std::vector<EventId> events_;
+        /// The distinct mask widths present.
+        std::vector<Segment> segments_;
+        /// Bloom filter of (masked event, mask width) pairs.
+        std::vector<uint32_t> bloom_;
+        /// log2 of the number of bits in bloom_.
+        unsigned bloomBits_;
+        /// true if there is a registration for the entire event space.
+        bool matchAll_{false};
+    };
+
+    /// Event filter of a single port. To make adding registrations cheap
+    /// even with many registrations on a port, the registrations are split
+    /// into a large base table and a small table of recent additions, which
+    /// gets merged into the base when it grows too large.
+    struct PortFilter
+    {
+        /// All registrations at the time of the last merge.
+        std::shared_ptr<const FilterTable> base_;
+        /// Registrations since the last merge; may be null.
+        std::shared_ptr<const FilterTable> delta_;
+
+        /// Checks whether a registration on this port covers a given event
+        /// range.
+        /// @param base is the first event ID of the range.
+        /// @param bits how many low bits of the event ID are masked (0 for a
+        /// single event).
+        /// @return true if there is a registration on this port that covers
+        /// the range.
+        bool covers(EventId base, uint8_t bits) const
+        {
+            return base_->covers(base, bits) ||
+                (delta_ && delta_->covers(base, bits));
+        }
+    };
+
+    /// Immutable copy of the routing tables, used for lookups.
+    struct Snapshot : public PublishedSnapshot
+    {
+        /// Type of the per-port filter list.
+        typedef std::vector<std::pair<Port *, PortFilter>> PortList;
+
+        /// Address routing table.
+        std::shared_ptr<const AddressTable> addresses_;
+        /// Per-port event filters, sorted by port.
+        PortList ports_;
+
+        /// @param port is the port to look for.
+        /// @return the entry of port in ports_, or ports_.end() if the port
+        /// has no event registrations.
+        typename PortList::const_iterator find_entry(Port *port) const
+        {
+            auto it = std::lower_bound(ports_.begin(), ports_.end(), port,
+                [](const typename PortList::value_type &e, Port *p) {
+                    return e.first < p;
+                });
+            if (it != ports_.end() && it->first != port)
+            {
+                return ports_.end();
+            }
+            return it;
+        }
+
+        /// @param port is the port to look for.
+        /// @return the event filter of port, or nullptr if the port has no
+        /// event registrations.
+        const PortFilter *find_port(Port *port) const
+        {
+            auto it = find_entry(port);
+            return it == ports_.end() ? nullptr : &it->second;
+        }
+    };
+
+    /// Holds a reference to the current snapshot for the lifetime of this
+    /// object (RCU read-side critical section).
+    class ReadHolder
+    {
+    public:
+        /// Enters the read-side critical section.
+        /// @param parent the routing table.
+        /// @param refresh if true, the snapshot will be rebuilt from the
+        /// master copy if there were changes since it was taken.
+        ReadHolder(RoutingLogic *parent, bool refresh)
+            : parent_(parent)
+        {
+            if (refresh && parent_->is_dirty())
+            {
+                OSMutexLock l(&parent_->lock_);
+                parent_->publish_locked();
+            }
+            snapshot_ = parent_->snapshots_.pin(&slot_);
+        }
+
+        ~ReadHolder()
+        {
+            parent_->snapshots_.unpin(slot_);
+        }
+
+        /// @return the snapshot.
+        const Snapshot *operator->()
+        {
+            return snapshot_;
+        }
+
+    private:
+        /// Routing table.
+        RoutingLogic *parent_;
+        /// The snapshot we hold.
+        const Snapshot *snapshot_;
+        /// Which reader counter of the publisher we are counted in.
+        unsigned slot_;
+    };
+
+    friend class ReadHolder;
+
+    /// Adds an event registration for a port.
+    /// @param port is where the registration came from.
+    /// @param event is the (masked) base event ID.
+    /// @param bits is the number of mask bits (0 for a single event).
+    void register_consumer_bits(Port *port, EventId event, uint8_t bits)
+    {
+        if (!is_dirty())
+        {
+            // Fast path: repeated identify messages do not change the
+            // filter. When the master copy has unpublished changes (e.g. a
+            // remove_port), the snapshot may have stale registrations.
+            ReadHolder h(this, false);
+            const PortFilter *f = h->find_port(port);
+            if (f && f->covers(event, bits))
+            {
+                return;
+            }
+        }
+        OSMutexLock l(&lock_);
+        EventSet &es = eventRoutingTable_[port];
+        if (es.registeredConsumers_[bits].insert(event).second)
+        {
+            es.pending_.emplace_back(bits, event);
+            ++es.size_;
+            es.dirty_ = true;
+            eventsDirty_ = true;
+            set_dirty();
         }
-        return false;
     }
 
-private:
+    /// @return true if the master copy has changes that are not in the
+    /// current snapshot.
+    bool is_dirty()
+    {
+        return __atomic_load_n(&dirty_, __ATOMIC_ACQUIRE) != 0;
+    }
+
+    /// Marks that the snapshot needs to be rebuilt. Must be called with the
+    /// lock held.
+    void set_dirty()
+    {
+        __atomic_store_n(&dirty_, 1, __ATOMIC_RELEASE);
+    }
+
+    /// Rebuilds the snapshot from the master copy if needed, publishes it,
+    /// and frees the old snapshots that no reader can see anymore. Must be
+    /// called with the lock held.
+    void publish_locked()
+    {
+        if (!dirty_)
+        {
+            return; // Someone else has rebuilt it already.
+        }
+        const Snapshot *old_snapshot = snapshots_.current_locked();
+        Snapshot *s = new Snapshot(*old_snapshot);
+        if (addressesDirty_)
+        {
+            s->addresses_.reset(new AddressTable(addressRoutingTable_));
+            addressesDirty_ = false;
+        }
+        if (eventsDirty_)
+        {
+            typename Snapshot::PortList ports;
+            ports.reserve(eventRoutingTable_.size());
+            for (auto &it : eventRoutingTable_)
+            {
+                auto old = old_snapshot->find_entry(it.first);
+                if (!it.second.dirty_ && old != old_snapshot->ports_.end())
+                {
+                    // Unchanged filter is shared with the old snapshot.
+                    ports.push_back(*old);
+                }
+                else
+                {
+                    ports.emplace_back(it.first, build_filter(&it.second));
+                    it.second.dirty_ = false;
+                }
+            }
+            s->ports_.swap(ports);
+            eventsDirty_ = false;
+        }
+        snapshots_.publish_locked(s);
+        __atomic_store_n(&dirty_, 0, __ATOMIC_RELEASE);
+    }
+
+    struct EventSet;
+
+    /// Computes the new event filter of a port after changes. Must be called
+    /// with the lock held.
+    /// @param es is the master copy of the port's registrations.
+    /// @return the new filter.
+    static PortFilter build_filter(EventSet *es)
+    {
+        // The recent additions are kept separate up to about sqrt(n) entries,
+        // which makes the amortized cost of a registration O(sqrt(n)) even if
+        // every registration is followed by a lookup.
+        size_t delta_limit = 32;
+        while (delta_limit * delta_limit < es->size_)
+        {
+            delta_limit *= 2;
+        }
+        if (!es->base_ || es->pending_.size() > delta_limit)
+        {
+            std::vector<typename FilterTable::Registration> regs;
+            regs.reserve(es->size_);
+            for (const auto &it : es->registeredConsumers_)
+            {
+                for (EventId e : it.second)
+                {
+                    regs.emplace_back(it.first, e);
+                }
+            }
+            es->base_ = std::make_shared<const FilterTable>(regs);
+            es->pending_.clear();
+        }
+        PortFilter f;
+        f.base_ = es->base_;
+        if (!es->pending_.empty())
+        {
+            std::vector<typename FilterTable::Registration> regs(
+                es->pending_);
+            std::sort(regs.begin(), regs.end());
+            f.delta_ = std::make_shared<const FilterTable>(regs);
+        }
+        return f;
+    }
+
+    /// @return an empty snapshot.
+    static Snapshot *empty_snapshot()
+    {
+        Snapshot *s = new Snapshot;
+        s->addresses_.reset(
+            new AddressTable(std::unordered_map<Address, Port *>()));
+        return s;
+    }
+
     /// Protects all internal data structures.
     OSMutex lock_;
 
@@ -227,10 +684,28 @@ private:
         /// key: number of bits set in the mask part. Valid values:
         /// 0..64. Value of 0 means individual event.
         std::map<uint8_t, std::set<EventId>> registeredConsumers_;
+        /// Registrations that are not in base_ yet.
+        std::vector<typename FilterTable::Registration> pending_;
+        /// Filter table of the registrations that are not in pending_.
+        std::shared_ptr<const FilterTable> base_;
+        /// Total number of registrations.
+        size_t size_{0};
+        /// true if this port's filter needs to be rebuilt.
+        bool dirty_{true};
     };
 
     /// Stores per-port event information.
     std::map<Port *, EventSet> eventRoutingTable_;
+
+    /// Snapshot used by the lookups, and the old ones that may still be in
+    /// use.
+    SnapshotPublisher<Snapshot> snapshots_{empty_snapshot()};
+    /// Non-zero if the master copy has changed since the snapshot was built.
+    unsigned dirty_{0};
+    /// true if the address table needs to be rebuilt.
+    bool addressesDirty_{false};
+    /// true if any port's event filter needs to be rebuilt.
+    bool eventsDirty_{false};
 };
 
 } // namespace openlcb
@@ -32,499 +32,727 @@
  */
 
 #include "openlcb/Stream.hxx"
-#include "openlcb/NMRAnetNode.hxx"
-#include "openlcb/NMRAnetMessageID.hxx"
-#include "utils/macros.h"
+
+#include <algorithm>
+
+#include "openlcb/CanDefs.hxx"
 
 namespace openlcb
 {
 
-/** Open a stream.
- * @param dst destination node for stream
- * @param timeout 0 = do not wait for success, deliver success asynchronously
- *                > 0, wait for success, or fail on timeout
- * @return NULL on fail, else stream handle on success or pending success
- */
-Stream::StreamHandle Stream::sopen(NodeHandle dst, long long timeout)
-{
-    StreamHandle handle = NULL;
-
-    Node::mutex.lock();
-    if (count < CHANNELS_PER_NODE)
-    {
-        Metadata* metadata = new Metadata;
-        metadata->data = RingBuffer<uint8_t>::create(MAX_BUFFER_SIZE * 2);
-        metadata->size = MAX_BUFFER_SIZE;
-        metadata->count = 0;
-        metadata->srcID = 0;
-        metadata->nodeHandle = dst;
-        RBTree<uint8_t, Metadata*>::Node *last = outboundTree.last();
-        
-        if (last != NULL)
+/// Answers incoming stream initiate requests. Matching requests are handed
+/// to a waiting StreamReceiver; the others are rejected.
+class StreamService::InitiateHandler : public IncomingMessageStateFlow
+{
+public:
+    /// Constructor. @param service is the parent stream service.
+    InitiateHandler(StreamService *service)
+        : IncomingMessageStateFlow(service->iface())
+        , service_(service)
+    {
+        iface()->dispatcher()->register_handler(
+            this, Defs::MTI_STREAM_INITIATE_REQUEST, Defs::MTI_EXACT);
+    }
+
+    ~InitiateHandler()
+    {
+        iface()->dispatcher()->unregister_handler(
+            this, Defs::MTI_STREAM_INITIATE_REQUEST, Defs::MTI_EXACT);
+    }
+
+    Action entry() OVERRIDE
+    {
+        if (!nmsg()->dstNode)
         {
-            metadata->srcID = last->key + 1;
-            while (outboundTree.find(metadata->srcID) != NULL)
-            {
-                metadata->srcID++;
-            }
+            return release_and_exit();
         }
-        
-        Buffer *buffer = buffer_alloc(6);
-        uint8_t *data = (uint8_t*)buffer->start();
-        
-        data[0] = (MAX_BUFFER_SIZE >> 8) & 0xFF;
-        data[1] = (MAX_BUFFER_SIZE >> 0) & 0xFF;
-        data[2] = 0;
-        data[3] = 0;
-        data[4] = metadata->srcID;
-        data[5] = 0;
-
-        buffer->advance(6);
-        
-        RBTree<uint8_t, Metadata*>::Node *node =
-            new RBTree<uint8_t, Metadata*>::Node(metadata->srcID, metadata);
-
-        outboundTree.insert(node);
-        
-        write(Defs::MTI_STREAM_INITIATE_REQUEST, dst, buffer);
-        
-        if (timeout)
+        if (nmsg()->payload.size() < 5)
         {
-            metadata->state = WAITING_O;
-
-            Node::mutex.unlock();
-            int result = sem.timedwait(timeout);
-            Node::mutex.lock();
-
-            if (result != 0 || metadata->state != CONNECTED_O)
-            {
-                outboundTree.remove(node);
-                metadata->data->destroy();
-                delete node;
-                delete metadata;
-            }
-            else
-            {
-                count++;
-                handle = (StreamHandle)metadata;
-            }
-            /** @todo (Stuart Baker) is there a race between connected and timeout */
+            return reject(StreamDefs::FLAG_PERMANENT_ERROR,
+                StreamDefs::REJECT_PERMANENT_INVALID_REQUEST);
         }
-        else
+        StreamReceiver *r = service_->find_pending(nmsg());
+        if (!r)
         {
-            metadata->state = PENDING_O;
-            count++;
-            handle = (StreamHandle)metadata;
+            return reject(0, StreamDefs::REJECT_TEMPORARY_BUFFER_FULL);
         }
-    }    
-    Node::mutex.unlock();
-
-    return handle;
-}
+        service_->remove_receiver(r);
+        r->initiate(nmsg());
+        return release_and_exit();
+    }
 
-/** Close a stream.
- * @param handle to stream to close
- */
-void Stream::sclose(StreamHandle handle)
-{
-    Metadata *metadata = (Metadata*)handle;
-    
-    Node::mutex.lock();
-    if (metadata->data->items() == 0)
-    {
-        /* no more data left to send.  Hooray! */
-        Buffer *buffer = buffer_alloc(4);
-        uint8_t *data = (uint8_t*)buffer->start();
-        data[0] = metadata->srcID;
-        data[1] = metadata->dstID;
-        data[2] = 0;
-        data[3] = 0;
-        buffer->advance(4);
-        
-        write(Defs::MTI_STREAM_COMPLETE, metadata->nodeHandle, buffer);
-    
-        /* no more data left in the buffer */
-        RBTree<uint8_t, Metadata*>::Node *node = outboundTree.remove(metadata->srcID);
-        metadata->data->destroy();
-        delete metadata;
-        delete node;
+private:
+    /// Sends a negative stream initiate reply.
+    /// @param flags is 0 for temporary, FLAG_PERMANENT_ERROR for permanent
+    /// errors.
+    /// @param additional_flags is the error reason.
+    Action reject(uint8_t flags, uint8_t additional_flags)
+    {
+        flags_ = flags;
+        additionalFlags_ = additional_flags;
+        return allocate_and_call(
+            iface()->addressed_message_write_flow(), STATE(send_reject));
     }
-    else
+
+    Action send_reject()
     {
-        /* we have some data left to send, but mark us as closed */
-        metadata->state = CLOSED_O;
+        auto *b =
+            get_allocation_result(iface()->addressed_message_write_flow());
+        const Payload &p = nmsg()->payload;
+        uint8_t src_id = p.size() > 4 ? p[4] : 0;
+        b->data()->reset(Defs::MTI_STREAM_INITIATE_REPLY,
+            nmsg()->dstNode->node_id(), nmsg()->src,
+            StreamDefs::create_initiate_response(
+                0, flags_, additionalFlags_, src_id, 0));
+        iface()->addressed_message_write_flow()->send(b);
+        return release_and_exit();
     }
-    Node::mutex.unlock();
-}
 
-/** Write data to a stream.
- * @param handle handle to stream to write to
- * @param buf buffer to copy data from
- * @param size size in bytes to write to stream
- * @return number of bytes written, else -1 on error with errno set to indicate error
- */
-ssize_t Stream::swrite(StreamHandle handle, const void *buf, size_t size)
+    /// Parent service.
+    StreamService *service_;
+    /// Flags for the rejection.
+    uint8_t flags_;
+    /// Additional flags for the rejection.
+    uint8_t additionalFlags_;
+};
+
+/// Parses incoming CAN stream data frames, and forwards the payload to the
+/// receiver that owns the destination stream ID.
+class StreamService::DataParser : public CanFrameStateFlow
 {
-    Metadata *metadata = (Metadata*)handle;
-    
-    ssize_t result = 0;
-    
-    Node::mutex.lock();
-    if (metadata->data->items() || metadata->count >= metadata->size)
+public:
+    enum
     {
-        /* there is already some data in flight, so lets just add to the back
-         * of the buffer.
-         */
-        result = metadata->data->put((uint8_t*)buf, size);
+        CAN_FILTER = CanMessageData::CAN_EXT_FRAME_FILTER |
+            (CanDefs::STREAM_DATA << CanDefs::CAN_FRAME_TYPE_SHIFT) |
+            (CanDefs::NMRANET_MSG << CanDefs::FRAME_TYPE_SHIFT) |
+            (CanDefs::NORMAL_PRIORITY << CanDefs::PRIORITY_SHIFT),
+        CAN_MASK = CanMessageData::CAN_EXT_FRAME_MASK |
+            CanDefs::CAN_FRAME_TYPE_MASK | CanDefs::FRAME_TYPE_MASK |
+            CanDefs::PRIORITY_MASK,
+    };
+
+    /// Constructor. @param service is the parent stream service.
+    DataParser(StreamService *service)
+        : CanFrameStateFlow(service->iface())
+        , service_(service)
+    {
+        if_can()->frame_dispatcher()->register_handler(
+            this, CAN_FILTER, CAN_MASK);
     }
-    else
+
+    ~DataParser()
     {
-        size_t buffer_size;
-        if (size > (metadata->size - metadata->count))
+        if_can()->frame_dispatcher()->unregister_handler(
+            this, CAN_FILTER, CAN_MASK);
+    }
+
+    Action entry() OVERRIDE
+    {
+        const struct can_frame *f = &message()->data()->frame();
+        if (f->can_dlc < 1)
         {
-            buffer_size = metadata->size - metadata->count;
+            return release_and_exit();
         }
-        else
+        uint32_t id = GET_CAN_FRAME_ID_EFF(*f);
+        StreamReceiver *r = service_->find_active(f->data[0]);
+        if (!r)
         {
-            buffer_size = size;
+            return release_and_exit();
         }
+        NodeID dst =
+            if_can()->local_aliases()->lookup(CanDefs::get_dst(id));
+        if (!dst || dst != r->request()->dst->node_id())
+        {
+            // Stream ID of a different local node, or not for us at all.
+            return release_and_exit();
+        }
+        r->data_received(CanDefs::get_src(id), f->data + 1, f->can_dlc - 1);
+        return release_and_exit();
+    }
+
+private:
+    /// Parent service.
+    StreamService *service_;
+};
+
+StreamService::StreamService(IfCan *iface)
+    : iface_(iface)
+{
+    memset(usedIds_, 0, sizeof(usedIds_));
+    // This value is reserved by the protocol.
+    usedIds_[StreamDefs::INVALID_STREAM_ID >> 5] |=
+        1u << (StreamDefs::INVALID_STREAM_ID & 31);
+    initiateHandler_.reset(new InitiateHandler(this));
+    dataParser_.reset(new DataParser(this));
+}
+
+StreamService::~StreamService()
+{
+}
 
-        Buffer *buffer = buffer_alloc(buffer_size + 2);
-        uint8_t *data = (uint8_t*)buffer->start();
-        memcpy(data, buf, buffer_size);
-        data[buffer_size + 0] = metadata->srcID;
-        data[buffer_size + 1] = metadata->dstID;
-        buffer->advance(buffer_size + 2);
-        write(Defs::MTI_STREAM_DATA, metadata->nodeHandle, buffer);
-        
-        result = buffer_size;
-        size -= buffer_size;
-        metadata->count += buffer_size;
-
-        if (size)
+uint8_t StreamService::alloc_stream_id()
+{
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        if (usedIds_[i] == 0xFFFFFFFFu)
         {
-            result += metadata->data->put((uint8_t*)buf + buffer_size, size);
+            continue;
         }
+        unsigned bit = __builtin_ctz(~usedIds_[i]);
+        usedIds_[i] |= 1u << bit;
+        return (i << 5) | bit;
     }
-    Node::mutex.unlock();
+    return StreamDefs::INVALID_STREAM_ID;
+}
 
-    return result;
+bool StreamService::reserve_stream_id(uint8_t id)
+{
+    uint32_t bit = 1u << (id & 31);
+    if (usedIds_[id >> 5] & bit)
+    {
+        return false;
+    }
+    usedIds_[id >> 5] |= bit;
+    return true;
 }
 
-/** Read data from a stream.
- * @param handle handle to stream to read from
- * @param buf buffer to copy data to
- * @param size size in bytes to read from stream
- * @return number of bytes read, else -1 on error with errno set to indicate error
- */
-ssize_t Stream::sread(StreamHandle handle, void *buf, size_t size)
-{
-    Metadata *metadata = (Metadata*)handle;
-    
-    ssize_t result = 0;
-    
-    Node::mutex.lock();
-    size_t space = metadata->data->space();
-    result = metadata->data->get((uint8_t*)buf, size);
-
-    if (space < metadata->size && metadata->data->space() >= metadata->size)
-    {
-        /* proceed since we made room for the next data set */
-        Buffer *buffer = buffer_alloc(4);
-        uint8_t *data = (uint8_t*)buffer->start();
-        data[0] = metadata->srcID;
-        data[1] = metadata->dstID;
-        data[2] = 0;
-        data[3] = 0;
-        buffer->advance(4);
-        
-        metadata->count = 0;
-        
-        write(Defs::MTI_STREAM_PROCEED, metadata->nodeHandle, buffer);
-    }
-    Node::mutex.unlock();
-
-    return result;
-}
-
-/** Handle incoming stream initiate request messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::initiate_request(NodeHandle src, Buffer *buffer)
+void StreamService::free_stream_id(uint8_t id)
 {
-    if (count < CHANNELS_PER_NODE && buffer->used() >= 6)
+    HASSERT(id != StreamDefs::INVALID_STREAM_ID);
+    usedIds_[id >> 5] &= ~(1u << (id & 31));
+}
+
+void StreamService::remove_receiver(StreamReceiver *r)
+{
+    pendingReceivers_.erase(
+        std::remove(pendingReceivers_.begin(), pendingReceivers_.end(), r),
+        pendingReceivers_.end());
+    activeReceivers_.erase(
+        std::remove(activeReceivers_.begin(), activeReceivers_.end(), r),
+        activeReceivers_.end());
+}
+
+StreamReceiver *StreamService::find_active(uint8_t dst_stream_id)
+{
+    for (StreamReceiver *r : activeReceivers_)
     {
-        uint8_t *data = (uint8_t*)buffer->start();
-        
-        size_t buffer_size = (data[0] << 8) + data[1];
-        
-        if (MAX_BUFFER_SIZE < buffer_size)
+        if (r->dstId_ == dst_stream_id)
         {
-            buffer_size = MAX_BUFFER_SIZE;
+            return r;
         }
+    }
+    return nullptr;
+}
 
-        Metadata* metadata = new Metadata;
-        metadata->protocol = DISCOVER_1;
-        metadata->data = RingBuffer<uint8_t>::create(MAX_BUFFER_SIZE * 2);
-        metadata->nodeHandle = src;
-        metadata->size = buffer_size;
-        metadata->count = 0;
-        metadata->state = CONNECTED_I;
-        metadata->srcID = data[4];
-        metadata->dstID = 0;
-
-        RBTree<uint8_t, Metadata*>::Node *last = inboundTree.last();
-        
-        if (last != NULL)
+StreamReceiver *StreamService::find_pending(GenMessage *m)
+{
+    for (StreamReceiver *r : pendingReceivers_)
+    {
+        StreamReceiveRequest *req = r->request();
+        if (req->dst != m->dstNode)
         {
-            metadata->dstID = last->key + 1;
-            while (inboundTree.find(metadata->dstID) != NULL)
-            {
-                metadata->dstID++;
-            }
+            continue;
         }
-        
-        /* reuse buffer to reply since we are otherwise done with it */
-        buffer->zero();
-        
-        data[0] = (buffer_size >> 8) & 0xFF;
-        data[1] = (buffer_size >> 0) & 0xFF;
-        data[2] = ACCEPT;
-        data[3] = 0;
-        data[4] = metadata->srcID;
-        data[5] = metadata->dstID;
-
-        buffer->advance(6);
-        
-        write(Defs::MTI_STREAM_INITIATE_REPLY, src, buffer);
-        
-        RBTree<uint8_t, Metadata*>::Node *node =
-            new RBTree<uint8_t, Metadata*>::Node(metadata->dstID, metadata);
-
-        inboundTree.insert(node);
-        
-        buffer = buffer_alloc(sizeof(IdStreamType));
-        IdStreamType* type = (IdStreamType*)buffer->start();
-        type->stream = (StreamHandle)node->value;
-        buffer->id(ID_STREAM_NEW_CONNECTION);
-        buffer->advance(sizeof(IdStreamType));
-        
-        rx_queue()->insert(buffer);
-    }
-}
-
-/** Handle incoming stream initiate reply messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::initiate_reply(NodeHandle src, Buffer *buffer)
+        if ((req->src.id || req->src.alias) &&
+            !iface_->matching_node(req->src, m->src))
+        {
+            continue;
+        }
+        if (m->payload.size() > 5 &&
+            req->localStreamId != StreamDefs::INVALID_STREAM_ID &&
+            (uint8_t)m->payload[5] != req->localStreamId)
+        {
+            // Suggested destination stream ID is different.
+            continue;
+        }
+        return r;
+    }
+    return nullptr;
+}
+
+StreamSender::StreamSender(StreamService *service)
+    : CallableFlow<StreamSendRequest>(service->iface())
+    , service_(service)
+{
+}
+
+StreamSender::~StreamSender()
+{
+}
+
+StateFlowBase::Action StreamSender::entry()
 {
-    uint8_t *data = (uint8_t*)buffer->start();
-    
-    size_t buffer_size = (data[0] << 8) + data[1];
-    
-    RBTree<uint8_t, Metadata*>::Node *node = outboundTree.find(data[4]);
-    
-    HASSERT(node);
-    
-    if (node->value->size > buffer_size)
+    srcId_ = service_->alloc_stream_id();
+    if (srcId_ == StreamDefs::INVALID_STREAM_ID)
     {
-        node->value->size = buffer_size;
+        return return_with_error(Defs::ERROR_TEMPORARY);
     }
+    hasReply_ = 0;
+    isLocal_ = 0;
+    isSleeping_ = 0;
+    offset_ = 0;
+    total_ = 0;
+    available_ = 0;
+    service_->iface()->dispatcher()->register_handler(
+        &replyHandler_, Defs::MTI_STREAM_INITIATE_REPLY, Defs::MTI_EXACT);
+    return allocate_and_call(service_->iface()->addressed_message_write_flow(),
+        STATE(send_initiate));
+}
+
+StateFlowBase::Action StreamSender::send_initiate()
+{
+    auto *b = get_allocation_result(
+        service_->iface()->addressed_message_write_flow());
+    b->data()->reset(Defs::MTI_STREAM_INITIATE_REQUEST,
+        request()->src->node_id(), request()->dst,
+        request()->dstStreamId == StreamDefs::INVALID_STREAM_ID
+            ? StreamDefs::create_initiate_request(
+                  StreamDefs::MAX_PAYLOAD, false, srcId_)
+            : StreamDefs::create_initiate_request(StreamDefs::MAX_PAYLOAD,
+                  false, srcId_, request()->dstStreamId));
+    service_->iface()->addressed_message_write_flow()->send(b);
+    isSleeping_ = 1;
+    return sleep_and_call(&timer_, TIMEOUT_NSEC, STATE(initiate_timeout));
+}
 
-    node->value->dstID = data[5];
+bool StreamSender::is_from_remote(GenMessage *m)
+{
+    return m->dstNode == request()->src &&
+        service_->iface()->matching_node(request()->dst, m->src);
+}
 
-    buffer = buffer_alloc(sizeof(IdStreamType));
-    IdStreamType* type = (IdStreamType*)buffer->start();
-    type->stream = (StreamHandle)node->value;
-    buffer->id(ID_STREAM_COMPLETED_CONNECTION);
-    buffer->advance(sizeof(IdStreamType));
-    
-    if (node->value->state == WAITING_O)
+void StreamSender::initiate_reply(Buffer<GenMessage> *message)
+{
+    GenMessage *m = message->data();
+    if (hasReply_ || !is_from_remote(m) || m->payload.size() < 6 ||
+        (uint8_t)m->payload[4] != srcId_)
     {
-        node->value->state = CONNECTED_O;
-        sem.post();
+        // Not for me.
+        return message->unref();
     }
-    else
+    const uint8_t *p = (const uint8_t *)m->payload.data();
+    bufferSize_ = (p[0] << 8) | p[1];
+    replyFlags_ = p[2];
+    replyAdditionalFlags_ = p[3];
+    dstId_ = p[5];
+    isLocal_ = m->src.id &&
+        service_->iface()->lookup_local_node(m->src.id) != nullptr;
+    if (m->src.alias)
     {
-        node->value->state = CONNECTED_O;
-        rx_queue()->insert(buffer);
+        request()->dst.alias = m->src.alias;
+    }
+    hasReply_ = 1;
+    message->unref();
+    if (isSleeping_)
+    {
+        isSleeping_ = 0;
+        timer_.ensure_triggered();
     }
 }
 
-/** Handle incoming stream data messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::handle_data(NodeHandle src, Buffer *buffer)
+StateFlowBase::Action StreamSender::initiate_timeout()
 {
-    bool wakeup;
-    uint8_t *data = (uint8_t*)buffer->start();
-
-    RBTree<uint8_t, Metadata*>::Node *node = inboundTree.find(data[buffer->used() - 1]);
+    isSleeping_ = 0;
+    service_->iface()->dispatcher()->unregister_handler(
+        &replyHandler_, Defs::MTI_STREAM_INITIATE_REPLY, Defs::MTI_EXACT);
+    if (!hasReply_)
+    {
+        return finish(Defs::OPENMRN_TIMEOUT);
+    }
+    if (!(replyFlags_ & StreamDefs::FLAG_ACCEPT))
+    {
+        hasReply_ = 0;
+        if (replyFlags_ & StreamDefs::FLAG_PERMANENT_ERROR)
+        {
+            return finish(Defs::ERROR_PERMANENT | replyAdditionalFlags_);
+        }
+        return finish(Defs::ERROR_TEMPORARY | replyAdditionalFlags_);
+    }
+    if (!bufferSize_)
+    {
+        hasReply_ = 0;
+        return finish(Defs::ERROR_PERMANENT);
+    }
+    if (!isLocal_ && !request()->dst.alias)
+    {
+        hasReply_ = 0;
+        return finish(Defs::ERROR_DST_NOT_FOUND);
+    }
+    available_ = bufferSize_;
+    request()->bufferSize = bufferSize_;
+    service_->iface()->dispatcher()->register_handler(
+        &proceedHandler_, Defs::MTI_STREAM_PROCEED, Defs::MTI_EXACT);
+    return call_immediately(STATE(send_data));
+}
 
-    /* we only wakeup if starting from zero, otherwise, the node already knows
-     * there is data available, so no need to re-notify it.
-     */
-    if (node->value->data->items() == 0)
+StateFlowBase::Action StreamSender::send_data()
+{
+    string &payload = request()->payload;
+    if (offset_ >= payload.size())
     {
-        wakeup = true;
+        if (!request()->refill)
+        {
+            return call_immediately(STATE(send_complete));
+        }
+        total_ += offset_;
+        offset_ = 0;
+        payload.clear();
+        request()->needData = true;
+        request()->refill->notify();
+        return wait_and_call(STATE(chunk_ready));
     }
-    else
+    if (!available_)
+    {
+        return call_immediately(STATE(wait_for_proceed));
+    }
+    IfCan *iface = service_->iface();
+    if (isLocal_)
+    {
+        StreamReceiver *r = service_->find_active(dstId_);
+        if (!r)
+        {
+            return finish(Defs::ERROR_PERMANENT);
+        }
+        size_t len = std::min(available_, payload.size() - offset_);
+        r->data_received(0, (const uint8_t *)payload.data() + offset_, len);
+        offset_ += len;
+        available_ -= len;
+        return yield_and_call(STATE(send_data));
+    }
+    NodeAlias local_alias =
+        iface->local_aliases()->lookup(request()->src->node_id());
+    if (!local_alias)
+    {
+        return finish(Defs::ERROR_PERMANENT);
+    }
+    uint32_t can_id;
+    CanDefs::set_datagram_fields(
+        &can_id, local_alias, request()->dst.alias, CanDefs::STREAM_DATA);
+    bn_.reset(this);
+    for (unsigned i = 0;
+         i < FRAMES_PER_BATCH && available_ && offset_ < payload.size(); ++i)
     {
-        wakeup = false;
+        auto *b = iface->frame_write_flow()->alloc();
+        struct can_frame *f = b->data()->mutable_frame();
+        SET_CAN_FRAME_ID_EFF(*f, can_id);
+        size_t len = std::min(size_t(StreamDefs::CAN_FRAME_PAYLOAD),
+            std::min(available_, payload.size() - offset_));
+        f->can_dlc = len + 1;
+        f->data[0] = dstId_;
+        memcpy(f->data + 1, payload.data() + offset_, len);
+        offset_ += len;
+        available_ -= len;
+        b->set_done(bn_.new_child());
+        iface->frame_write_flow()->send(b);
     }
-    
-    /* last two bytes represent source and destination ID */
-    size_t len = buffer->size() - buffer->available();
+    bn_.notify();
+    return wait_and_call(STATE(send_data));
+}
 
-    /* some sanity tests that will help us debug this */
-    HASSERT(node->value->state == CONNECTED_I);
-    HASSERT(len > 2);
-    HASSERT(node->value->data->space() >= (len - 2));
+StateFlowBase::Action StreamSender::wait_for_proceed()
+{
+    if (available_)
+    {
+        return call_immediately(STATE(send_data));
+    }
+    isSleeping_ = 1;
+    return sleep_and_call(&timer_, TIMEOUT_NSEC, STATE(proceed_timeout));
+}
 
-    while ((node->value->protocol & DISCOVER_MASK) != DISCOVERED && len > 2)
+void StreamSender::proceed(Buffer<GenMessage> *message)
+{
+    GenMessage *m = message->data();
+    if (!is_from_remote(m) || m->payload.size() < 2 ||
+        (uint8_t)m->payload[0] != srcId_ || (uint8_t)m->payload[1] != dstId_)
     {
-        int shift = (node->value->protocol >> DISCOVER_SHIFT) - 1;
-        node->value->protocol |= (*data) << (shift * 8);
-        data++;
-        len--;
-        node->value->protocol-= DISCOVERED_DEC;
+        // Not for me.
+        return message->unref();
     }
+    message->unref();
+    available_ += bufferSize_;
+    if (isSleeping_)
+    {
+        isSleeping_ = 0;
+        timer_.ensure_triggered();
+    }
+}
 
-    node->value->count += (len - 2);
-    HASSERT(node->value->count <= node->value->size);
+StateFlowBase::Action StreamSender::proceed_timeout()
+{
+    isSleeping_ = 0;
+    if (!available_)
+    {
+        return finish(Defs::OPENMRN_TIMEOUT);
+    }
+    return call_immediately(STATE(send_data));
+}
 
-    node->value->data->put(data, len - 2);
+StateFlowBase::Action StreamSender::chunk_ready()
+{
+    if (request()->payload.empty())
+    {
+        return call_immediately(STATE(send_complete));
+    }
+    return call_immediately(STATE(send_data));
+}
 
-    /* release buffer, we are done with it */
-    buffer->free();
+StateFlowBase::Action StreamSender::send_complete()
+{
+    return allocate_and_call(service_->iface()->addressed_message_write_flow(),
+        STATE(complete_sent));
+}
 
-    /* this operation must come before proceed because proceed will release the
-     * critical Node::mutex and cause a race condition.
-     */
-    if (wakeup && (node->value->protocol & DISCOVER_MASK) == DISCOVERED)
+StateFlowBase::Action StreamSender::complete_sent()
+{
+    auto *b = get_allocation_result(
+        service_->iface()->addressed_message_write_flow());
+    Payload p = StreamDefs::create_close_request(srcId_, dstId_);
+    size_t sent = total_ + offset_;
+    for (int shift = 24; shift >= 0; shift -= 8)
     {
-        buffer = buffer_alloc(sizeof(IdStreamType));
-        IdStreamType* type = (IdStreamType*)buffer->start();
-        type->stream = (StreamHandle)node->value;
-        buffer->id(ID_STREAM_DATA_POSTED);
-        buffer->advance(sizeof(IdStreamType));
+        p.push_back((sent >> shift) & 0xff);
+    }
+    b->data()->reset(Defs::MTI_STREAM_COMPLETE, request()->src->node_id(),
+        request()->dst, p);
+    service_->iface()->addressed_message_write_flow()->send(b);
+    request()->bytesSent = sent;
+    return finish(0);
+}
 
-        rx_queue()->insert(buffer);
+StateFlowBase::Action StreamSender::finish(int error)
+{
+    if (hasReply_)
+    {
+        // We have registered the proceed handler.
+        service_->iface()->dispatcher()->unregister_handler(
+            &proceedHandler_, Defs::MTI_STREAM_PROCEED, Defs::MTI_EXACT);
     }
+    service_->free_stream_id(srcId_);
+    return return_with_error(error);
+}
+
+StreamReceiver::StreamReceiver(StreamService *service)
+    : CallableFlow<StreamReceiveRequest>(service->iface())
+    , service_(service)
+{
+}
+
+StreamReceiver::~StreamReceiver()
+{
+}
 
-    if (node->value->count == node->value->size &&
-        node->value->data->space() >= MAX_BUFFER_SIZE)
+StateFlowBase::Action StreamReceiver::entry()
+{
+    isInitiated_ = 0;
+    isComplete_ = 0;
+    isSleeping_ = 0;
+    hasActivity_ = 0;
+    needProceed_ = 0;
+    granted_ = 0;
+    received_ = 0;
+    expectedSize_ = 0;
+    if (request()->localStreamId != StreamDefs::INVALID_STREAM_ID)
+    {
+        // Already taken by the caller.
+        dstId_ = request()->localStreamId;
+    }
+    else
     {
-        /* proceed since we already have room for the next data set */
-        buffer = buffer_alloc(4);
-        data = (uint8_t*)buffer->start();
-        data[0] = node->value->srcID;
-        data[1] = node->value->dstID;
-        data[2] = 0;
-        data[3] = 0;
-        buffer->advance(4);
-        
-        node->value->count = 0;
-        
-        write(Defs::MTI_STREAM_PROCEED, src, buffer);
+        dstId_ = service_->alloc_stream_id();
+        if (dstId_ == StreamDefs::INVALID_STREAM_ID)
+        {
+            return return_with_error(Defs::ERROR_TEMPORARY);
+        }
     }
+    service_->add_pending(this);
+    isSleeping_ = 1;
+    return sleep_and_call(&timer_, TIMEOUT_NSEC, STATE(initiate_wakeup));
 }
 
-/** Handle incoming stream proceed messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::proceed(NodeHandle src, Buffer *buffer)
+void StreamReceiver::initiate(GenMessage *m)
 {
-    uint8_t *data = (uint8_t*)buffer->start();
+    const uint8_t *p = (const uint8_t *)m->payload.data();
+    uint16_t proposed = (p[0] << 8) | p[1];
+    bufferSize_ = request()->maxBufferSize;
+    if (proposed && proposed < bufferSize_)
+    {
+        bufferSize_ = proposed;
+    }
+    srcId_ = p[4];
+    request()->src = m->src;
+    isInitiated_ = 1;
+    wakeup();
+}
 
-    RBTree<uint8_t, Metadata*>::Node *node = outboundTree.find(data[1]);
+StateFlowBase::Action StreamReceiver::initiate_wakeup()
+{
+    isSleeping_ = 0;
+    if (!isInitiated_)
+    {
+        return finish(Defs::OPENMRN_TIMEOUT);
+    }
+    return allocate_and_call(service_->iface()->addressed_message_write_flow(),
+        STATE(send_reply));
+}
 
-    node->value->count = 0;
-    
-    buffer->free();
+StateFlowBase::Action StreamReceiver::send_reply()
+{
+    auto *b = get_allocation_result(
+        service_->iface()->addressed_message_write_flow());
+    b->data()->reset(Defs::MTI_STREAM_INITIATE_REPLY,
+        request()->dst->node_id(), request()->src,
+        StreamDefs::create_initiate_response(
+            bufferSize_, StreamDefs::FLAG_ACCEPT, 0, srcId_, dstId_));
+    granted_ = bufferSize_;
+    service_->add_active(this);
+    service_->iface()->dispatcher()->register_handler(
+        &completeHandler_, Defs::MTI_STREAM_COMPLETE, Defs::MTI_EXACT);
+    service_->iface()->addressed_message_write_flow()->send(b);
+    return call_immediately(STATE(wait_for_data));
+}
 
-    if (node->value->data->items())
+StateFlowBase::Action StreamReceiver::wait_for_data()
+{
+    if (needProceed_)
     {
-        size_t segment_size;
-        if (node->value->data->items() < node->value->size)
+        return allocate_and_call(
+            service_->iface()->addressed_message_write_flow(),
+            STATE(send_proceed));
+    }
+    if (isComplete_ && !request()->hasData)
+    {
+        if (received_ == expectedSize_)
         {
-            segment_size = node->value->data->items();
+            return finish(0);
         }
-        else
+        if (received_ > expectedSize_)
         {
-            segment_size = node->value->size;
+            return finish(Defs::ERROR_INVALID_ARGS);
         }
-        
-        buffer = buffer_alloc(segment_size + 2);
-        data = (uint8_t*)buffer->start();
-        node->value->data->get(data, segment_size);
-        data[segment_size + 0] = node->value->srcID;
-        data[segment_size + 1] = node->value->dstID;
-        buffer->advance(segment_size + 2);
-        node->value->count = segment_size;
+        // The last data frames are still on their way.
+    }
+    hasActivity_ = 0;
+    isSleeping_ = 1;
+    return sleep_and_call(&timer_, TIMEOUT_NSEC, STATE(data_wakeup));
+}
 
-        write(Defs::MTI_STREAM_DATA, src, buffer);
+StateFlowBase::Action StreamReceiver::data_wakeup()
+{
+    isSleeping_ = 0;
+    if (!timer_.is_triggered() && !hasActivity_ && !request()->hasData)
+    {
+        // While the caller holds data, the sender is expected to stall.
+        return finish(Defs::OPENMRN_TIMEOUT);
     }
+    return call_immediately(STATE(wait_for_data));
 }
 
-/** Handle incoming stream complete messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::complete(NodeHandle src, Buffer *buffer)
+StateFlowBase::Action StreamReceiver::send_proceed()
+{
+    auto *b = get_allocation_result(
+        service_->iface()->addressed_message_write_flow());
+    b->data()->reset(Defs::MTI_STREAM_PROCEED, request()->dst->node_id(),
+        request()->src, StreamDefs::create_data_proceed(srcId_, dstId_));
+    service_->iface()->addressed_message_write_flow()->send(b);
+    granted_ += bufferSize_;
+    needProceed_ = 0;
+    return call_immediately(STATE(wait_for_data));
+}
+
+void StreamReceiver::data_received(
+    NodeAlias src_alias, const uint8_t *data, size_t len)
+{
+    if (src_alias && request()->src.alias && src_alias != request()->src.alias)
+    {
+        // Same stream ID, but a different sender.
+        return;
+    }
+    request()->payload.append((const char *)data, len);
+    received_ += len;
+    hasActivity_ = 1;
+    if (isComplete_ && received_ >= expectedSize_)
+    {
+        wakeup();
+        return;
+    }
+    check_window();
+}
+
+void StreamReceiver::consumed()
+{
+    request()->hasData = false;
+    check_window();
+    wakeup();
+}
+
+void StreamReceiver::check_window()
 {
-    uint8_t *data = (uint8_t*)buffer->start();
+    StreamReceiveRequest *req = request();
+    size_t consumed = received_;
+    if (req->drain)
+    {
+        consumed -= req->payload.size();
+        if (!req->hasData && !req->payload.empty() &&
+            req->payload.size() >= bufferSize_ / 2u)
+        {
+            req->hasData = true;
+            req->drain->notify();
+        }
+    }
+    if (!needProceed_ && consumed + bufferSize_ / 2 >= granted_)
+    {
+        // Less than half of the window is left: we renew it early so that
+        // the sender does not have to stop.
+        needProceed_ = 1;
+        wakeup();
+    }
+}
 
-    RBTree<uint8_t, Metadata*>::Node *node = inboundTree.find(data[2]);
+bool StreamReceiver::is_for_me(GenMessage *m)
+{
+    return m->dstNode == request()->dst &&
+        service_->iface()->matching_node(request()->src, m->src) &&
+        m->payload.size() >= 2 && (uint8_t)m->payload[0] == srcId_ &&
+        (uint8_t)m->payload[1] == dstId_;
+}
 
-    if (node->value->data->items() == 0)
+void StreamReceiver::complete(Buffer<GenMessage> *message)
+{
+    if (!is_for_me(message->data()))
     {
-        /* no more data left in the buffer */
-        outboundTree.remove(node);
-        node->value->data->destroy();
-        delete node->value;
-        delete node;
+        return message->unref();
+    }
+    const Payload &p = message->data()->payload;
+    if (p.size() >= 6)
+    {
+        expectedSize_ = 0;
+        for (unsigned i = 2; i < 6; ++i)
+        {
+            expectedSize_ = (expectedSize_ << 8) | (uint8_t)p[i];
+        }
     }
     else
     {
-        /* we have some data left, give the application a chance to get it */
-        node->value->state = CLOSED_I;
+        // No byte count: we take what has arrived so far.
+        expectedSize_ = received_;
     }
+    message->unref();
+    isComplete_ = 1;
+    hasActivity_ = 1;
+    wakeup();
 }
 
-/** Handle incoming stream messages.
- * @param mti Message Type Indicator
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::packet(Defs::MTI mti, NodeHandle src, Buffer *data)
-{
-    switch (mti)
-    {
-        default:
-            HASSERT(0);
-            break;
-        case Defs::MTI_STREAM_INITIATE_REQUEST:
-            initiate_request(src, data);
-            break;
-        case Defs::MTI_STREAM_INITIATE_REPLY:
-            initiate_reply(src, data);
-            break;
-        case Defs::MTI_STREAM_DATA:
-            handle_data(src, data);
-            break;
-        case Defs::MTI_STREAM_PROCEED:
-            proceed(src, data);
-            break;
-        case Defs::MTI_STREAM_COMPLETE:
-            complete(src, data);
-            break;
+StateFlowBase::Action StreamReceiver::finish(int error)
+{
+    if (isInitiated_)
+    {
+        service_->iface()->dispatcher()->unregister_handler(
+            &completeHandler_, Defs::MTI_STREAM_COMPLETE, Defs::MTI_EXACT);
     }
+    service_->remove_receiver(this);
+    service_->free_stream_id(dstId_);
+    return return_with_error(error);
 }
 
-};
-
+} // namespace openlcb
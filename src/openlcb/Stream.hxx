@@ -34,202 +34,375 @@
 #ifndef _NMRANET_STREAM_HXX_
 #define _NMRANET_STREAM_HXX_
 
-#include "openlcb/NMRAnetIf.hxx"
-#include "utils/RBTree.hxx"
-#include "utils/RingBuffer.hxx"
+#include <vector>
+
+#include "executor/CallableFlow.hxx"
+#include "openlcb/IfCan.hxx"
+#include "openlcb/StreamDefs.hxx"
 
 namespace openlcb
 {
 
-/**
-   Base service for OpenLCB streaming protocol.
+class StreamReceiver;
 
-   This code does not work yet.
- */
-class Stream
+/// Request structure for @ref StreamSender.
+struct StreamSendRequest : public CallableFlowRequestBase
 {
-public:
-    /** number of simultaneous open streams per virtual node instance */
-    static const size_t CHANNELS_PER_NODE;
-    
-    /** Max buffer size for stream transmission segments */
-    static const uint16_t MAX_BUFFER_SIZE;
-
-    /** Stream handle type */
-    typedef void *StreamHandle;
-    
-    /** Open a stream.
-     * @param dst destination node for stream
-     * @param timeout 0 = do not wait for success, deliver success asynchronously
-     *                > 0, wait for success, or fail on timeout
-     * @return NULL on fail, else stream handle on success or pending success
-     */
-    StreamHandle sopen(NodeHandle dst, long long timeout);
-
-    /** Close a stream.
-     * @param handle handle to stream to close
-     */
-    void sclose(StreamHandle handle);
-
-    /** Write data to a stream.
-     * @param handle handle to stream to write to
-     * @param buf buffer to copy data from
-     * @param size size in bytes to write to stream
-     * @return number of bytes written, else -1 on error with errno set to indicate error
-     */
-    ssize_t swrite(StreamHandle handle, const void *buf, size_t size);
-
-    /** Read data from a stream.
-     * @param handle handle to stream to read from
-     * @param buf buffer to copy data to
-     * @param size size in bytes to read from stream
-     * @return number of bytes read, else -1 on error with errno set to indicate error
-     */
-    ssize_t sread(StreamHandle handle, void *buf, size_t size);
-
-protected:
-    /** Default constructor.
-     */
-    Stream()
-        : outboundTree(),
-          inboundTree(),
-          count(0),
-          sem()
+    /// Sets up sending a block of data over a new stream.
+    /// @param src is the local node sending the data.
+    /// @param dst is the node to send the data to.
+    /// @param data is the data to send. The contents are taken over.
+    /// @param dst_stream_id is the destination stream ID to suggest to the
+    /// receiver, or INVALID_STREAM_ID.
+    void reset(Node *src, NodeHandle dst, string *data,
+        uint8_t dst_stream_id = StreamDefs::INVALID_STREAM_ID)
     {
+        reset_base();
+        this->src = src;
+        this->dst = dst;
+        payload.clear();
+        payload.swap(*data);
+        dstStreamId = dst_stream_id;
+        bytesSent = 0;
+        refill = nullptr;
+        needData = false;
+        bufferSize = 0;
     }
-    
-    /** Default destructor.
-     */
-    ~Stream()
+
+    /// Local node sending the data.
+    Node *src;
+    /// Node to send the data to.
+    NodeHandle dst;
+    /// Data to send.
+    string payload;
+    /// Suggested destination stream ID.
+    uint8_t dstStreamId;
+    /// Output: how many bytes were acknowledged by the transport.
+    size_t bytesSent;
+    /// If not null, the data is sent in chunks. Whenever the payload is
+    /// consumed (also before the first byte is sent), the sender sets
+    /// needData and notifies refill. The caller then puts the next chunk into
+    /// the payload, clears needData and calls notify() on the sender. An
+    /// empty chunk ends the stream.
+    Notifiable *refill;
+    /// True while the sender is waiting for the next chunk.
+    bool needData;
+    /// Output: the window size granted by the receiver; a good chunk size.
+    uint16_t bufferSize;
+};
+
+/// Request structure for @ref StreamReceiver.
+struct StreamReceiveRequest : public CallableFlowRequestBase
+{
+    /// Sets up receiving one incoming stream.
+    /// @param dst is the local node that will receive the stream.
+    /// @param src is the remote node that is expected to send the stream. If
+    /// both id and alias are zero, a stream is accepted from any node.
+    /// @param local_stream_id is the destination stream ID to use. If
+    /// INVALID_STREAM_ID, the StreamService allocates one. Otherwise the
+    /// caller must have taken the ID from the StreamService (with
+    /// alloc_stream_id() or reserve_stream_id()); the receiver releases it
+    /// when done.
+    /// @param max_buffer_size is the largest window the receiver grants.
+    void reset(Node *dst, NodeHandle src,
+        uint8_t local_stream_id = StreamDefs::INVALID_STREAM_ID,
+        uint16_t max_buffer_size = DEFAULT_BUFFER_SIZE)
     {
+        reset_base();
+        this->dst = dst;
+        this->src = src;
+        localStreamId = local_stream_id;
+        maxBufferSize = max_buffer_size;
+        payload.clear();
+        drain = nullptr;
+        hasData = false;
     }
 
-    /** Handle incoming stream messages.
-     * @param mti Message Type Indicator
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void packet(Defs::MTI mti, NodeHandle src, Buffer *data);
+    /// Default window size of the receiver.
+    static const uint16_t DEFAULT_BUFFER_SIZE = 4096;
 
-private:
-    /** possible flag values.
-     */
-    enum Flag
-    {
-        PERMINATE_ERROR = 0x40, /**< a perminate error occured */
-        ACCEPT          = 0x80  /**< initiate request accepted */
-    };
-    
-    /** Possible stream states.
-     */
-    enum State
+    /// Local node receiving the data.
+    Node *dst;
+    /// Remote node expected to send the data. Output: the actual sender.
+    NodeHandle src;
+    /// Destination stream ID to use.
+    uint8_t localStreamId;
+    /// Largest window to grant to the sender.
+    uint16_t maxBufferSize;
+    /// Output: the data received.
+    string payload;
+    /// If not null, the data is handed over in chunks. Whenever at least
+    /// half of the window is waiting in the payload, the receiver sets
+    /// hasData and notifies drain. The caller then takes the data out of the
+    /// payload and calls StreamReceiver::consumed(). The window is only
+    /// renewed for consumed data. The data left over when the stream
+    /// completes is in the payload.
+    Notifiable *drain;
+    /// True while the caller owes a call to consumed().
+    bool hasData;
+};
+
+/// Stream transport for a CAN interface. Owns the stream ID allocation,
+/// answers the incoming stream initiate requests, and parses the incoming
+/// stream data frames, forwarding the payload to the @ref StreamReceiver
+/// that owns the stream.
+///
+/// Data travels in CAN stream data frames (7 bytes each), without any
+/// per-frame acknowledgement. The receiver grants the sender a window of
+/// max_buffer_size bytes, and renews it with a Stream Data Proceed message
+/// once half of the window is consumed, so the sender does not have to stop
+/// for the round trip.
+///
+/// Streams between two nodes on the same interface are delivered locally,
+/// without CAN frames.
+class StreamService
+{
+public:
+    /// Constructor. @param iface is the CAN interface to operate on.
+    StreamService(IfCan *iface);
+    ~StreamService();
+
+    /// @return the interface this service is operating on.
+    IfCan *iface()
     {
-        PENDING_O,   /**< connection pending, outbound */
-        WAITING_O,   /**< waiting on a pending connection, outbound */
-        CONNECTED_O, /**< connection made, outbound */
-        CLOSED_O,    /**< connection closed, outbound */
-        PENDING_I,   /**< connection pending, inbound */
-        WAITING_I,   /**< waiting on a pending connection, inbound */
-        CONNECTED_I, /**< connection made, inbound */
-        CLOSED_I,    /**< connection closed, inbound */
-        
-    };
-    
-    enum Protocol
+        return iface_;
+    }
+
+    /// Allocates an unused stream ID.
+    /// @return the stream ID, or StreamDefs::INVALID_STREAM_ID if all IDs are
+    /// taken.
+    uint8_t alloc_stream_id();
+
+    /// Marks a given stream ID as used.
+    /// @param id is the stream ID to take.
+    /// @return false if the ID is already in use.
+    bool reserve_stream_id(uint8_t id);
+
+    /// Releases a stream ID. @param id is the stream ID to release.
+    void free_stream_id(uint8_t id);
+
+private:
+    friend class StreamReceiver;
+    friend class StreamSender;
+    class InitiateHandler;
+    class DataParser;
+
+    /// Adds a receiver that is waiting for a stream initiate request.
+    void add_pending(StreamReceiver *r)
     {
-        DISCOVER_1     = 0x0600000000000000,
-        DISCOVER_2     = 0x0500000000000000,
-        DISCOVER_3     = 0x0400000000000000,
-        DISCOVER_4     = 0x0300000000000000,
-        DISCOVER_5     = 0x0200000000000000,
-        DISCOVER_6     = 0x0100000000000000,
-        DISCOVERED     = 0x0000000000000000,
-        DISCOVERED_DEC = 0x0100000000000000,
-        DISCOVER_MASK  = 0xFF00000000000000,
-        DISCOVER_SHIFT = 56,
-    };
-    
-    /** Stream metadata, often cast to @ref StreamHandle.
-     */
-    struct Metadata
+        pendingReceivers_.push_back(r);
+    }
+
+    /// Removes a receiver from the pending and the active lists.
+    void remove_receiver(StreamReceiver *r);
+
+    /// Marks a receiver as active, i.e. receiving data for a stream ID.
+    void add_active(StreamReceiver *r)
     {
-        uint64_t protocol; /**< stream protocol */
-        RingBuffer<uint8_t> *data; /**< stream data */
-        NodeHandle  nodeHandle; /**< node we are communicating with */
-
-        size_t  size;   /**< max buffer size */
-        size_t  count;  /**< count received before proceed required */
-        State   state;  /**< Stream state */
-        uint8_t srcID;  /**< unique source ID */
-        uint8_t dstID;  /**< unique destination ID */
-    };
-
-    /** Write a message from a node.  We should already have a mutex lock at this
-     * at this point.
-     * @param mti Message Type Indicator
-     * @param dst destination node ID, 0 if unavailable
-     * @param data NMRAnet packet data
-     * @return 0 upon success
-     */
-    virtual int write(Defs::MTI mti, NodeHandle dst, Buffer *data) = 0;
-
-     /** Get handle to the receive queue for incoming NMRAnet messages.
-     * @return handle to queue
-     */
-    virtual BufferQueueWait *rx_queue() = 0;
-
-    /** Handle incoming stream initiate request messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void initiate_request(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream initiate reply messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void initiate_reply(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream data messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void handle_data(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream proceed messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void proceed(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream complete messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void complete(NodeHandle src, Buffer *buffer);
-    
-    /** tree for keeping track of outbound streams */
-    RBTree <uint8_t, Metadata*> outboundTree;
-
-    /** tree for keeping track of inbound streams */
-    RBTree <uint8_t, Metadata*> inboundTree;
-
-    /** number of active streams for this node */
-    size_t count;
-
-    /** wait for completion semaphore */
-    OSSem sem;
-
-    DISALLOW_COPY_AND_ASSIGN(Stream);
+        activeReceivers_.push_back(r);
+    }
+
+    /// @return the active receiver for a given destination stream ID, or
+    /// nullptr.
+    StreamReceiver *find_active(uint8_t dst_stream_id);
+
+    /// @return the first pending receiver that accepts a given stream
+    /// initiate request, or nullptr.
+    StreamReceiver *find_pending(GenMessage *m);
+
+    /// Parent interface.
+    IfCan *iface_;
+    /// One bit for every stream ID; 1 if the ID is in use.
+    uint32_t usedIds_[8];
+    /// Receivers waiting for a stream initiate request.
+    std::vector<StreamReceiver *> pendingReceivers_;
+    /// Receivers of open streams.
+    std::vector<StreamReceiver *> activeReceivers_;
+    /// Answers the stream initiate requests.
+    std::unique_ptr<InitiateHandler> initiateHandler_;
+    /// Parses stream data frames.
+    std::unique_ptr<DataParser> dataParser_;
 };
 
-/// unused.
-struct IdStreamType
+/// Sends a block of data to a remote node via an OpenLCB stream. Usage:
+/// invoke_subflow_and_wait(&sender, ..., src_node, dst, &data). The
+/// resultCode is zero on success.
+class StreamSender : public CallableFlow<StreamSendRequest>
 {
-    Stream::StreamHandle stream;
+public:
+    /// Constructor. @param service is the stream transport to use.
+    StreamSender(StreamService *service);
+    ~StreamSender();
+
+    /// How long to wait for a response from the receiver.
+    static const long long TIMEOUT_NSEC = SEC_TO_NSEC(5);
+    /// How many CAN frames to put on the bus before waiting for them to be
+    /// sent out.
+    static const unsigned FRAMES_PER_BATCH = 8;
+
+private:
+    Action entry() OVERRIDE;
+    Action send_initiate();
+    Action initiate_timeout();
+    Action send_data();
+    Action wait_for_proceed();
+    Action proceed_timeout();
+    Action chunk_ready();
+    Action send_complete();
+    Action complete_sent();
+
+    /// Releases all resources and terminates the flow.
+    /// @param error is the result code to return.
+    Action finish(int error);
+
+    /// Callback from the dispatcher for the initiate reply.
+    void initiate_reply(Buffer<GenMessage> *message);
+    /// Callback from the dispatcher for the data proceed messages.
+    void proceed(Buffer<GenMessage> *message);
+
+    /// Checks if a message is from the remote node of the stream.
+    bool is_from_remote(GenMessage *m);
+
+    /// The stream transport.
+    StreamService *service_;
+    /// Handles incoming stream initiate reply messages.
+    MessageHandler::GenericHandler replyHandler_{
+        this, &StreamSender::initiate_reply};
+    /// Handles incoming stream proceed messages.
+    MessageHandler::GenericHandler proceedHandler_{
+        this, &StreamSender::proceed};
+    /// Helper for waiting for messages.
+    StateFlowTimer timer_{this};
+    /// Notified when a batch of CAN frames was sent out.
+    BarrierNotifiable bn_;
+    /// Local (source) stream ID.
+    uint8_t srcId_;
+    /// Remote (destination) stream ID.
+    uint8_t dstId_;
+    /// Stream initiate reply flags.
+    uint8_t replyFlags_;
+    /// Stream initiate reply additional flags.
+    uint8_t replyAdditionalFlags_;
+    /// 1 if we received the initiate reply.
+    uint8_t hasReply_ : 1;
+    /// 1 if the destination node is on the same interface.
+    uint8_t isLocal_ : 1;
+    /// 1 if the flow is waiting on the timer.
+    uint8_t isSleeping_ : 1;
+    /// Negotiated buffer size.
+    uint16_t bufferSize_;
+    /// How many more bytes the receiver accepts.
+    size_t available_;
+    /// Offset in the payload of the next byte to send.
+    size_t offset_;
+    /// Number of bytes sent from the previous chunks.
+    size_t total_;
 };
 
+/// Receives an incoming OpenLCB stream into a string. Usage:
+/// invoke_subflow_and_wait(&receiver, ..., dst_node, src_handle). The
+/// resultCode is zero on success; the data is in the payload. If the byte
+/// count in the stream complete message is less than what arrived, the
+/// resultCode is ERROR_INVALID_ARGS; if it is more, the receiver waits for
+/// the missing data until the timeout.
+class StreamReceiver : public CallableFlow<StreamReceiveRequest>
+{
+public:
+    /// Constructor. @param service is the stream transport to use.
+    StreamReceiver(StreamService *service);
+    ~StreamReceiver();
+
+    /// How long to wait for the remote node before giving up.
+    static const long long TIMEOUT_NSEC = SEC_TO_NSEC(5);
 
+    /// Tells the receiver that the caller took the data out of the payload
+    /// after a drain notification. Must be called on the executor of the
+    /// interface.
+    void consumed();
+
+    /// Stops waiting for the stream initiate request. The request returns
+    /// with OPENMRN_TIMEOUT. Has no effect once the stream is open. Must be
+    /// called on the executor of the interface.
+    void cancel()
+    {
+        if (!isInitiated_)
+        {
+            wakeup();
+        }
+    }
+
+private:
+    friend class StreamService;
+    friend class StreamSender;
+
+    Action entry() OVERRIDE;
+    Action initiate_wakeup();
+    Action send_reply();
+    Action wait_for_data();
+    Action data_wakeup();
+    Action send_proceed();
+    Action finish(int error);
+
+    /// Called by the service for a matching stream initiate request.
+    void initiate(GenMessage *m);
+
+    /// Called by the service for incoming stream data.
+    /// @param src_alias is the alias of the sending node on the bus, or zero
+    /// for local loopback.
+    /// @param data is the payload.
+    /// @param len is the number of bytes in data.
+    void data_received(NodeAlias src_alias, const uint8_t *data, size_t len);
+
+    /// Hands the data to the caller and renews the window as needed.
+    void check_window();
+
+    /// Callback from the dispatcher for the stream complete message.
+    void complete(Buffer<GenMessage> *message);
+
+    /// @return true if the message is for this stream.
+    bool is_for_me(GenMessage *m);
+
+    /// Wakes up the flow if it is waiting for data.
+    void wakeup()
+    {
+        if (isSleeping_)
+        {
+            isSleeping_ = 0;
+            timer_.ensure_triggered();
+        }
+    }
+
+    /// The stream transport.
+    StreamService *service_;
+    /// Handles incoming stream complete messages.
+    MessageHandler::GenericHandler completeHandler_{
+        this, &StreamReceiver::complete};
+    /// Helper for waiting for messages.
+    StateFlowTimer timer_{this};
+    /// Local (destination) stream ID.
+    uint8_t dstId_;
+    /// Remote (source) stream ID.
+    uint8_t srcId_;
+    /// 1 if the stream initiate request arrived.
+    uint8_t isInitiated_ : 1;
+    /// 1 if the stream complete message arrived.
+    uint8_t isComplete_ : 1;
+    /// 1 if the flow is waiting on the timer.
+    uint8_t isSleeping_ : 1;
+    /// 1 if data arrived since the flow started waiting.
+    uint8_t hasActivity_ : 1;
+    /// 1 if we need to send a proceed message.
+    uint8_t needProceed_ : 1;
+    /// Negotiated buffer size.
+    uint16_t bufferSize_;
+    /// Total number of bytes the sender is allowed to send.
+    size_t granted_;
+    /// Total number of bytes received.
+    size_t received_;
+    /// Byte count from the stream complete message.
+    size_t expectedSize_;
 };
 
+} // namespace openlcb
+
 #endif /* _NMRANET_STREAM_HXX_ */
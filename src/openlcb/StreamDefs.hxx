@@ -31,6 +31,9 @@
  * @date 14 December 2014
  */
 
+#ifndef _OPENLCB_STREAMDEFS_HXX_
+#define _OPENLCB_STREAMDEFS_HXX_
+
 #include "openlcb/If.hxx"
 
 namespace openlcb
@@ -41,6 +44,13 @@ struct StreamDefs
 {
     static const uint16_t MAX_PAYLOAD = 0xffff;
 
+    /// Stream ID value that means "no stream ID".
+    static const uint8_t INVALID_STREAM_ID = 0xff;
+
+    /// Number of payload bytes in a stream data frame on CAN (the first byte
+    /// of the frame carries the destination stream ID).
+    static const unsigned CAN_FRAME_PAYLOAD = 7;
+
     enum Flags
     {
         FLAG_CARRIES_ID = 0x01,
@@ -72,6 +82,46 @@ struct StreamDefs
         return p;
     }
 
+    /// Creates a stream initiate request that carries a suggested
+    /// destination stream ID.
+    static Payload create_initiate_request(uint16_t max_buffer_size,
+        bool has_ident, uint8_t src_stream_id, uint8_t dst_stream_id)
+    {
+        Payload p = create_initiate_request(
+            max_buffer_size, has_ident, src_stream_id);
+        p.push_back(dst_stream_id);
+        return p;
+    }
+
+    /// Creates a stream initiate reply.
+    /// @param max_buffer_size is the accepted buffer size; zero if the stream
+    /// is rejected.
+    /// @param flags is a combination of the Flags values.
+    /// @param additional_flags is a combination of the AdditionalFlags values.
+    static Payload create_initiate_response(uint16_t max_buffer_size,
+        uint8_t flags, uint8_t additional_flags, uint8_t src_stream_id,
+        uint8_t dst_stream_id)
+    {
+        Payload p(6, 0);
+        p[0] = max_buffer_size >> 8;
+        p[1] = max_buffer_size & 0xff;
+        p[2] = flags;
+        p[3] = additional_flags;
+        p[4] = src_stream_id;
+        p[5] = dst_stream_id;
+        return p;
+    }
+
+    /// Creates a stream data proceed message.
+    static Payload create_data_proceed(
+        uint8_t src_stream_id, uint8_t dst_stream_id)
+    {
+        Payload p(2, 0);
+        p[0] = src_stream_id;
+        p[1] = dst_stream_id;
+        return p;
+    }
+
     static Payload create_close_request(uint8_t src_stream_id, uint8_t dst_stream_id)
     {
         Payload p(2, 0);
@@ -82,3 +132,5 @@ struct StreamDefs
 };
 
 } // namespace openlcb
+
+#endif // _OPENLCB_STREAMDEFS_HXX_
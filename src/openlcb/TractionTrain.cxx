@@ -177,8 +177,7 @@ struct TrainService::Impl
                 {
                     SpeedType sp = fp16_to_speed(payload() + 1);
                     train_node()->train()->set_speed(sp);
-                    nextConsistIndex_ = 0;
-                    return call_immediately(STATE(maybe_forward_consist));
+                    return forward_consist();
                 }
                 case TractionDefs::REQ_SET_FN:
                 {
@@ -191,8 +190,7 @@ struct TrainService::Impl
                     value <<= 8;
                     value |= payload()[5];
                     train_node()->train()->set_fn(address, value);
-                    nextConsistIndex_ = 0;
-                    return call_immediately(STATE(maybe_forward_consist));
+                    return forward_consist();
                 }
                 case TractionDefs::REQ_EMERGENCY_STOP:
                 {
@@ -408,88 +406,75 @@ struct TrainService::Impl
             }
         }
 
-        Action maybe_forward_consist()
+        /// Sends a copy of the incoming command to all consist targets that
+        /// need it, in a single pass over the consist list. Targets whose
+        /// alias is known are sent first, because targets that need an alias
+        /// lookup on the bus would otherwise hold up the addressed write flow
+        /// for the rest of the consist.
+        Action forward_consist()
         {
-            auto* train_node = this->train_node();
-            unsigned count = train_node->query_consist_length();
-            if (count <= nextConsistIndex_)
-                return release_and_exit();
-            uint8_t flags = 0;
-            NodeID dst = train_node->query_consist(nextConsistIndex_, &flags);
-            if (iface()->matching_node(nmsg()->src, NodeHandle(dst)))
+            auto *train_node = this->train_node();
+            auto *flow = iface()->addressed_message_write_flow();
+            TypedQueue<Buffer<GenMessage>> lookups;
+            auto lookups_tail = lookups.begin();
+            for (auto it = train_node->consist_begin();
+                 it != train_node->consist_end(); ++it)
             {
-                ++nextConsistIndex_;
-                return again();
-            }
-            uint8_t cmd = payload()[0];
-            bool flip_speed = false;
-            if (cmd == TractionDefs::REQ_SET_SPEED) {
-                if (flags & TractionDefs::CNSTFLAGS_REVERSE) {
-                    flip_speed = true;
+                uint8_t flags = it->get_flags();
+                if (!should_forward(flags))
+                {
+                    continue;
                 }
-            } else if (cmd == TractionDefs::REQ_SET_FN) {
-                uint32_t address = payload()[1];
-                address <<= 8;
-                address |= payload()[2];
-                address <<= 8;
-                address |= payload()[3];
-                if (address == 0) {
-                    if ((flags & TractionDefs::CNSTFLAGS_LINKF0) == 0) {
-                        // skip
-                        ++nextConsistIndex_;
-                        return again();
-                    }
-                } else {
-                    if ((flags & TractionDefs::CNSTFLAGS_LINKFN) == 0) {
-                        // skip
-                        ++nextConsistIndex_;
-                        return again();
-                    }
+                NodeHandle dst(it->get_slave());
+                if (iface()->matching_node(nmsg()->src, dst))
+                {
+                    continue;
                 }
-            }
-            if (count == nextConsistIndex_ + 1u)
-            {
-                // last node: we can transfer the message.
-                auto *b = transfer_message();
-                b->data()->src = NodeHandle(train_node->node_id());
-                b->data()->dst = NodeHandle(dst);
-                b->data()->dstNode = nullptr;
-                if (flip_speed) {
+                iface()->canonicalize_handle(&dst);
+                auto *b = flow->alloc();
+                b->data()->reset(nmsg()->mti, train_node->node_id(), dst,
+                                 nmsg()->payload);
+                if ((payload()[0] == TractionDefs::REQ_SET_SPEED) &&
+                    (flags & TractionDefs::CNSTFLAGS_REVERSE))
+                {
                     b->data()->payload[1] ^= 0x80;
                 }
-                iface()->addressed_message_write_flow()->send(b);
-                return exit();
+                if (dst.alias)
+                {
+                    flow->send(b);
+                }
+                else
+                {
+                    lookups.insert(lookups_tail, b);
+                    ++lookups_tail;
+                }
             }
-            else
+            while (!lookups.empty())
             {
-                return allocate_and_call(
-                    iface()->addressed_message_write_flow(),
-                    STATE(forward_consist));
+                flow->send(lookups.pop_front());
             }
+            return release_and_exit();
         }
 
-        Action forward_consist()
+        /// @return true if the incoming set speed or set function command
+        /// has to be forwarded to a consist target.
+        /// @param flags is the consist flags of the target.
+        bool should_forward(uint8_t flags)
         {
-            auto *b =
-                get_allocation_result(iface()->addressed_message_write_flow());
-            uint8_t flags;
-            NodeID dst = train_node()->query_consist(nextConsistIndex_, &flags);
-            if (!dst)
+            if (payload()[0] != TractionDefs::REQ_SET_FN)
             {
-                // Strange. The consist destination should exist and never be
-                // zero once we got here.
-                b->unref();
-                return release_and_exit();
+                return true;
             }
-            b->data()->reset(message()->data()->mti, train_node()->node_id(),
-                             NodeHandle(dst), message()->data()->payload);
-            if ((payload()[0] == TractionDefs::REQ_SET_SPEED) &&
-                (flags & TractionDefs::CNSTFLAGS_REVERSE)) {
-                b->data()->payload[1] ^= 0x80;
+            uint32_t address = payload()[1];
+            address <<= 8;
+            address |= payload()[2];
+            address <<= 8;
+            address |= payload()[3];
+            if (address == 0)
+            {
+                return flags & TractionDefs::CNSTFLAGS_LINKF0;
             }
-            iface()->addressed_message_write_flow()->send(b);
-            ++nextConsistIndex_;
-            return call_immediately(STATE(maybe_forward_consist));
+            return flags & TractionDefs::CNSTFLAGS_LINKFN;
         }
 
         Action handle_traction_mgmt()
@@ -589,7 +574,6 @@ struct TrainService::Impl
     private:
         /// error code for reject_permanent().
         unsigned errorCode_ : 16;
-        unsigned nextConsistIndex_ : 8;
         /// 1 if the voluntary lock protocol has set this train to be reserved.
         unsigned reserved_ : 1;
         TrainService *trainService_;
@@ -176,6 +176,19 @@ public:
         return 0;
     }
 
+    /** @return an iterator to the first consist target. Use this to walk
+     * all consist targets in one pass; query_consist is linear in id. */
+    TypedQueue<ConsistEntry>::iterator consist_begin()
+    {
+        return consistSlaves_.begin();
+    }
+
+    /** @return the sentinel for consist_begin(). */
+    SimpleQueue::end_iterator consist_end()
+    {
+        return consistSlaves_.end();
+    }
+
     /** Returns the number of slaves in this consist. */
     int query_consist_length()
     {
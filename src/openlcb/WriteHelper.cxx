@@ -41,5 +41,8 @@
 namespace openlcb
 {
 
+EVENT_HANDLER_LOCAL WriteHelper::Interceptor *WriteHelper::interceptor_ =
+    nullptr;
+
 } /* namespace openlcb */
 
@@ -42,6 +42,17 @@
 #include "openlcb/If.hxx"
 #include "openlcb/Node.hxx"
 
+#if defined(__linux__) || defined(__MACH__)
+/// Enables dispatching the event handler calls to a pool of executors (see
+/// config_event_dispatch_threads()). The state that the event handlers share
+/// (the event write helpers and the write interceptor) is per-thread then.
+#define EVENT_PARALLEL_DISPATCH
+/// Storage class of the state shared by the event handlers.
+#define EVENT_HANDLER_LOCAL thread_local
+#else
+#define EVENT_HANDLER_LOCAL
+#endif
+
 namespace openlcb
 {
 
@@ -69,6 +80,37 @@ public:
         waitForLocalLoopback_ = (wait ? 1 : 0);
     }
 
+    /// Receiver for global messages that should not go directly to the
+    /// interface. See @ref set_interceptor.
+    class Interceptor
+    {
+    public:
+        virtual ~Interceptor()
+        {
+        }
+
+        /** Offers a global message to the interceptor.
+         * @param node is the originating node.
+         * @param mti is the message to send.
+         * @param buffer is the message payload.
+         * @param done must be notified when the message is taken care of.
+         * @return true if the interceptor took the message, false if it
+         * should be sent to the interface normally. */
+        virtual bool intercept(Node *node, Defs::MTI mti,
+            const payload_type &buffer, Notifiable *done) = 0;
+    };
+
+    /** Diverts the global messages of all WriteHelpers to an interceptor.
+     * The event service uses this while answering an Identify Events
+     * message. Must be called on the executor that calls WriteAsync. With
+     * EVENT_PARALLEL_DISPATCH the setting is per thread.
+     * @param interceptor will get the messages, or nullptr to send them to
+     * the interface again. */
+    static void set_interceptor(Interceptor *interceptor)
+    {
+        interceptor_ = interceptor;
+    }
+
     /** Originates an NMRAnet message from a particular node.
      *
      * @param node is the originating node.
@@ -96,6 +138,11 @@ public:
             done_.notify();
             return;
         }
+        if (dst == global() && interceptor_ && !waitForLocalLoopback_ &&
+            interceptor_->intercept(node, mti, buffer, &done_))
+        {
+            return;
+        }
         node_ = node;
         mti_ = mti;
         dst_ = dst;
@@ -152,6 +199,9 @@ private:
         HASSERT(0);
     }
 
+    /// Receives the global messages instead of the interface, if set.
+    static EVENT_HANDLER_LOCAL Interceptor *interceptor_;
+
     unsigned waitForLocalLoopback_ : 1;
     NodeHandle dst_;
     Defs::MTI mti_;
@@ -50,6 +50,10 @@ DEFAULT_CONST(num_datagram_registry_entries, 2);
  * happen concurrently. */
 DEFAULT_CONST(num_datagram_clients, 2);
 
+/** Number of incoming multi-frame datagrams that can be reassembled
+ * concurrently on a CAN interface. Each takes about 80 bytes of RAM. */
+DEFAULT_CONST(num_datagram_reassembly_buffers, 4);
+
 /** Maximum number of memory spaces that can be registered for the MemoryConfig
  * datagram handler. */
 DEFAULT_CONST(num_memory_spaces, 5);
@@ -63,3 +67,20 @@ DEFAULT_CONST_FALSE(enable_all_memory_space);
  * identified messages at boot time. This is required by the OpenLCB
  * standard. */
 DEFAULT_CONST_TRUE(node_init_identify);
+
+/** Maximum number of producer / consumer identified messages per second that
+ * the event service sends in response to Identify Events messages. 0 sends
+ * them directly, without rate limiting. */
+DEFAULT_CONST(event_identify_rate, 0);
+
+/** Queue priority of the rate limited identify responses. The lowest
+ * priority lets all other traffic go first. */
+DEFAULT_CONST(event_identify_priority, 3);
+
+/** Set to CONSTANT_TRUE to merge aligned blocks of identified messages with
+ * unknown state into range identified messages. */
+DEFAULT_CONST_FALSE(event_identify_merge_ranges);
+
+/** Number of threads to dispatch the event handler calls to. 0 calls the
+ * handlers on the event service's executor. */
+DEFAULT_CONST(event_dispatch_threads, 0);
@@ -51,6 +51,14 @@
 #include <sys/select.h>
 #endif
 
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+/// Defined when the wakeup can be performed via an eventfd, and the executors
+/// wait for their file descriptors using epoll instead of select.
+#define OSSELECTWAKEUP_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 /// Signal handler that does nothing. @param sig ignored.
 void empty_signal_handler(int sig);
 
@@ -64,6 +72,37 @@ public:
     {
     }
 
+#ifdef OSSELECTWAKEUP_EPOLL
+    ~OSSelectWakeup()
+    {
+        if (eventFd_ >= 0)
+        {
+            ::close(eventFd_);
+        }
+    }
+
+    /** Switches the wakeup mechanism from sending a signal to the locked
+     * thread to writing an eventfd. The caller must watch the returned fd for
+     * reading in the epoll set passed to epoll_wait(), and call
+     * clear_eventfd() when it becomes readable.
+     * @return the eventfd. */
+    int enable_eventfd()
+    {
+        HASSERT(eventFd_ < 0);
+        eventFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        HASSERT(eventFd_ >= 0);
+        return eventFd_;
+    }
+
+    /** Resets the eventfd after it was reported readable. */
+    void clear_eventfd()
+    {
+        uint64_t value;
+        ssize_t ret = ::read(eventFd_, &value, sizeof(value));
+        (void)ret;
+    }
+#endif
+
     /// @return the thread ID that we are engaged upon.
     os_thread_t main_thread() {
         return thread_;
@@ -96,6 +135,28 @@ public:
     /** Wakes up the select in the locked thread. */
     void wakeup()
     {
+#ifdef OSSELECTWAKEUP_EPOLL
+        // Lock-free. Only the first wakeup after the thread cleared the
+        // pending flag needs to do anything; the ones after are batched into
+        // it. Pairs with the flag accesses in epoll_wait().
+        if (__atomic_exchange_n(&pendingWakeup_, true, __ATOMIC_SEQ_CST) ||
+            !__atomic_load_n(&inSelect_, __ATOMIC_SEQ_CST))
+        {
+            return;
+        }
+        if (eventFd_ >= 0)
+        {
+            uint64_t one = 1;
+            // Fails only if the counter is full, in which case the wakeup is
+            // pending anyway.
+            ssize_t ret = ::write(eventFd_, &one, sizeof(one));
+            (void)ret;
+        }
+        else
+        {
+            pthread_kill(thread_, WAKEUP_SIG);
+        }
+#else
         bool need_wakeup = false;
         {
             AtomicHolder l(this);
@@ -117,6 +178,7 @@ public:
             pthread_kill(thread_, WAKEUP_SIG);
 #endif
         }
+#endif // OSSELECTWAKEUP_EPOLL
     }
 
     /// Called from the main thread after being woken up. Enables further
@@ -158,6 +220,14 @@ public:
     int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
         long long deadline_nsec)
     {
+#ifdef OSSELECTWAKEUP_EPOLL
+        // Same protocol as in epoll_wait().
+        __atomic_store_n(&inSelect_, true, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pendingWakeup_, __ATOMIC_SEQ_CST))
+        {
+            deadline_nsec = 0;
+        }
+#else
         {
             AtomicHolder l(this);
             inSelect_ = true;
@@ -172,6 +242,7 @@ public:
 #endif
             }
         }
+#endif
 #ifdef __FreeRTOS__
         int ret =
             Device::select(nfds, readfds, writefds, exceptfds, deadline_nsec);
@@ -193,13 +264,66 @@ public:
         int ret =
             ::pselect(nfds, readfds, writefds, exceptfds, &timeout, &origMask_);
 #endif
+#ifdef OSSELECTWAKEUP_EPOLL
+        __atomic_store_n(&pendingWakeup_, false, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&inSelect_, false, __ATOMIC_SEQ_CST);
+#else
         {
             AtomicHolder l(this);
             pendingWakeup_ = false;
             inSelect_ = false;
         }
+#endif
+        return ret;
+    }
+
+#ifdef OSSELECTWAKEUP_EPOLL
+    /** Waits on an epoll set in a way that can be woken up asynchronously
+     * from a different thread.
+     *
+     * @param epfd is the epoll fd, as in a regular ::epoll_wait call.
+     * @param events is the output buffer, as in a regular ::epoll_wait call.
+     * @param maxevents is the size of events.
+     * @param deadline_nsec is the maximum time to sleep if no fd activity and
+     * no wakeup happens. -1 to sleep indefinitely, 0 to return immediately.
+     * Positive values are rounded up to whole milliseconds.
+     *
+     * @return what epoll_wait would return (number of events filled in, 0 in
+     * case of timeout), or -1 and errno==EINTR if woken up by a signal.
+     */
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+        long long deadline_nsec)
+    {
+        // Either we see the pending flag here, or wakeup() sees inSelect_
+        // and interrupts the wait.
+        __atomic_store_n(&inSelect_, true, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pendingWakeup_, __ATOMIC_SEQ_CST))
+        {
+            deadline_nsec = 0;
+        }
+        int timeout_msec;
+        if (deadline_nsec < 0)
+        {
+            timeout_msec = -1;
+        }
+        else if (deadline_nsec >= MSEC_TO_NSEC(INT32_MAX))
+        {
+            timeout_msec = INT32_MAX;
+        }
+        else
+        {
+            timeout_msec = (deadline_nsec + MSEC_TO_NSEC(1) - 1) /
+                MSEC_TO_NSEC(1);
+        }
+        int ret =
+            ::epoll_pwait(epfd, events, maxevents, timeout_msec, &origMask_);
+        // A wakeup arriving between these two stores is not lost: the
+        // caller looks at its queue after this returns.
+        __atomic_store_n(&pendingWakeup_, false, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&inSelect_, false, __ATOMIC_SEQ_CST);
         return ret;
     }
+#endif
 
 private:
 #if !defined(__FreeRTOS__) && !defined(__WINNT__)
@@ -219,6 +343,11 @@ private:
     /// using to wake up.
     sigset_t origMask_;
 #endif
+#ifdef OSSELECTWAKEUP_EPOLL
+    /// eventfd to write for waking up the thread, or -1 if the wakeup is done
+    /// by a signal.
+    int eventFd_{-1};
+#endif
 };
 
 #endif // _OS_OSSELECTWAKEUP_HXX_
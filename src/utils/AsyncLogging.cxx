@@ -0,0 +1,713 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file AsyncLogging.cxx
+ *
+ * Deferred logging: LOG() calls record the format string and the arguments
+ * into a per-thread ring buffer, and a background thread renders and outputs
+ * them.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#include "utils/AsyncLogging.hxx"
+
+#ifdef ASYNC_LOGGING
+
+#include <algorithm>
+#include <ctype.h>
+
+/// Log ring of one thread. Single producer (the owning thread), single
+/// consumer (drain()).
+struct AsyncLogger::LogRing
+{
+    /// Next ring in the list of all rings. Immutable once the ring is
+    /// published.
+    LogRing *next{nullptr};
+    /// True while a thread owns this ring.
+    std::atomic<bool> inUse{true};
+    /// Number of bytes ever committed. Written only by the owner.
+    std::atomic<size_t> head{0};
+    /// Number of bytes ever consumed. Written only by drain().
+    std::atomic<size_t> tail{0};
+    /// Number of records dropped since drain() last looked.
+    std::atomic<unsigned> dropped{0};
+    /// head after the pending reservation. Used only by the owner.
+    size_t reserved{0};
+    /// Record storage.
+    uint8_t data[RING_SIZE];
+};
+
+/// Gives the ring of a thread back when the thread exits.
+struct AsyncLogger::RingHolder
+{
+    ~RingHolder()
+    {
+        if (ring)
+        {
+            ring->inUse.store(false, std::memory_order_release);
+            ring = nullptr;
+        }
+        exited = true;
+    }
+
+    /// Ring of this thread, or nullptr if not allocated yet.
+    LogRing *ring;
+    /// True once the thread-local destructors ran.
+    bool exited;
+};
+
+std::atomic<AsyncLogger *> AsyncLogger::instance_{nullptr};
+std::atomic<AsyncLogger::LogRing *> AsyncLogger::rings_{nullptr};
+
+AsyncLogger::AsyncLogger(bool start_thread, bool timestamps)
+    : hasThread_(start_thread)
+    , timestamps_(timestamps)
+{
+    os_mutex_init(&drainLock_);
+    os_sem_init(&wakeSem_, 0);
+    os_sem_init(&exitSem_, 0);
+    AsyncLogger *expected = nullptr;
+    HASSERT(instance_.compare_exchange_strong(expected, this));
+    g_log_flush_async = &AsyncLogger::flush_active;
+    if (hasThread_)
+    {
+        os_thread_t thread;
+        os_thread_create(&thread, "log_drain", 0, 0, drain_thread, this);
+    }
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    g_log_flush_async = nullptr;
+    instance_.store(nullptr);
+    if (hasThread_)
+    {
+        exit_.store(true);
+        os_sem_post(&wakeSem_);
+        os_sem_wait(&exitSem_);
+    }
+    drain();
+    os_sem_destroy(&exitSem_);
+    os_sem_destroy(&wakeSem_);
+    os_mutex_destroy(&drainLock_);
+}
+
+void *AsyncLogger::drain_thread(void *arg)
+{
+    AsyncLogger *self = static_cast<AsyncLogger *>(arg);
+    while (!self->exit_.load())
+    {
+        if (!self->drain())
+        {
+            os_sem_timedwait(&self->wakeSem_, DRAIN_PERIOD_NSEC);
+        }
+    }
+    os_sem_post(&self->exitSem_);
+    return nullptr;
+}
+
+AsyncLogger::LogRing *AsyncLogger::thread_ring()
+{
+    static thread_local RingHolder holder{nullptr, false};
+    if (holder.ring || holder.exited)
+    {
+        return holder.ring;
+    }
+    // Reuses the ring of an exited thread.
+    for (LogRing *r = rings_.load(std::memory_order_acquire); r; r = r->next)
+    {
+        bool in_use = false;
+        if (r->inUse.compare_exchange_strong(
+                in_use, true, std::memory_order_acquire))
+        {
+            holder.ring = r;
+            return r;
+        }
+    }
+    LogRing *r = new LogRing;
+    r->next = rings_.load();
+    while (!rings_.compare_exchange_weak(r->next, r))
+    {
+    }
+    holder.ring = r;
+    return r;
+}
+
+uint8_t *AsyncLogger::reserve(size_t bytes, LogRing **ring)
+{
+    LogRing *r = thread_ring();
+    *ring = r;
+    if (!r)
+    {
+        return nullptr;
+    }
+    size_t head = r->head.load(std::memory_order_relaxed);
+    size_t tail = r->tail.load(std::memory_order_acquire);
+    size_t ofs = head % RING_SIZE;
+    size_t pad = 0;
+    if (ofs + bytes > RING_SIZE)
+    {
+        // The record has to start at the beginning of the ring.
+        pad = RING_SIZE - ofs;
+    }
+    if (bytes > RING_SIZE / 2 || head + pad + bytes - tail > RING_SIZE)
+    {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (pad)
+    {
+        RecordHeader h;
+        h.size = pad;
+        h.level = LEVEL_PADDING;
+        memcpy(r->data + ofs, &h, 8);
+        ofs = 0;
+    }
+    r->reserved = head + pad + bytes;
+    if (r->reserved - tail > RING_SIZE / 2 && head - tail <= RING_SIZE / 2)
+    {
+        // Crossed half full; does not wait for the next drain period.
+        AsyncLogger *l = instance_.load(std::memory_order_relaxed);
+        if (l && l->hasThread_)
+        {
+            os_sem_post(&l->wakeSem_);
+        }
+    }
+    return r->data + ofs;
+}
+
+void AsyncLogger::commit(LogRing *ring)
+{
+    ring->head.store(ring->reserved, std::memory_order_release);
+}
+
+/// Skips the padding records of a ring.
+/// @param ring is the ring.
+/// @param tail is the position to start at; will be moved past the padding.
+/// @param head is the end of the committed records.
+static void skip_padding(const uint8_t *data, size_t ring_size,
+    uint8_t padding_level, size_t *tail, size_t head)
+{
+    while (*tail < head)
+    {
+        uint32_t size;
+        uint8_t level;
+        const uint8_t *p = data + (*tail % ring_size);
+        memcpy(&size, p, 4);
+        memcpy(&level, p + 4, 1);
+        if (level != padding_level)
+        {
+            return;
+        }
+        *tail += size;
+    }
+}
+
+unsigned AsyncLogger::drain()
+{
+    os_mutex_lock(&drainLock_);
+    cursors_.clear();
+    for (LogRing *r = rings_.load(std::memory_order_acquire); r; r = r->next)
+    {
+        Cursor c{r, r->tail.load(std::memory_order_relaxed),
+            r->head.load(std::memory_order_acquire)};
+        skip_padding(r->data, RING_SIZE, LEVEL_PADDING, &c.tail, c.head);
+        if (c.tail < c.head)
+        {
+            cursors_.push_back(c);
+        }
+        else
+        {
+            r->tail.store(c.tail, std::memory_order_release);
+        }
+    }
+    unsigned count = 0;
+    while (!cursors_.empty())
+    {
+        // Outputs the oldest record of all rings first.
+        unsigned best = 0;
+        long long best_time = 0;
+        for (unsigned i = 0; i < cursors_.size(); ++i)
+        {
+            long long t;
+            memcpy(&t,
+                cursors_[i].ring->data + (cursors_[i].tail % RING_SIZE) +
+                    offsetof(RecordHeader, timestamp),
+                sizeof(t));
+            if (i == 0 || t < best_time)
+            {
+                best = i;
+                best_time = t;
+            }
+        }
+        Cursor &c = cursors_[best];
+        const uint8_t *p = c.ring->data + (c.tail % RING_SIZE);
+        output_record(p);
+        ++count;
+        uint32_t size;
+        memcpy(&size, p, 4);
+        c.tail += size;
+        skip_padding(c.ring->data, RING_SIZE, LEVEL_PADDING, &c.tail, c.head);
+        c.ring->tail.store(c.tail, std::memory_order_release);
+        if (c.tail >= c.head)
+        {
+            cursors_.erase(cursors_.begin() + best);
+        }
+    }
+    for (LogRing *r = rings_.load(std::memory_order_acquire); r; r = r->next)
+    {
+        unsigned dropped = r->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped)
+        {
+            output_dropped(dropped);
+        }
+    }
+    numRecords_ += count;
+    os_mutex_unlock(&drainLock_);
+    return count;
+}
+
+AsyncLogger::Stats AsyncLogger::stats()
+{
+    os_mutex_lock(&drainLock_);
+    Stats ret{numRecords_, numDropped_};
+    os_mutex_unlock(&drainLock_);
+    return ret;
+}
+
+void AsyncLogger::output_record(const uint8_t *p)
+{
+    RecordHeader h;
+    memcpy(&h, p, sizeof(h));
+    int len = 0;
+    if (timestamps_)
+    {
+        len = snprintf(line_, sizeof(line_), "%lld.%06lld: ",
+            h.timestamp / 1000000000, (h.timestamp / 1000) % 1000000);
+    }
+    len += render(
+        line_ + len, sizeof(line_) - len, h.fmt, p + HEADER_SIZE, h.numArgs);
+    output(line_, len);
+}
+
+void AsyncLogger::output_dropped(unsigned count)
+{
+    numDropped_ += count;
+    int len = snprintf(
+        line_, sizeof(line_), "AsyncLogger: %u log records dropped.", count);
+    output(line_, len);
+}
+
+void AsyncLogger::output(char *buf, int size)
+{
+    log_output(buf, size);
+}
+
+/// Reads the encoded arguments of a record.
+class ArgReader
+{
+public:
+    /// @param args is the first encoded argument. @param count is the number
+    /// of encoded arguments.
+    ArgReader(const uint8_t *args, unsigned count)
+        : p_(args)
+        , count_(count)
+    {
+    }
+
+    /// Takes the next argument. @return false if there are no more.
+    bool next()
+    {
+        if (!count_)
+        {
+            return false;
+        }
+        --count_;
+        uint64_t tag;
+        memcpy(&tag, p_, 8);
+        p_ += 8;
+        type_ = tag & 0xff;
+        size_ = (tag >> 8) & 0xff;
+        memcpy(&value_, p_, 8);
+        p_ += 8;
+        if (type_ == STRING)
+        {
+            size_t len = tag >> 16;
+            str_ = (const char *)p_;
+            p_ += (len + 8) & ~(size_t)7;
+        }
+        return true;
+    }
+
+    /// @return the current argument as a signed integer.
+    long long as_int()
+    {
+        switch (type_)
+        {
+            case DOUBLE:
+            {
+                double d;
+                memcpy(&d, &value_, 8);
+                return (long long)d;
+            }
+            case STRING:
+                return 0;
+            default:
+                return (long long)value_;
+        }
+    }
+
+    /// @return the current argument as printf would read it for an integer
+    /// conversion.
+    /// @param is_signed is true for %d and %i.
+    /// @param width is the size of the type selected by the length modifier
+    /// (e.g. 2 for h). If it is larger than the promoted argument, the
+    /// argument's own size is used, as the caller did not pass more bits.
+    long long as_integer(bool is_signed, unsigned width)
+    {
+        uint64_t v = as_int();
+        if (type_ == INT || type_ == UINT)
+        {
+            // Integers smaller than int are promoted to int.
+            unsigned promoted = std::max(size_, (unsigned)sizeof(int));
+            width = std::min(width, promoted);
+        }
+        if (width < 8)
+        {
+            unsigned shift = 64 - width * 8;
+            v <<= shift;
+            return is_signed ? (long long)v >> shift : (long long)(v >> shift);
+        }
+        return (long long)v;
+    }
+
+    /// @return the current argument as a floating point number.
+    double as_double()
+    {
+        switch (type_)
+        {
+            case DOUBLE:
+            {
+                double d;
+                memcpy(&d, &value_, 8);
+                return d;
+            }
+            case INT:
+                return (long long)value_;
+            case STRING:
+                return 0;
+            default:
+                return value_;
+        }
+    }
+
+    /// @return the current argument as a string, or nullptr if it is not a
+    /// string.
+    const char *as_string()
+    {
+        return type_ == STRING ? str_ : nullptr;
+    }
+
+    /// @return the current argument as a pointer. For a string, this is
+    /// the pointer that was passed to LOG.
+    void *as_pointer()
+    {
+        return (void *)(uintptr_t)value_;
+    }
+
+    /// @return true if the current argument is a null pointer.
+    bool is_null()
+    {
+        return type_ == PTR && value_ == 0;
+    }
+
+    /// Argument type codes; match AsyncLogger::ArgType.
+    enum
+    {
+        INT,
+        UINT,
+        DOUBLE,
+        PTR,
+        STRING
+    };
+
+private:
+    /// Next encoded argument.
+    const uint8_t *p_;
+    /// Number of arguments left.
+    unsigned count_;
+    /// Type of the current argument.
+    unsigned type_{0};
+    /// sizeof the current argument as it was passed to LOG.
+    unsigned size_{0};
+    /// Value of the current scalar argument.
+    uint64_t value_{0};
+    /// Value of the current string argument.
+    const char *str_{nullptr};
+};
+
+uint32_t AsyncLogger::string_args(const char *fmt)
+{
+    // Walks the conversions the same way as render() consumes the
+    // arguments.
+    uint32_t mask = 0;
+    unsigned arg = 0;
+    for (const char *f = fmt; *f && arg < MAX_ARGS; ++f)
+    {
+        if (*f != '%')
+        {
+            continue;
+        }
+        ++f;
+        if (!*f)
+        {
+            break;
+        }
+        if (*f == '%')
+        {
+            continue;
+        }
+        while (*f && strchr("-+ #0", *f))
+        {
+            ++f;
+        }
+        for (int part = 0; part < 2; ++part)
+        {
+            if (part == 1)
+            {
+                if (*f != '.')
+                {
+                    break;
+                }
+                ++f;
+            }
+            if (*f == '*')
+            {
+                ++f;
+                ++arg;
+                continue;
+            }
+            while (isdigit((unsigned char)*f))
+            {
+                ++f;
+            }
+        }
+        while (*f && strchr("hlLqjzt", *f))
+        {
+            ++f;
+        }
+        if (!*f)
+        {
+            break;
+        }
+        if (*f == 's' && arg < MAX_ARGS)
+        {
+            mask |= 1u << arg;
+        }
+        ++arg;
+    }
+    return mask;
+}
+
+int AsyncLogger::render(char *buf, size_t size, const char *fmt,
+    const uint8_t *args, unsigned num_args)
+{
+    static_assert((int)ArgReader::STRING == (int)ARG_STRING &&
+            (int)ArgReader::PTR == (int)ARG_PTR &&
+            (int)ArgReader::DOUBLE == (int)ARG_DOUBLE,
+        "argument type codes must match");
+    HASSERT(size > 0);
+    ArgReader rd(args, num_args);
+    size_t len = 0;
+    const char *f = fmt;
+    while (*f && len < size - 1)
+    {
+        if (*f != '%')
+        {
+            buf[len++] = *f++;
+            continue;
+        }
+        ++f;
+        if (*f == '%')
+        {
+            buf[len++] = '%';
+            ++f;
+            continue;
+        }
+        // Rebuilds the conversion specification with a length modifier that
+        // matches the recorded argument.
+        char spec[48];
+        size_t sl = 0;
+        spec[sl++] = '%';
+        for (unsigned n = 0; *f && strchr("-+ #0", *f); ++f)
+        {
+            if (n++ < 5)
+            {
+                spec[sl++] = *f;
+            }
+        }
+        bool ok = true;
+        for (int part = 0; part < 2 && ok; ++part)
+        {
+            if (part == 1)
+            {
+                if (*f != '.')
+                {
+                    break;
+                }
+                spec[sl++] = *f++;
+            }
+            if (*f == '*')
+            {
+                ++f;
+                if (!rd.next())
+                {
+                    ok = false;
+                    break;
+                }
+                sl += snprintf(spec + sl, 12, "%d", (int)rd.as_int());
+                continue;
+            }
+            for (unsigned n = 0; isdigit((unsigned char)*f); ++f)
+            {
+                if (n++ < 9)
+                {
+                    spec[sl++] = *f;
+                }
+            }
+        }
+        // Size of the integer type selected by the length modifier.
+        unsigned width = sizeof(int);
+        switch (*f)
+        {
+            case 'h':
+                width = f[1] == 'h' ? 1 : 2;
+                break;
+            case 'l':
+                width = f[1] == 'l' ? sizeof(long long) : sizeof(long);
+                break;
+            case 'q':
+                width = sizeof(long long);
+                break;
+            case 'j':
+                width = sizeof(intmax_t);
+                break;
+            case 'z':
+                width = sizeof(size_t);
+                break;
+            case 't':
+                width = sizeof(ptrdiff_t);
+                break;
+        }
+        while (*f && strchr("hlLqjzt", *f))
+        {
+            ++f;
+        }
+        char conv = *f;
+        if (!ok || !conv || !rd.next())
+        {
+            // Out of arguments.
+            break;
+        }
+        ++f;
+        int ret = 0;
+        size_t room = size - len;
+        switch (conv)
+        {
+            case 'd':
+            case 'i':
+                spec[sl++] = 'l';
+                spec[sl++] = 'l';
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                ret = snprintf(
+                    buf + len, room, spec, rd.as_integer(true, width));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec[sl++] = 'l';
+                spec[sl++] = 'l';
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                ret = snprintf(buf + len, room, spec,
+                    (unsigned long long)rd.as_integer(false, width));
+                break;
+            case 'c':
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                ret = snprintf(buf + len, room, spec, (int)rd.as_int());
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                ret = snprintf(buf + len, room, spec, rd.as_double());
+                break;
+            case 's':
+            {
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                const char *s = rd.as_string();
+                if (!s)
+                {
+                    s = rd.is_null() ? "(null)" : "(?)";
+                }
+                ret = snprintf(buf + len, room, spec, s);
+                break;
+            }
+            case 'p':
+                spec[sl++] = conv;
+                spec[sl] = 0;
+                ret = snprintf(buf + len, room, spec, rd.as_pointer());
+                break;
+            default:
+                // %n and unknown conversions print nothing.
+                break;
+        }
+        if (ret > 0)
+        {
+            len += ret;
+            if (len > size - 1)
+            {
+                len = size - 1;
+            }
+        }
+    }
+    buf[len] = 0;
+    return len;
+}
+
+#endif // ASYNC_LOGGING
@@ -0,0 +1,531 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file AsyncLogging.hxx
+ *
+ * Deferred logging: LOG() calls record the format string and the arguments
+ * into a per-thread ring buffer, and a background thread renders and outputs
+ * them.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#ifndef _UTILS_ASYNCLOGGING_HXX_
+#define _UTILS_ASYNCLOGGING_HXX_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+#include "os/os.h"
+#include "utils/logging.h"
+#include "utils/macros.h"
+
+#ifdef ASYNC_LOGGING
+#undef LOG_ASYNC
+/// Hands off a log message to the deferred logger (see @ref AsyncLogger).
+/// Only messages with a literal format string can be deferred, because the
+/// format string is rendered later. @return true if the message was taken
+/// care of.
+#define LOG_ASYNC(level, fmt, args...)                                         \
+    (__builtin_constant_p(fmt) && log_async(level, fmt, ##args))
+#endif
+
+/// Deferred logging mode for LOG().
+///
+/// While an instance of this class exists, LOG() calls with a literal format
+/// string in the source files that include this header do not render
+/// anything on the calling thread. Instead they copy the
+/// format pointer, the arguments and a timestamp into a lock-free ring buffer
+/// owned by the calling thread. A background thread collects the records of
+/// all threads in timestamp order, renders them with snprintf and hands them
+/// to log_output().
+///
+/// Character pointers that the format prints with %s are copied into the
+/// record (truncated at MAX_STRING_ARG), so it is safe to log stack buffers
+/// or std::string contents. Every other pointer, including a char* printed
+/// with %p, is recorded as-is and is never dereferenced. Integers are recorded with their size and signedness, and are
+/// rendered as printf would see them with the h, hh, l, ll, j, z and t
+/// modifiers of the format, e.g. %x of -1 is ffffffff.
+///
+/// Memory is bounded: every thread that ever logged owns a ring of
+/// RING_SIZE bytes, and the ring of an exited thread is reused by the next
+/// thread. The drain thread polls every DRAIN_PERIOD_NSEC, and is woken up
+/// early when a ring gets half full. When a ring is full, records are
+/// dropped and counted; the drain thread outputs a line with the number of
+/// dropped records.
+///
+/// Usage: instantiate once in main(), before starting the threads whose
+/// logging should be deferred.
+class AsyncLogger
+{
+public:
+    /// Number of bytes in the log ring of every thread.
+    static constexpr unsigned RING_SIZE = 16384;
+    /// String arguments longer than this are truncated.
+    static constexpr unsigned MAX_STRING_ARG = 255;
+    /// How long the drain thread sleeps when there is nothing to output.
+    static constexpr long long DRAIN_PERIOD_NSEC = MSEC_TO_NSEC(2);
+
+    /// Counters of the deferred logger.
+    struct Stats
+    {
+        /// Number of records output.
+        uint64_t records;
+        /// Number of records dropped because the ring of the logging thread
+        /// was full.
+        uint64_t dropped;
+    };
+
+    /// Starts deferred logging. Only one instance may exist at a time.
+    /// @param start_thread if false, no drain thread is started, and the
+    /// records are only output when drain() or flush() is called.
+    /// @param timestamps if true, every output line is prefixed with the
+    /// monotonic time (seconds.microseconds) of the LOG call.
+    AsyncLogger(bool start_thread = true, bool timestamps = true);
+
+    /// Stops deferred logging, then outputs all pending records.
+    virtual ~AsyncLogger();
+
+    /// Outputs all pending records. Thread-safe.
+    /// @return the number of records output.
+    unsigned drain();
+
+    /// Outputs every record that was logged before this call.
+    void flush()
+    {
+        drain();
+    }
+
+    /// Outputs the pending records of the active deferred logger, if any.
+    /// Called by LOG(FATAL) before it aborts, through g_log_flush_async.
+    static void flush_active()
+    {
+        AsyncLogger *l = instance_.load();
+        if (l)
+        {
+            l->flush();
+        }
+    }
+
+    /// @return a copy of the counters.
+    Stats stats();
+
+    /// @return true if there is an active deferred logger.
+    static bool is_active()
+    {
+        return instance_.load(std::memory_order_relaxed) != nullptr;
+    }
+
+    /// Records a log message. Called by the LOG() macro.
+    /// @param level is the log level.
+    /// @param fmt is the printf format string. Must be a string literal.
+    /// @param args are the printf arguments.
+    /// @return false if deferred logging is not active or the arguments
+    /// cannot be recorded; the caller then has to render the message itself.
+    template <typename... Args>
+    static bool log(int level, const char *fmt, Args... args)
+    {
+        return log_impl(std::integral_constant<bool,
+                            AllEncodable<Args...>::value &&
+                                sizeof...(Args) <= MAX_ARGS>(),
+            level, fmt, args...);
+    }
+
+    /// Renders a recorded message.
+    /// @param buf is the output buffer.
+    /// @param size is the size of the output buffer.
+    /// @param fmt is the printf format string.
+    /// @param args is the encoded argument list.
+    /// @param num_args is the number of encoded arguments.
+    /// @return the number of characters written to buf, excluding the
+    /// terminating zero.
+    static int render(char *buf, size_t size, const char *fmt,
+        const uint8_t *args, unsigned num_args);
+
+protected:
+    /// Outputs a rendered line. The default implementation calls
+    /// log_output().
+    /// @param buf is the rendered line, zero terminated at buf[size].
+    /// @param size is the length of the line.
+    virtual void output(char *buf, int size);
+
+private:
+    struct LogRing;
+    struct RingHolder;
+
+    /// Types of encoded arguments.
+    enum ArgType : uint8_t
+    {
+        ARG_INT,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_PTR,
+        ARG_STRING,
+    };
+
+    /// Start of every record in the ring. The first two fields are also
+    /// used for padding records.
+    struct RecordHeader
+    {
+        /// Total size of the record in bytes, a multiple of 8.
+        uint32_t size;
+        /// Log level, or LEVEL_PADDING.
+        uint8_t level;
+        /// Number of encoded arguments following the header.
+        uint8_t numArgs;
+        /// Format string.
+        const char *fmt;
+        /// os_get_time_monotonic() at the LOG call.
+        long long timestamp;
+    };
+
+    /// Messages with more arguments than this are not deferred.
+    static constexpr unsigned MAX_ARGS = 32;
+
+    /// Level of a record that fills the end of the ring before wrapping.
+    static constexpr uint8_t LEVEL_PADDING = 0xff;
+
+    /// @return n rounded up to a multiple of 8.
+    static constexpr size_t round8(size_t n)
+    {
+        return (n + 7) & ~(size_t)7;
+    }
+
+    /// Size of the record header in the ring.
+    static constexpr size_t HEADER_SIZE = (sizeof(RecordHeader) + 7) & ~7;
+
+    /// Writes the tag word of an argument. @param p is where to write.
+    /// @param type is the argument type. @param arg_size is sizeof the
+    /// argument as it was passed to LOG. @param len is the string length.
+    /// @return pointer after the tag word.
+    static uint8_t *put_tag(
+        uint8_t *p, ArgType type, unsigned arg_size, uint32_t len = 0)
+    {
+        uint64_t tag = type | (arg_size << 8) | ((uint64_t)len << 16);
+        memcpy(p, &tag, 8);
+        return p + 8;
+    }
+
+    /// Encodes a scalar argument. @param p is where to write. @param type
+    /// is the argument type. @param v is the value. @param arg_size is
+    /// sizeof the argument as it was passed to LOG. @return pointer after
+    /// the argument.
+    template <typename T>
+    static uint8_t *put(uint8_t *p, ArgType type, T v, unsigned arg_size)
+    {
+        static_assert(sizeof(T) == 8, "arguments are stored in 8 bytes");
+        p = put_tag(p, type, arg_size);
+        memcpy(p, &v, 8);
+        return p + 8;
+    }
+
+    /// Argument encoder. Types without a specialization cannot be deferred.
+    ///
+    /// The specializations have size(v, as_string), which returns the
+    /// encoded size of v, and encode(p, v, as_string), which writes v to p
+    /// and returns the pointer after it. as_string is true if the format
+    /// prints the argument with %s.
+    template <typename T, typename Enable = void> struct Encoder
+    {
+        /// False for types that cannot be recorded.
+        static constexpr bool OK = false;
+        /// True if the argument may have to be copied as a string.
+        static constexpr bool MAY_BE_STRING = false;
+    };
+
+    /// Tells whether all argument types can be recorded.
+    template <typename... Ts> struct AllEncodable;
+
+    /// Tells whether any argument may have to be copied as a string.
+    template <typename... Ts> struct AnyString;
+
+    /// Finds the arguments that a format prints with %s.
+    /// @param fmt is the printf format string.
+    /// @return a bit mask, bit i set if argument i is a %s argument.
+    static uint32_t string_args(const char *fmt);
+
+    /// Deferred logging for arguments that can not be recorded. @return
+    /// false.
+    template <typename... Args>
+    static bool log_impl(std::false_type, int, const char *, Args...)
+    {
+        return false;
+    }
+
+    /// Records a message. See @ref log.
+    template <typename... Args>
+    static bool log_impl(std::true_type, int level, const char *fmt,
+        Args... args)
+    {
+        if (!is_active())
+        {
+            return false;
+        }
+        uint32_t strings = AnyString<Args...>::value ? string_args(fmt) : 0;
+        unsigned idx = 0;
+        size_t sizes[] = {HEADER_SIZE,
+            Encoder<Args>::size(args, (strings >> idx++) & 1)...};
+        size_t total = 0;
+        for (size_t s : sizes)
+        {
+            total += s;
+        }
+        LogRing *ring;
+        uint8_t *p = reserve(total, &ring);
+        if (!p)
+        {
+            // Either the record was dropped (and counted), or this thread
+            // cannot have a ring anymore.
+            return ring != nullptr;
+        }
+        RecordHeader h;
+        h.size = total;
+        h.level = level;
+        h.numArgs = sizeof...(Args);
+        h.fmt = fmt;
+        h.timestamp = os_get_time_monotonic();
+        memcpy(p, &h, sizeof(h));
+        p += HEADER_SIZE;
+        idx = 0;
+        int unused[] = {0,
+            (p = Encoder<Args>::encode(p, args, (strings >> idx++) & 1),
+                0)...};
+        (void)unused;
+        commit(ring);
+        return true;
+    }
+
+    /// Reserves space in the ring of the calling thread.
+    /// @param bytes is the size of the record, a multiple of 8.
+    /// @param ring will be set to the ring of the calling thread, or nullptr
+    /// if the thread is exiting and has no ring.
+    /// @return where to write the record, or nullptr if the record cannot be
+    /// recorded.
+    static uint8_t *reserve(size_t bytes, LogRing **ring);
+
+    /// Makes the reserved record visible to the drain thread.
+    /// @param ring is the ring returned by reserve.
+    static void commit(LogRing *ring);
+
+    /// @return the ring of the calling thread, allocating one if needed.
+    static LogRing *thread_ring();
+
+    /// Entry point of the drain thread. @param arg is the AsyncLogger.
+    static void *drain_thread(void *arg);
+
+    /// Renders and outputs one record.
+    /// @param p is the record in the ring.
+    void output_record(const uint8_t *p);
+
+    /// Outputs a notice about dropped records. @param count is how many
+    /// records were dropped.
+    void output_dropped(unsigned count);
+
+    /// The active logger, or nullptr.
+    static std::atomic<AsyncLogger *> instance_;
+    /// All rings ever allocated, linked through LogRing::next.
+    static std::atomic<LogRing *> rings_;
+
+    /// Position of drain() in one ring.
+    struct Cursor
+    {
+        /// The ring.
+        LogRing *ring;
+        /// Next record to output.
+        size_t tail;
+        /// End of the records that were committed when drain() started.
+        size_t head;
+    };
+
+    /// Serializes drain() calls.
+    os_mutex_t drainLock_;
+    /// Posted to wake up the drain thread.
+    os_sem_t wakeSem_;
+    /// Posted by the drain thread when it exits.
+    os_sem_t exitSem_;
+    /// Rings with pending records during drain().
+    std::vector<Cursor> cursors_;
+    /// Tells the drain thread to exit.
+    std::atomic<bool> exit_{false};
+    /// True if the drain thread was started.
+    bool hasThread_;
+    /// True if output lines get a timestamp prefix.
+    bool timestamps_;
+    /// Number of records output.
+    uint64_t numRecords_{0};
+    /// Number of records dropped.
+    uint64_t numDropped_{0};
+    /// Line buffer for rendering.
+    char line_[sizeof(logbuffer)];
+
+    DISALLOW_COPY_AND_ASSIGN(AsyncLogger);
+};
+
+/// Encoder for signed integers and enums.
+template <typename T>
+struct AsyncLogger::Encoder<T,
+    typename std::enable_if<(std::is_integral<T>::value &&
+                                std::is_signed<T>::value) ||
+        std::is_enum<T>::value>::type>
+{
+    static constexpr bool OK = true;
+    static constexpr bool MAY_BE_STRING = false;
+    static size_t size(T, bool)
+    {
+        return 16;
+    }
+    static uint8_t *encode(uint8_t *p, T v, bool)
+    {
+        return put(p, ARG_INT, (int64_t)v, sizeof(T));
+    }
+};
+
+/// Encoder for unsigned integers.
+template <typename T>
+struct AsyncLogger::Encoder<T,
+    typename std::enable_if<std::is_integral<T>::value &&
+        !std::is_signed<T>::value>::type>
+{
+    static constexpr bool OK = true;
+    static constexpr bool MAY_BE_STRING = false;
+    static size_t size(T, bool)
+    {
+        return 16;
+    }
+    static uint8_t *encode(uint8_t *p, T v, bool)
+    {
+        return put(p, ARG_UINT, (uint64_t)v, sizeof(T));
+    }
+};
+
+/// Encoder for floating point numbers.
+template <typename T>
+struct AsyncLogger::Encoder<T,
+    typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static constexpr bool OK = true;
+    static constexpr bool MAY_BE_STRING = false;
+    static size_t size(T, bool)
+    {
+        return 16;
+    }
+    static uint8_t *encode(uint8_t *p, T v, bool)
+    {
+        return put(p, ARG_DOUBLE, (double)v, sizeof(T));
+    }
+};
+
+/// Encoder for pointers. Character pointers printed with %s are copied as
+/// strings, after the pointer value.
+template <typename T>
+struct AsyncLogger::Encoder<T *, void>
+{
+    static constexpr bool OK = true;
+    /// True if the pointer may point to a string.
+    static constexpr bool MAY_BE_STRING =
+        std::is_same<typename std::remove_cv<T>::type, char>::value ||
+        std::is_same<typename std::remove_cv<T>::type, signed char>::value ||
+        std::is_same<typename std::remove_cv<T>::type, unsigned char>::value;
+    static size_t length(T *v)
+    {
+        return strnlen((const char *)v, MAX_STRING_ARG);
+    }
+    static size_t size(T *v, bool as_string)
+    {
+        return MAY_BE_STRING && as_string && v ? 16 + round8(length(v) + 1)
+                                               : 16;
+    }
+    static uint8_t *encode(uint8_t *p, T *v, bool as_string)
+    {
+        if (!MAY_BE_STRING || !as_string || !v)
+        {
+            return put(p, ARG_PTR, (uint64_t)(uintptr_t)v, sizeof(v));
+        }
+        size_t len = length(v);
+        p = put_tag(p, ARG_STRING, sizeof(v), len);
+        uint64_t value = (uintptr_t)v;
+        memcpy(p, &value, 8);
+        p += 8;
+        memcpy(p, v, len);
+        p[len] = 0;
+        return p + round8(len + 1);
+    }
+};
+
+/// Encoder for nullptr.
+template <> struct AsyncLogger::Encoder<std::nullptr_t, void>
+{
+    static constexpr bool OK = true;
+    static constexpr bool MAY_BE_STRING = false;
+    static size_t size(std::nullptr_t, bool)
+    {
+        return 16;
+    }
+    static uint8_t *encode(uint8_t *p, std::nullptr_t, bool)
+    {
+        return put(p, ARG_PTR, (uint64_t)0, sizeof(void *));
+    }
+};
+
+template <> struct AsyncLogger::AllEncodable<>
+{
+    static constexpr bool value = true;
+};
+
+template <typename T, typename... Ts> struct AsyncLogger::AllEncodable<T, Ts...>
+{
+    static constexpr bool value =
+        Encoder<T>::OK && AllEncodable<Ts...>::value;
+};
+
+template <> struct AsyncLogger::AnyString<>
+{
+    static constexpr bool value = false;
+};
+
+template <typename T, typename... Ts> struct AsyncLogger::AnyString<T, Ts...>
+{
+    static constexpr bool value =
+        Encoder<T>::MAY_BE_STRING || AnyString<Ts...>::value;
+};
+
+/// Hands off a log message to the deferred logger. Called by LOG().
+/// @param level is the log level.
+/// @param fmt is the printf format string. Must be a string literal.
+/// @param args are the printf arguments.
+/// @return false if the caller has to render the message itself.
+template <typename... Args>
+inline bool log_async(int level, const char *fmt, Args... args)
+{
+    return AsyncLogger::log(level, fmt, args...);
+}
+
+#endif // _UTILS_ASYNCLOGGING_HXX_
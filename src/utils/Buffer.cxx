@@ -40,6 +40,7 @@ Pool* init_main_buffer_pool()
     if (!mainBufferPool)
     {
         mainBufferPool = new DynamicPool(Bucket::init(16, 32, 48, 72, 0));
+        mainBufferPool->enable_thread_cache();
     }
     return mainBufferPool;
 }
@@ -74,7 +75,7 @@ size_t DynamicPool::free_items()
     size_t total = 0;
     for (Bucket *current = buckets; current->size() != 0; ++current)
     {
-        total += current->pending();
+        total += current->pending() + cached_items(current);
     }
     return total;
 }
@@ -89,7 +90,7 @@ size_t DynamicPool::free_items(size_t size)
     {
         if (current->size() >= size)
         {
-            return current->pending();
+            return current->pending() + cached_items(current);
         }
     }
     return 0;
@@ -125,7 +126,14 @@ BufferBase *DynamicPool::alloc_untyped(size_t size, Executable *flow)
     {
         if (size <= current->size())
         {
-            result = static_cast<BufferBase*>(current->next().item);
+            if (threadCache_)
+            {
+                result = cache_alloc(current);
+            }
+            else
+            {
+                result = static_cast<BufferBase*>(current->next().item);
+            }
             if (result == NULL)
             {
                 result = (BufferBase*)buffer_malloc(current->size());
@@ -189,7 +197,10 @@ void DynamicPool::free(BufferBase *item)
     {
         if (item->size() <= current->size())
         {
-            current->insert(item);
+            if (!threadCache_ || !cache_free(current, item))
+            {
+                current->insert(item);
+            }
             return;
         }
     }
@@ -201,6 +212,165 @@ void DynamicPool::free(BufferBase *item)
     free_large(item);
 }
 
+#ifdef DYNAMICPOOL_THREAD_CACHE
+
+/// Free buffers of one DynamicPool held by one thread.
+struct DynamicPool::ThreadCache
+{
+    ~ThreadCache()
+    {
+        if (pool)
+        {
+            pool->cache_flush(this);
+        }
+    }
+
+    /// The pool these buffers belong to. Bound at first use.
+    DynamicPool *pool{nullptr};
+    /// Allocations served from the cache since the last flush of the
+    /// statistics.
+    size_t hits{0};
+    /// Allocations not served from the cache since the last flush of the
+    /// statistics.
+    size_t misses{0};
+    /// Number of entries used in items, per bucket.
+    uint8_t count[CACHE_BUCKETS] = {0};
+    /// Free buffers, per bucket. The most recently freed are at the end.
+    BufferBase *items[CACHE_BUCKETS][CACHE_SIZE];
+};
+
+thread_local DynamicPool::ThreadCache DynamicPool::tlsCache_;
+
+BufferBase *DynamicPool::cache_alloc(Bucket *bucket)
+{
+    unsigned idx = bucket - buckets;
+    ThreadCache *c = &tlsCache_;
+    if (c->pool != this)
+    {
+        if (c->pool)
+        {
+            // This thread caches for a different pool.
+            return static_cast<BufferBase *>(bucket->next().item);
+        }
+        c->pool = this;
+    }
+    if (idx >= CACHE_BUCKETS)
+    {
+        return static_cast<BufferBase *>(bucket->next().item);
+    }
+    if (c->count[idx])
+    {
+        ++c->hits;
+        return c->items[idx][--c->count[idx]];
+    }
+    ++c->misses;
+    {
+        AtomicHolder h(bucket);
+        while (c->count[idx] < CACHE_BATCH)
+        {
+            QMember *m = bucket->next_locked();
+            if (!m)
+            {
+                break;
+            }
+            c->items[idx][c->count[idx]++] = static_cast<BufferBase *>(m);
+        }
+    }
+    {
+        AtomicHolder h(this);
+        cacheHits_ += c->hits;
+        cacheMisses_ += c->misses;
+    }
+    c->hits = c->misses = 0;
+    if (c->count[idx])
+    {
+        return c->items[idx][--c->count[idx]];
+    }
+    return nullptr;
+}
+
+bool DynamicPool::cache_free(Bucket *bucket, BufferBase *item)
+{
+    unsigned idx = bucket - buckets;
+    ThreadCache *c = &tlsCache_;
+    if (c->pool != this)
+    {
+        if (c->pool)
+        {
+            return false;
+        }
+        c->pool = this;
+    }
+    if (idx >= CACHE_BUCKETS)
+    {
+        return false;
+    }
+    if (c->count[idx] >= CACHE_SIZE)
+    {
+        // Returns the least recently freed half to the shared bucket.
+        {
+            AtomicHolder h(bucket);
+            for (unsigned i = 0; i < CACHE_BATCH; ++i)
+            {
+                bucket->insert_locked(c->items[idx][i]);
+            }
+        }
+        memmove(&c->items[idx][0], &c->items[idx][CACHE_BATCH],
+            (CACHE_SIZE - CACHE_BATCH) * sizeof(c->items[idx][0]));
+        c->count[idx] -= CACHE_BATCH;
+    }
+    c->items[idx][c->count[idx]++] = item;
+    return true;
+}
+
+void DynamicPool::cache_flush(ThreadCache *cache)
+{
+    for (unsigned idx = 0;
+         idx < CACHE_BUCKETS && buckets[idx].size() != 0; ++idx)
+    {
+        AtomicHolder h(&buckets[idx]);
+        for (unsigned i = 0; i < cache->count[idx]; ++i)
+        {
+            buckets[idx].insert_locked(cache->items[idx][i]);
+        }
+        cache->count[idx] = 0;
+    }
+    AtomicHolder h(this);
+    cacheHits_ += cache->hits;
+    cacheMisses_ += cache->misses;
+    cache->hits = cache->misses = 0;
+}
+
+size_t DynamicPool::cached_items(Bucket *bucket)
+{
+    unsigned idx = bucket - buckets;
+    ThreadCache *c = &tlsCache_;
+    if (c->pool != this || idx >= CACHE_BUCKETS)
+    {
+        return 0;
+    }
+    return c->count[idx];
+}
+
+#else
+
+BufferBase *DynamicPool::cache_alloc(Bucket *bucket)
+{
+    return static_cast<BufferBase *>(bucket->next().item);
+}
+
+bool DynamicPool::cache_free(Bucket *bucket, BufferBase *item)
+{
+    return false;
+}
+
+size_t DynamicPool::cached_items(Bucket *bucket)
+{
+    return 0;
+}
+
+#endif // DYNAMICPOOL_THREAD_CACHE
+
 /** Get a free item out of the pool.
  * @param size how many payload bytes should he allocated buffer have. Usually
  * sizeof<T> for Buffer<T>.
@@ -37,6 +37,12 @@
 // Enable this to collect the pointer of all buffers live.
 //#define DEBUG_BUFFER_MEMORY
 
+#if defined(__linux__) || defined(__MACH__)
+/// Enables the per-thread buffer caches of DynamicPool. These only help on
+/// hosts where multiple executor threads share the mainBufferPool.
+#define DYNAMICPOOL_THREAD_CACHE
+#endif
+
 #include <memory>
 #include <new>
 #include <cstdint>
@@ -495,6 +501,46 @@ public:
         return totalSize;
     }
 
+    /** Turns on a per-thread cache (magazine) of free buffers in front of
+     * each bucket. Allocations and frees are served from the calling thread's
+     * cache without locking; the cache is refilled from and drained to the
+     * shared buckets CACHE_BATCH buffers at a time. A thread can cache
+     * buffers of only one pool; the pool must outlive all threads that used
+     * it. Must be called before the first allocation. No-op on platforms
+     * without DYNAMICPOOL_THREAD_CACHE.
+     *
+     * The free_items() calls count the buffers in the calling thread's
+     * cache, but not those cached by other threads. */
+    void enable_thread_cache()
+    {
+#ifdef DYNAMICPOOL_THREAD_CACHE
+        threadCache_ = true;
+#endif
+    }
+
+    /** @return the number of allocations served from a per-thread cache. The
+     * per-thread counts are added at every refill or drain of the thread's
+     * cache, so the latest ones may be missing. */
+    size_t cache_hits()
+    {
+        return cacheHits_;
+    }
+
+    /** @return the number of allocations that had to go to the shared
+     * buckets (or the heap) while per-thread caches were enabled. */
+    size_t cache_misses()
+    {
+        return cacheMisses_;
+    }
+
+    /// How many free buffers a thread caches per bucket.
+    static const unsigned CACHE_SIZE = 32;
+    /// How many buffers are moved at a time between a thread's cache and the
+    /// shared bucket.
+    static const unsigned CACHE_BATCH = CACHE_SIZE / 2;
+    /// Only the first this many buckets are cached.
+    static const unsigned CACHE_BUCKETS = 8;
+
 protected:
     /** keep track of total allocated size of memory */
     size_t totalSize;
@@ -503,6 +549,42 @@ protected:
     Bucket *buckets;
 
 private:
+    struct ThreadCache;
+
+    /** Takes a buffer from the calling thread's cache, refilling the cache
+     * from the shared bucket if needed.
+     * @param bucket is the bucket to allocate from.
+     * @return the buffer, or nullptr if the cache cannot be used or the
+     * shared bucket is empty too. */
+    BufferBase *cache_alloc(Bucket *bucket);
+
+    /** Puts a buffer into the calling thread's cache, draining the cache to
+     * the shared bucket if it is full.
+     * @param bucket is the bucket the item belongs to.
+     * @param item is the buffer to release.
+     * @return false if the cache cannot be used. */
+    bool cache_free(Bucket *bucket, BufferBase *item);
+
+    /** Returns all buffers of a thread's cache to the shared buckets. Called
+     * when the thread exits. @param cache is the thread's cache. */
+    void cache_flush(ThreadCache *cache);
+
+    /** @return the number of buffers in the calling thread's cache for a
+     * given bucket. */
+    size_t cached_items(Bucket *bucket);
+
+#ifdef DYNAMICPOOL_THREAD_CACHE
+    /// The calling thread's buffer cache.
+    static thread_local ThreadCache tlsCache_;
+#endif
+
+    /// true if the per-thread caches are enabled.
+    bool threadCache_{false};
+    /// Statistics: allocations served from a thread cache.
+    size_t cacheHits_{0};
+    /// Statistics: allocations not served from a thread cache.
+    size_t cacheMisses_{0};
+
     /** Get a free item out of the pool.
      * @param result pointer to a pointer to the result
      * @param flow if !NULL, then the alloc call is considered async and will
@@ -140,9 +140,9 @@ TEST(EepromStaticTest, assertions) {
 class EepromTest : public ::testing::Test {
 protected:
     /// Creates the eeprom under test. @param clear if true, eeprom starts up
-    /// empty.
-    void create(bool clear = true) {
-        e.reset(new MyEEPROM(eeprom_size, clear));
+    /// empty. @param size is the file size of the eeprom.
+    void create(bool clear = true, size_t size = eeprom_size) {
+        e.reset(new MyEEPROM(size, clear));
     }
 
     /// Helper function to write to the test eeprom.
@@ -289,3 +289,79 @@ TEST_F(EepromTest, many_overflow) {
     EXPECT_AT(13, "abcd");
     EXPECT_EQ(s, e->activeSector_);
 }
+
+TEST_F(EepromTest, odd_size_overflow) {
+    // The last block of the file is only partially used.
+    create(true, eeprom_size + 1);
+    write_to(eeprom_size, "z");
+    EXPECT_AT(eeprom_size, "z");
+    overflow_block();
+    EXPECT_EQ(1, e->activeSector_);
+    EXPECT_AT(eeprom_size, "z");
+    overflow_block();
+    EXPECT_AT(eeprom_size, "z");
+    create(false, eeprom_size + 1);
+    EXPECT_AT(eeprom_size, "z");
+}
+
+TEST_F(EepromTest, random_writes) {
+    create();
+    string model(eeprom_size, '\xFF');
+    unsigned int seed = 17;
+    for (int i = 0; i < 2000; ++i) {
+        unsigned ofs = rand_r(&seed) % eeprom_size;
+        unsigned len = 1 + rand_r(&seed) % 20;
+        len = std::min(len, eeprom_size - ofs);
+        string payload;
+        for (unsigned j = 0; j < len; ++j) {
+            payload.push_back(rand_r(&seed) & 0xff);
+        }
+        write_to(ofs, payload);
+        model.replace(ofs, len, payload);
+
+        ofs = rand_r(&seed) % eeprom_size;
+        len = std::min(1u + rand_r(&seed) % 30, eeprom_size - ofs);
+        EXPECT_AT(ofs, model.substr(ofs, len));
+    }
+    // The writes have been through several sectors.
+    EXPECT_NE(0, e->activeSector_);
+    EXPECT_AT(0, model);
+    // Reboot MCU
+    create(false);
+    EXPECT_AT(0, model);
+}
+
+/// Measures mounting a large, fully written eeprom, then reading all of it
+/// in small chunks as a node does when loading its configuration.
+TEST_F(EepromTest, benchmark) {
+    static constexpr unsigned size = 2000;
+    static constexpr unsigned NUM_ROUNDS = 20;
+    create(true, size);
+    string data(size, 0);
+    for (unsigned i = 0; i < size; ++i) {
+        data[i] = i & 0x7f;
+    }
+    write_to(0, data);
+    EXPECT_AT(0, data);
+
+    long long mount_time = 0;
+    long long read_time = 0;
+    for (unsigned r = 0; r < NUM_ROUNDS; ++r) {
+        long long start = os_get_time_monotonic();
+        create(false, size);
+        long long mounted = os_get_time_monotonic();
+        char buf[4];
+        for (unsigned ofs = 0; ofs < size; ofs += sizeof(buf)) {
+            ee()->read(ofs, buf, sizeof(buf));
+        }
+        long long done = os_get_time_monotonic();
+        mount_time += mounted - start;
+        read_time += done - mounted;
+    }
+    printf("shadow %d index %d: mount %lld usec, %u 4-byte reads %lld usec "
+           "(%lld nsec per read)\n", EEPROMEmulation::SHADOW_IN_RAM,
+        EEPROMEmulation::INDEX_IN_RAM, mount_time / NUM_ROUNDS / 1000,
+        size / 4, read_time / NUM_ROUNDS / 1000,
+        read_time / NUM_ROUNDS / (size / 4));
+    EXPECT_AT(0, data);
+}
@@ -32,6 +32,7 @@
  * @date 26 May 2016
  */
 
+#include <string.h>
 #include <string>
 
 #include "utils/GcStreamParser.hxx"
@@ -75,6 +76,69 @@ bool GcStreamParser::consume_byte(char c)
     return false;
 }
 
+bool GcStreamParser::consume_data(const char **data, size_t *len)
+{
+    const char *p = *data;
+    const char *end = p + *len;
+    bool complete = false;
+    while (p < end)
+    {
+        if (offset_ < 0)
+        {
+            // Drops bytes to the floor until the start of a packet.
+            const char *start =
+                static_cast<const char *>(memchr(p, ':', end - p));
+            if (!start)
+            {
+                p = end;
+                break;
+            }
+            p = start + 1;
+            offset_ = 0;
+            continue;
+        }
+        // Finds the next delimiter, but looks at most one byte beyond what
+        // fits into the frame buffer.
+        size_t room = sizeof(cbuf_) - 1 - offset_;
+        const char *limit = end - p > (ptrdiff_t)room ? p + room + 1 : end;
+        const char *q = p;
+        while (q < limit && *q != ':' && *q != ';')
+        {
+            ++q;
+        }
+        size_t count = q - p;
+        if (count > room)
+        {
+            // We overran the buffer, so this can't be a valid frame.
+            // Reset and look for sync byte again.
+            offset_ = -1;
+            p = q;
+            continue;
+        }
+        memcpy(cbuf_ + offset_, p, count);
+        offset_ += count;
+        p = q;
+        if (p == end)
+        {
+            break;
+        }
+        if (*p++ == ':')
+        {
+            // Frame is starting here.
+            offset_ = 0;
+            continue;
+        }
+        // Frame ends here.
+        cbuf_[offset_] = 0;
+        offset_ = -1;
+        complete = true;
+        break;
+    }
+    *len -= p - *data;
+    *data = p;
+    return complete;
+}
+
 void GcStreamParser::frame_buffer(std::string* payload) {
     if (offset_ >= 0) {
         payload->assign(cbuf_, offset_);
@@ -56,6 +56,20 @@ public:
      * internal buffer contains a complete frame. @param c next character. */
     bool consume_byte(char c);
 
+    /** Adds a block of characters from the source stream. Processes the
+     * characters up to and including the end of the first complete frame, or
+     * the entire block if there is no frame ending in it. Equivalent to
+     * calling consume_byte for each character, but it is faster because it
+     * searches for the frame delimiters and copies the frame contents in
+     * bulk.
+     *
+     * @param data points to the next character; will be advanced past the
+     * processed characters.
+     * @param len is the number of characters at data; will be decremented by
+     * the number of processed characters.
+     * @return true if the internal buffer contains a complete frame. */
+    bool consume_data(const char **data, size_t *len);
+
     /** Parses the current contents of the frame buffer to a can_frame
      * struct. Should be called if and inly if the previous consume_char call
      * returned true.
@@ -31,10 +31,15 @@
  * @date 26 Apr 2014
  */
 
+#include <algorithm>
 #include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "utils/GcTcpHub.hxx"
 
+#include "executor/Executor.hxx"
+#include "executor/Service.hxx"
 #include "nmranet_config.h"
 #include "utils/GridConnectHub.hxx"
 
@@ -42,11 +47,71 @@ void GcTcpHub::OnNewConnection(int fd)
 {
     const bool use_select =
         (config_gridconnect_tcp_use_select() == CONSTANT_TRUE);
-    create_gc_port_for_can_hub(canHub_, fd, nullptr, use_select);
+    Service *port_service = nullptr;
+    if (!services_.empty())
+    {
+        port_service = services_[nextService_].get();
+        if (++nextService_ >= services_.size())
+        {
+            nextService_ = 0;
+        }
+    }
+    Connection *c = new Connection(this, ::dup(fd));
+    {
+        OSMutexLock h(&lock_);
+        connections_.push_back(c);
+    }
+    create_gc_port_for_can_hub(canHub_, fd, c, use_select, port_service);
 }
 
-GcTcpHub::GcTcpHub(CanHubFlow *can_hub, int port)
+void GcTcpHub::Connection::notify()
+{
+    GcTcpHub *parent = parent_;
+    {
+        OSMutexLock h(&parent->lock_);
+        auto &v = parent->connections_;
+        v.erase(std::remove(v.begin(), v.end(), this), v.end());
+        if (parent->shuttingDown_ && v.empty())
+        {
+            parent->allClosed_.post();
+        }
+    }
+    ::close(fd_);
+    delete this;
+}
+
+/// Starts the executors for the connection thread pool.
+/// @param num_threads how many threads to start.
+/// @return the executors.
+static std::vector<std::unique_ptr<ExecutorBase>> create_executors(
+    unsigned num_threads)
+{
+    std::vector<std::unique_ptr<ExecutorBase>> ret;
+    for (unsigned i = 0; i < num_threads; ++i)
+    {
+        ret.emplace_back(new Executor<1>("gc_tcp_hub", 0, 1024));
+    }
+    return ret;
+}
+
+/// Creates a service for each executor of the thread pool.
+/// @param executors the executors of the thread pool.
+/// @return the services.
+static std::vector<std::unique_ptr<Service>> create_services(
+    const std::vector<std::unique_ptr<ExecutorBase>> &executors)
+{
+    std::vector<std::unique_ptr<Service>> ret;
+    for (const auto &e : executors)
+    {
+        ret.emplace_back(new Service(e.get()));
+    }
+    return ret;
+}
+
+GcTcpHub::GcTcpHub(CanHubFlow *can_hub, int port, unsigned num_threads)
     : canHub_(can_hub)
+    , executors_(create_executors(num_threads))
+    , services_(create_services(executors_))
     , tcpListener_(port, std::bind(&GcTcpHub::OnNewConnection, this,
                                    std::placeholders::_1))
 {
@@ -55,4 +120,19 @@ GcTcpHub::GcTcpHub(CanHubFlow *can_hub, int port)
 GcTcpHub::~GcTcpHub()
 {
     tcpListener_.shutdown();
+    {
+        OSMutexLock h(&lock_);
+        if (connections_.empty())
+        {
+            return;
+        }
+        shuttingDown_ = true;
+        // The ports see an EOF or error on their socket and start their
+        // own shutdown sequence, which unregisters them from the CAN hub.
+        for (Connection *c : connections_)
+        {
+            ::shutdown(c->fd_, SHUT_RDWR);
+        }
+    }
+    allClosed_.wait();
 }
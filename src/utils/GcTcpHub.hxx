@@ -34,15 +34,27 @@
 #ifndef _UTILS_GCTCPHUB_HXX_
 #define _UTILS_GCTCPHUB_HXX_
 
+#include <memory>
+#include <vector>
+
+#include "os/OS.hxx"
 #include "utils/socket_listener.hxx"
 #include "utils/Hub.hxx"
 
 class ExecutorBase;
+class Service;
 
 /** This class runs a CAN-bus HUB listening on TCP socket using the gridconnect
  * format. Any new incoming connection will be wired into the same virtual CAN
  * hub. All packets will be forwarded to every participant, without
- * loopback. */
+ * loopback.
+ *
+ * Optionally the hub can use a pool of threads: every incoming connection is
+ * then assigned (round-robin) to one of the pool's executors, which performs
+ * the socket I/O and the GridConnect parsing and formatting for that
+ * connection. Only the routing of the binary frames remains on the executor
+ * of the CAN hub. This allows the throughput of a hub with many connections
+ * to scale with the number of CPU cores. */
 class GcTcpHub
 {
 public:
@@ -51,7 +63,14 @@ public:
     /// @param can_hub Which CAN-hub should we attach the TCP gridconnect hub
     /// onto.
     /// @param port TCp port number to listen on.
-    GcTcpHub(CanHubFlow *can_hub, int port);
+    /// @param num_threads if non-zero, this many executors (threads) will be
+    /// started for handling the connections. If zero, all connections are
+    /// handled on the executor of can_hub.
+    GcTcpHub(CanHubFlow *can_hub, int port, unsigned num_threads = 0);
+
+    /// Stops listening, closes all connections that are still open and
+    /// waits until their ports are removed from the CAN hub. Must not be
+    /// called on the executor of the CAN hub.
     ~GcTcpHub();
 
     /// @return true of the listener is ready to accept incoming connections.
@@ -61,16 +80,56 @@ public:
     }
 
 private:
+    /// One connection accepted by this hub.
+    class Connection : public Notifiable
+    {
+    public:
+        /// @param parent is the hub. @param fd is a duplicate of the
+        /// connection's socket, owned by *this.
+        Connection(GcTcpHub *parent, int fd)
+            : parent_(parent)
+            , fd_(fd)
+        {
+        }
+
+        /// Called when the port of the connection is shut down.
+        void notify() OVERRIDE;
+
+        /// Hub that accepted the connection.
+        GcTcpHub *parent_;
+        /// Duplicate of the socket. The port closes its own descriptor when
+        /// it exits; this one stays valid until then, so shutting it down
+        /// cannot hit an unrelated, reused descriptor.
+        int fd_;
+    };
+
     /// Callback when a new connection arrives.
     ///
     /// @param fd filedes of the freshly established incoming connection.
     ///
     void OnNewConnection(int fd);
 
+    /// Protects connections_ and shuttingDown_.
+    OSMutex lock_;
+    /// Connections whose port is still running.
+    std::vector<Connection *> connections_;
+    /// Posted when the last connection exits during the destructor.
+    OSSem allClosed_;
+    /// True when the destructor is waiting for the connections.
+    bool shuttingDown_{false};
+
     /// @param can_hub Which CAN-hub should we attach the TCP gridconnect hub
     /// onto.
     CanHubFlow *canHub_;
-    /// Helper object representing the listening on the socket.
+    /// Executors of the thread pool for the connections. Empty if all
+    /// connections run on the executor of canHub_.
+    std::vector<std::unique_ptr<ExecutorBase>> executors_;
+    /// One service for each entry in executors_.
+    std::vector<std::unique_ptr<Service>> services_;
+    /// Which entry of services_ the next incoming connection goes to.
+    unsigned nextService_{0};
+    /// Helper object representing the listening on the socket. Must be last,
+    /// because it calls OnNewConnection from a separate thread.
     SocketListener tcpListener_;
 };
 
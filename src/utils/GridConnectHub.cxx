@@ -57,9 +57,11 @@ public:
     /// @param can_side A hub of type struct can_frame, the binary side.
     /// @param double_bytes if true, upon rendering data each byte will be
     /// doubled. This is an anciant workaround.
-    GCAdapter(HubFlow *gc_side, CanHubFlow *can_side, bool double_bytes)
-        : parser_(can_side->service(), can_side, &formatter_)
-        , formatter_(can_side->service(), gc_side, &parser_, double_bytes)
+    /// @param service which executor to run the parsing and formatting on.
+    GCAdapter(HubFlow *gc_side, CanHubFlow *can_side, bool double_bytes,
+        Service *service)
+        : parser_(service, can_side, &formatter_)
+        , formatter_(service, gc_side, &parser_, double_bytes)
     {
         gc_side->register_port(&parser_);
         can_side->register_port(&formatter_);
@@ -237,15 +239,11 @@ public:
         /// frames. @return next state.
         Action parse_more_data()
         {
-            while (inBufSize_--)
+            if (streamSegmenter_.consume_data(&inBuf_, &inBufSize_))
             {
-                char c = *inBuf_++;
-                if (streamSegmenter_.consume_byte(c))
-                {
-                    // End of frame. Allocate an output buffer and parse the
-                    // frame.
-                    return allocate_and_call(destination_, STATE(parse_to_output_frame), frameAllocator_.get());
-                }
+                // End of frame. Allocate an output buffer and parse the
+                // frame.
+                return allocate_and_call(destination_, STATE(parse_to_output_frame), frameAllocator_.get());
             }
             // Will notify the caller.
             return release_and_exit();
@@ -301,10 +299,13 @@ private:
 };
 
 GCAdapterBase *GCAdapterBase::CreateGridConnectAdapter(HubFlow *gc_side,
-                                                       CanHubFlow *can_side,
-                                                       bool double_bytes)
+    CanHubFlow *can_side, bool double_bytes, Service *service)
 {
-    return new GCAdapter(gc_side, can_side, double_bytes);
+    if (!service)
+    {
+        service = can_side->service();
+    }
+    return new GCAdapter(gc_side, can_side, double_bytes, service);
 }
 
 GCAdapterBase *GCAdapterBase::CreateGridConnectAdapter(HubFlow *gc_side_read,
@@ -394,10 +395,14 @@ struct GcHubPort : public Executable
     /// experiences an error (typically upon device closed or connection lost).
     /// @param use_select true if fd can be used with select, false if threads
     /// are needed.
-    GcHubPort(CanHubFlow *can_hub, int fd, Notifiable *on_exit, bool use_select)
-        : gcHub_(can_hub->service())
-        , bridge_(
-              GCAdapterBase::CreateGridConnectAdapter(&gcHub_, can_hub, false))
+    /// @param port_service if not null, the executor to run the gridconnect
+    /// conversion and the device I/O on.
+    GcHubPort(CanHubFlow *can_hub, int fd, Notifiable *on_exit, bool use_select,
+        Service *port_service)
+        : gcHub_(port_service ? port_service : can_hub->service())
+        , bridge_(GCAdapterBase::CreateGridConnectAdapter(
+              &gcHub_, can_hub, false, gcHub_.service()))
+        , canExecutor_(can_hub->service()->executor())
         , onExit_(on_exit)
     {
         LOG(VERBOSE, "gchub port %p", (Executable *)this);
@@ -428,9 +433,24 @@ struct GcHubPort : public Executable
      * fd. Similarly, listens to the fd and sends the read charcters to the
      * char-hub. */
     std::unique_ptr<FdHubPortInterface> gcWrite_;
+    /** Executor of the CAN hub. If this is different from the executor of
+     * gcHub_, the shutdown needs to synchronize with it. */
+    ExecutorBase *canExecutor_;
     /** If not null, this notifiable will be called when the device is
      * closed. */
     Notifiable* onExit_;
+    /** Progress of the shutdown when the CAN hub runs on a different executor
+     * than this port. */
+    enum
+    {
+        /// Unregistering from the hubs and draining the port's flows.
+        SHUTDOWN_DRAIN,
+        /// Waiting for the CAN hub's executor to finish the step that might
+        /// have been running concurrently with unregistering.
+        SHUTDOWN_CAN_SYNC,
+        /// Draining the port's flows again after the CAN hub is synchronized.
+        SHUTDOWN_FINAL
+    } shutdownState_{SHUTDOWN_DRAIN};
 
     /** Callback in case the connection is closed due to error. */
     void notify() OVERRIDE
@@ -444,10 +464,25 @@ struct GcHubPort : public Executable
 
     void run() OVERRIDE
     {
+        ExecutorBase *port_executor = gcHub_.service()->executor();
+        if (shutdownState_ == SHUTDOWN_CAN_SYNC)
+        {
+            // We are on the CAN hub's executor now, so any dispatch that might
+            // still have seen our formatter as registered has completed.
+            shutdownState_ = SHUTDOWN_FINAL;
+            port_executor->add(this);
+            return;
+        }
         if (!bridge_->shutdown() || !gcHub_.is_waiting())
         {
             // Yield.
-            gcHub_.service()->executor()->add(this);
+            port_executor->add(this);
+            return;
+        }
+        if (shutdownState_ == SHUTDOWN_DRAIN && canExecutor_ != port_executor)
+        {
+            shutdownState_ = SHUTDOWN_CAN_SYNC;
+            canExecutor_->add(this);
             return;
         }
         LOG(INFO, "GCHubPort: Shutting down gridconnect port %d. (%p)",
@@ -464,8 +499,8 @@ struct GcHubPort : public Executable
     }
 };
 
-void create_gc_port_for_can_hub(
-    CanHubFlow *can_hub, int fd, Notifiable *on_exit, bool use_select)
+void create_gc_port_for_can_hub(CanHubFlow *can_hub, int fd,
+    Notifiable *on_exit, bool use_select, Service *port_service)
 {
-    new GcHubPort(can_hub, fd, on_exit, use_select);
+    new GcHubPort(can_hub, fd, on_exit, use_select, port_service);
 }
@@ -57,8 +57,8 @@ public:
 
     /// Unregisters *this from the pipes.
     /// @return true if it is safe to destroy *this. It is OK to call this
-    /// multiple times. It should be called on the executor of the CAN side
-    /// service. */
+    /// multiple times. It should be called on the executor of the bridge's
+    /// service (by default the CAN side service). */
     virtual bool shutdown() = 0;
 
     /**
@@ -77,12 +77,16 @@ public:
        @param double_bytes if true, any frame rendered into the GC protocol
        will have their characters doubled.
 
+       @param service if not null, the parsing and formatting will be
+       performed on this service's executor instead of the executor of
+       can_side. This allows spreading the GridConnect conversion of multiple
+       ports over multiple threads.
+
        @return a pointer to the created object. It can be deleted, which will
        terminate the link and unregister the link members from both pipes.
     */
     static GCAdapterBase *CreateGridConnectAdapter(HubFlow *gc_side,
-                                                   CanHubFlow *can_side,
-                                                   bool double_bytes);
+        CanHubFlow *can_side, bool double_bytes, Service *service = nullptr);
 
     /// Creates a gridconnect-CAN bridge with separate pipes for reading
     /// (parsing) from the GC side and writing (formatting) to the GC side. */
@@ -135,8 +139,14 @@ private:
  * @param on_exit is a notifiable (may be null) which will be called in case
  * an error is encountered on this port and the port is subsequently closed.
  * @param use_select when true, the FD will be used with select, when false,
- * separate threads will be started with blocking read and write calls. */
+ * separate threads will be started with blocking read and write calls.
+ * @param port_service if not null, the port's I/O and GridConnect
+ * parsing/formatting will run on this service's executor; only the routing of
+ * the binary frames remains on the executor of can_hub. Packets between the
+ * two executors are handed off via the executors' queues, which keeps the
+ * order of packets of each port. */
 void create_gc_port_for_can_hub(CanHubFlow *can_hub, int fd,
-    Notifiable *on_exit = nullptr, bool use_select = false);
+    Notifiable *on_exit = nullptr, bool use_select = false,
+    Service *port_service = nullptr);
 
 #endif //_UTILS_GRIDCONNECTHUB_HXX_
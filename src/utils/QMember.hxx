@@ -73,6 +73,8 @@ protected:
     /** ActiveTimers needs to iterate through the queue. */
     friend class ExecutorBase;
     friend class TimerTest;
+    /** Lock-free queues link the members with atomic operations. */
+    template <unsigned> friend class QListLockFree;
 };
 
 #endif /* _UTILS_QMEMBER_HXX_ */
@@ -79,10 +79,23 @@ void Q::insert_locked(QMember *item, unsigned index)
 Q::Result Q::next()
 {
     AtomicHolder h(this);
-    if (head == NULL)
+    QMember *qm = next_locked();
+    if (qm == NULL)
     {
         return Result();
     }
+    return Result(qm, 0);
+}
+
+/** Get an item from the front of the queue. Needs external locking.
+ * @return item retrieved from queue, NULL if no item available
+ */
+QMember *Q::next_locked()
+{
+    if (head == NULL)
+    {
+        return NULL;
+    }
     --count;
     QMember *qm = head;
     if (head == tail)
@@ -92,7 +105,7 @@ Q::Result Q::next()
     head = (qm->next);
     qm->next = NULL;
 
-    return Result(qm, 0);
+    return qm;
 }
 
 /** Add an item to the back of the queue.
@@ -312,6 +312,11 @@ public:
      */
     Result next() override;
 
+    /** Get an item from the front of the queue. Needs external locking.
+     * @return item retrieved from queue, NULL if no item available
+     */
+    QMember *next_locked();
+
     /** Get the number of pending items in the queue.
      * @param index in the list to operate on
      * @return number of pending items in the queue
@@ -1004,4 +1009,245 @@ private:
     DISALLOW_COPY_AND_ASSIGN(QListProtectedWait);
 };
 
+#if defined(__linux__) || defined(__MACH__)
+/// Enables QListLockFree, which needs the atomic builtins and sched_yield of
+/// the host.
+#define QLIST_LOCKFREE
+#include <sched.h>
+
+/** A list of queues that many threads can insert into without taking a lock,
+ * and one thread (the consumer) takes items out of. Index 0 is the highest
+ * priority queue.
+ *
+ * Each priority band is an intrusive multi-producer single-consumer queue:
+ * an insert is one atomic exchange and one store, and taking out an item
+ * needs no atomic read-modify-write at all. The consumer-side calls (next,
+ * wait, timedwait) must all happen on the same thread; pending and empty may
+ * be called from any thread.
+ *
+ * There is no blocking wait: the consumer is expected to sleep elsewhere,
+ * like the Executor does in epoll_wait, and be woken up by the inserters.
+ */
+template <unsigned items> class QListLockFree : public QInterface
+{
+public:
+    QListLockFree()
+    {
+        for (unsigned i = 0; i < items; ++i)
+        {
+            lanes_[i].head = &lanes_[i].stub;
+            lanes_[i].tail = &lanes_[i].stub;
+        }
+    }
+
+    /** Add an item to the back of the queue. May be called from any thread.
+     * @param item item to add to queue
+     * @param index in the list to operate on
+     */
+    void insert(QMember *item, unsigned index) override
+    {
+        if (index >= items)
+        {
+            index = items - 1;
+        }
+        Lane *l = &lanes_[index];
+        // Counted first, so that the queue never looks empty while an
+        // insert is in progress.
+        __atomic_add_fetch(&l->count, 1, __ATOMIC_SEQ_CST);
+        push(l, item);
+    }
+
+    /** Get an item from the front of the queue. Consumer thread only.
+     * @param index in the list to operate on
+     * @return item retrieved from queue, NULL if no item available
+     */
+    QMember *next(unsigned index) override
+    {
+        Lane *l = &lanes_[index];
+        if (!__atomic_load_n(&l->count, __ATOMIC_SEQ_CST))
+        {
+            return nullptr;
+        }
+        QMember *ret;
+        while ((ret = pop(l)) == nullptr)
+        {
+            // An inserter was preempted between its two steps. It is done
+            // with the hard part, so give it the CPU.
+            sched_yield();
+        }
+        __atomic_sub_fetch(&l->count, 1, __ATOMIC_SEQ_CST);
+        // Like the other queues, hands out the member unlinked. Nobody
+        // writes this field any more: pop() returns a member only after its
+        // successor was linked.
+        ret->next = nullptr;
+        return ret;
+    }
+
+    /** Get an item from the front of the queue in priority order. Consumer
+     * thread only.
+     * @return item retrieved from queue + index, NULL if no item available
+     */
+    Result next() override
+    {
+        for (unsigned i = 0; i < items; ++i)
+        {
+            QMember *result = next(i);
+            if (result)
+            {
+                return Result(result, i);
+            }
+        }
+        return Result();
+    }
+
+    /** Get an item from the front of the queue. Does not block, because the
+     * sleeping happens outside of this queue.
+     * @return item retrieved from queue, else NULL with errno set:
+     *         EINTR - woken up asynchronously
+     */
+    Result wait()
+    {
+        Result result = next();
+        if (result.item == NULL)
+        {
+            errno = EINTR;
+        }
+        return result;
+    }
+
+    /** Get an item from the front of the queue. Does not block, because the
+     * sleeping happens outside of this queue.
+     * @param timeout ignored
+     * @return item retrieved from queue, else NULL with errno set:
+     *         EINTR - woken up asynchronously
+     */
+    Result timedwait(long long timeout)
+    {
+        return wait();
+    }
+
+    /** Get the number of pending items in the queue.
+     * @param index in the list to operate on
+     * @return number of pending items in the queue
+     */
+    size_t pending(unsigned index) override
+    {
+        return __atomic_load_n(&lanes_[index].count, __ATOMIC_SEQ_CST);
+    }
+
+    /** Get the total number of pending items in all queues in the list.
+     * @return number of total pending items in all queues in the list
+     */
+    size_t pending() override
+    {
+        size_t result = 0;
+        for (unsigned i = 0; i < items; ++i)
+        {
+            result += pending(i);
+        }
+        return result;
+    }
+
+    /** Test if the queue is empty.
+     * @param index in the list to operate on
+     * @return true if empty, else false
+     */
+    bool empty(unsigned index) override
+    {
+        return pending(index) == 0;
+    }
+
+    /** Test if all the queues are empty.
+     * @return true if empty (all lists), else false
+     */
+    bool empty() override
+    {
+        for (unsigned i = 0; i < items; ++i)
+        {
+            if (pending(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    /// Placeholder member that keeps the list of a lane non-empty.
+    struct Stub : public QMember
+    {
+    };
+
+    /// One priority band.
+    struct Lane
+    {
+        /// Last inserted member. Written by the inserters.
+        QMember *head;
+        /// Number of items in the lane.
+        size_t count{0};
+        /// Keeps the consumer's data off the cache line the inserters write.
+        char padding[64 - sizeof(QMember *) - sizeof(size_t)];
+        /// First member, to be taken out next. Used by the consumer only.
+        QMember *tail;
+        /// Placeholder member.
+        Stub stub;
+    };
+
+    /// Appends a member to a lane. @param l is the lane. @param item is the
+    /// member to append.
+    static void push(Lane *l, QMember *item)
+    {
+        __atomic_store_n(&item->next, nullptr, __ATOMIC_RELAXED);
+        QMember *prev = __atomic_exchange_n(&l->head, item, __ATOMIC_ACQ_REL);
+        // Between the exchange and this store the list is broken; pop()
+        // sees this as an empty list.
+        __atomic_store_n(&prev->next, item, __ATOMIC_RELEASE);
+    }
+
+    /// Takes the first member out of a lane.
+    /// @param l is the lane.
+    /// @return the member, or nullptr if the lane is empty or an insert is in
+    /// progress.
+    static QMember *pop(Lane *l)
+    {
+        QMember *tail = l->tail;
+        QMember *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (tail == &l->stub)
+        {
+            if (!next)
+            {
+                return nullptr;
+            }
+            l->tail = next;
+            tail = next;
+            next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+        }
+        if (next)
+        {
+            l->tail = next;
+            return tail;
+        }
+        if (tail != __atomic_load_n(&l->head, __ATOMIC_ACQUIRE))
+        {
+            return nullptr;
+        }
+        // tail is the last member; puts the stub behind it so that it can be
+        // taken out.
+        push(l, &l->stub);
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (next)
+        {
+            l->tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    /// The priority bands.
+    Lane lanes_[items];
+
+    DISALLOW_COPY_AND_ASSIGN(QListLockFree);
+};
+#endif // defined(__linux__) || defined(__MACH__)
+
 #endif /* _UTILS_QUEUE_HXX_ */
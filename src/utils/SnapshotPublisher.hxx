@@ -0,0 +1,241 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file SnapshotPublisher.hxx
+ *
+ * RCU-style publication of immutable snapshots with epoch-based reclamation.
+ *
+ * @author Balazs Racz
+ * @date 18 Oct 2026
+ */
+
+#ifndef _UTILS_SNAPSHOTPUBLISHER_HXX_
+#define _UTILS_SNAPSHOTPUBLISHER_HXX_
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "utils/macros.h"
+
+/// Base class of the snapshots managed by a SnapshotPublisher. Copying a
+/// snapshot does not copy its reference count.
+struct PublishedSnapshot
+{
+    PublishedSnapshot()
+    {
+    }
+
+    PublishedSnapshot(const PublishedSnapshot &)
+    {
+    }
+
+    PublishedSnapshot &operator=(const PublishedSnapshot &)
+    {
+        return *this;
+    }
+
+    /// Number of readers that acquired this snapshot. Accessed with atomic
+    /// operations.
+    unsigned snapshotRefs_{0};
+};
+
+/// Publishes immutable snapshots of a data structure to readers that do not
+/// take any lock.
+///
+/// The writer builds a new snapshot under its own lock and calls
+/// publish_locked(). The old snapshot is retired, and freed once no reader
+/// can see it anymore. Readers come in two flavors:
+///
+/// - pin() / unpin() bracket a short read-side critical section. They cost
+///   two atomic operations on a counter selected by the parity of the
+///   current epoch. The epoch is only advanced when there are no readers
+///   left that registered in the epoch before the current one. Thus by the
+///   time the epoch moved two steps after a snapshot was retired, every
+///   pinned reader that could have loaded it is gone.
+///
+/// - acquire() / release() hold a snapshot for an unbounded time (e.g. an
+///   iteration that yields to other work). The snapshot is pinned only while
+///   its reference count is incremented, so long-held snapshots do not stop
+///   the epoch. Retired snapshots are freed once they are two epochs old and
+///   their reference count is zero. Thus the number of retired snapshots
+///   that stay allocated is bounded by the number of concurrent acquire()
+///   holders plus two, no matter how many snapshots are published in the
+///   meantime.
+///
+/// All methods with the _locked suffix, current_locked() and for_each() must
+/// be called with the writer's lock held.
+///
+/// @param T is the snapshot type; it must derive from PublishedSnapshot.
+template <class T> class SnapshotPublisher
+{
+public:
+    /// @param initial is the first snapshot. Ownership is transferred.
+    SnapshotPublisher(T *initial)
+        : current_(initial)
+    {
+    }
+
+    ~SnapshotPublisher()
+    {
+        HASSERT(readers_[0] == 0 && readers_[1] == 0);
+        HASSERT(current_->snapshotRefs_ == 0);
+        delete current_;
+        for (auto &r : retired_)
+        {
+            HASSERT(r.second->snapshotRefs_ == 0);
+            delete r.second;
+        }
+    }
+
+    /// Enters a short read-side critical section.
+    /// @param slot will be set to the readers_ entry the caller is counted
+    /// in.
+    /// @return the current snapshot, which stays valid until unpin is called.
+    T *pin(unsigned *slot)
+    {
+        unsigned e;
+        while (true)
+        {
+            e = __atomic_load_n(&epoch_, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&readers_[e & 1], 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&epoch_, __ATOMIC_SEQ_CST) == e)
+            {
+                break;
+            }
+            // The epoch moved on while we were registering; the writer may
+            // not have seen us.
+            __atomic_sub_fetch(&readers_[e & 1], 1, __ATOMIC_SEQ_CST);
+        }
+        *slot = e & 1;
+        return __atomic_load_n(&current_, __ATOMIC_SEQ_CST);
+    }
+
+    /// Leaves a read-side critical section.
+    /// @param slot is what pin returned.
+    void unpin(unsigned slot)
+    {
+        __atomic_sub_fetch(&readers_[slot], 1, __ATOMIC_SEQ_CST);
+    }
+
+    /// Takes a reference to the current snapshot.
+    /// @return the current snapshot, which stays valid until release is
+    /// called.
+    T *acquire()
+    {
+        unsigned slot;
+        T *s = pin(&slot);
+        __atomic_add_fetch(&s->snapshotRefs_, 1, __ATOMIC_SEQ_CST);
+        unpin(slot);
+        return s;
+    }
+
+    /// Drops a reference taken by acquire.
+    /// @param s is what acquire returned.
+    void release(T *s)
+    {
+        __atomic_sub_fetch(&s->snapshotRefs_, 1, __ATOMIC_SEQ_CST);
+    }
+
+    /// @return the current snapshot.
+    T *current_locked()
+    {
+        return current_;
+    }
+
+    /// Makes a new snapshot current, retires the old one, and frees the
+    /// retired snapshots that no reader can see anymore.
+    /// @param s is the new snapshot. Ownership is transferred.
+    void publish_locked(T *s)
+    {
+        retired_.emplace_back(epoch_, current_);
+        __atomic_store_n(&current_, s, __ATOMIC_SEQ_CST);
+        reclaim_locked();
+    }
+
+    /// Advances the epoch if possible, and frees the retired snapshots that
+    /// no reader can see anymore.
+    void reclaim_locked()
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            unsigned e = epoch_;
+            if (__atomic_load_n(&readers_[(e + 1) & 1], __ATOMIC_SEQ_CST))
+            {
+                break;
+            }
+            __atomic_store_n(&epoch_, e + 1, __ATOMIC_SEQ_CST);
+        }
+        auto dst = retired_.begin();
+        for (auto it = retired_.begin(); it != retired_.end(); ++it)
+        {
+            if (epoch_ - it->first >= 2 &&
+                !__atomic_load_n(&it->second->snapshotRefs_, __ATOMIC_SEQ_CST))
+            {
+                delete it->second;
+            }
+            else
+            {
+                *dst++ = *it;
+            }
+        }
+        retired_.erase(dst, retired_.end());
+    }
+
+    /// Calls a function on the current and every retired snapshot, e.g. to
+    /// update a flag that the readers check.
+    /// @param f is called with a T* argument.
+    template <class F> void for_each(F f)
+    {
+        f(current_);
+        for (auto &r : retired_)
+        {
+            f(r.second);
+        }
+    }
+
+    /// @return the number of retired snapshots that are not freed yet.
+    size_t num_retired_locked()
+    {
+        return retired_.size();
+    }
+
+private:
+    /// The current snapshot. Never null.
+    T *current_;
+    /// Old snapshots that may still be used by a reader, with the epoch in
+    /// which they were retired. Ordered by epoch.
+    std::vector<std::pair<unsigned, T *>> retired_;
+    /// Current epoch of the snapshot reclamation.
+    unsigned epoch_{0};
+    /// Number of pinned readers, by the parity of the epoch they registered
+    /// in.
+    unsigned readers_[2] = {0, 0};
+
+    DISALLOW_COPY_AND_ASSIGN(SnapshotPublisher);
+};
+
+#endif // _UTILS_SNAPSHOTPUBLISHER_HXX_
@@ -436,15 +436,20 @@ protected:
 
     void wait_for_event_thread()
     {
-        while (EventService::instance->event_processing_pending())
+        do
         {
+            while (EventService::instance->event_processing_pending())
+            {
 #ifdef __EMSCRIPTEN__
-            os_emscripten_yield();
+                os_emscripten_yield();
 #else
-            usleep(100);
+                usleep(100);
 #endif
-        }
-        AsyncIfTest::wait();
+            }
+            AsyncIfTest::wait();
+            // With parallel event dispatch the main executor may have handed
+            // new handler calls to the dispatch threads in the meantime.
+        } while (EventService::instance->event_processing_pending());
     }
 
     EventService eventService_;
@@ -40,20 +40,37 @@
 
 extern "C" {
 
+/// Uppercase hex digits, indexed by nibble value.
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+/// Value of hex digits (both upper and lowercase), indexed by the character
+/// code. -1 for characters that are not hex digits.
+static const int8_t NIBBLE_VALUE[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
 /** Build an ASCII character representation of a nibble value (uppercase hex).
  * @param nibble to convert
  * @return converted value
  */
-static char nibble_to_ascii(int nibble)
+static inline char nibble_to_ascii(int nibble)
 {
-    nibble &= 0xf;
-
-    if (nibble < 10)
-    {
-        return ('0' + nibble);
-    }
-    
-    return ('A' + (nibble - 10));
+    return HEX_DIGITS[nibble & 0xf];
 }
 
 /** Tries to parse a hex character to a nibble. Understands both upper and
@@ -61,24 +78,27 @@ static char nibble_to_ascii(int nibble)
     @param c is the character to convert.
     @return a converted value, or -1 if an invalid character was encountered.
 */
-static int ascii_to_nibble(const char c)
+static inline int ascii_to_nibble(const char c)
 {
-    if ('0' <= c && '9' >= c)
-    {
-        return c - '0';
-    }
-    else if ('A' <= c && 'F' >= c)
-    {
-        return c - 'A' + 10;
-    }
-    else if ('a' <= c && 'f' >= c)
+    return NIBBLE_VALUE[(uint8_t)c];
+}
+
+/** Appends the hex representation of a number to a buffer.
+ * @param dst is the output buffer.
+ * @param value is the number to format.
+ * @param digits is how many (least significant) nibbles to output.
+ * @return the pointer after the last character written.
+ */
+static inline char *format_hex(char *dst, uint32_t value, int digits)
+{
+    for (int i = digits - 1; i >= 0; --i)
     {
-        return c - 'a' + 10;
+        dst[i] = nibble_to_ascii(value);
+        value >>= 4;
     }
-    return -1;
+    return dst + digits;
 }
 
-
 int gc_format_parse(const char* buf, struct can_frame* can_frame)
 {
     CLR_CAN_FRAME_ERR(*can_frame);
@@ -138,42 +158,23 @@ int gc_format_parse(const char* buf, struct can_frame* can_frame)
     int index = 0;
     while (*buf)
     {
-        int nh = ascii_to_nibble(*buf++);
-        int nl = ascii_to_nibble(*buf++);
-        if (nh < 0 || nl < 0)
+        // If buf[0] is the last character, buf[1] is the terminating zero,
+        // which gives an error.
+        int nh = ascii_to_nibble(buf[0]);
+        int nl = ascii_to_nibble(buf[1]);
+        if ((nh | nl) < 0 || index >= 8)
         {
             SET_CAN_FRAME_ERR(*can_frame);
             return -1;
         }
         can_frame->data[index++] = (nh << 4) | nl;
+        buf += 2;
     } // while parsing data
     can_frame->can_dlc = index;
     CLR_CAN_FRAME_ERR(*can_frame);
     return 0;
 }
 
-/// Helper function for appending to a buffer ONCE.
-///
-/// @param dst buffer to append data to
-/// @param value one character to append to.
-///
-static void output_single(char*& dst, char value)
-{
-    *dst++ = value;
-}
-
-/// Helper function for appending to a buffer TWICE. Used in the implementation
-/// of the double-byte gridconnect output protocol.
-///
-/// @param dst buffer to append data to
-/// @param value one character to append to.
-///
-static void output_double(char*& dst, char value)
-{
-    *dst++ = value;
-    *dst++ = value;
-}
-
 /** Formats a can frame in the GridConnect protocol.
 
     If requested, it can create the double protocol with leading !!, trailing ;;
@@ -198,54 +199,40 @@ char* gc_format_generate(const struct can_frame* can_frame, char* buf, int doubl
         LOG(VERBOSE, "GC generate: incoming frame ERR.");
         return buf;
     }
-    void (*output)(char*& dst, char value);
-    if (double_format)
-    {
-        output = output_double;
-        output(buf, '!');
-    }
-    else
-    {
-        output = output_single;
-        output(buf, ':');
-    }
-    uint32_t id;
-    int offset;
+    char *p = buf;
+    *p++ = ':';
     if (IS_CAN_FRAME_EFF(*can_frame))
     {
-        id = GET_CAN_FRAME_ID_EFF(*can_frame);
-        output(buf, 'X');
-        offset = 28;
+        *p++ = 'X';
+        p = format_hex(p, GET_CAN_FRAME_ID_EFF(*can_frame), 8);
     }
     else
     {
-        id = GET_CAN_FRAME_ID(*can_frame);
-        output(buf, 'S');
-        offset = 8;
-    }
-    for (;offset >= 0; offset -= 4)
-    {
-        output(buf, nibble_to_ascii((id >> offset) & 0xf));
+        *p++ = 'S';
+        p = format_hex(p, GET_CAN_FRAME_ID(*can_frame), 3);
     }
     /* handle remote or normal */
-    if (IS_CAN_FRAME_RTR(*can_frame))
+    *p++ = IS_CAN_FRAME_RTR(*can_frame) ? 'R' : 'N';
+    for (int i = 0; i < can_frame->can_dlc; ++i)
     {
-        output(buf, 'R');
+        p = format_hex(p, can_frame->data[i], 2);
     }
-    else
-    {
-        output(buf, 'N');
+    *p++ = ';';
+    if (config_gc_generate_newlines()) {
+        *p++ = '\n';
     }
-    for (offset = 0; offset < can_frame->can_dlc; ++offset)
+    if (!double_format)
     {
-        output(buf, nibble_to_ascii(can_frame->data[offset] >> 4));
-        output(buf, nibble_to_ascii(can_frame->data[offset] & 0xf));
+        return p;
     }
-    output(buf, ';');
-    if (config_gc_generate_newlines()) {
-        output(buf, '\n');
+    // Expands the single format in place, starting from the end.
+    buf[0] = '!';
+    int len = p - buf;
+    for (int i = len - 1; i >= 0; --i)
+    {
+        buf[2 * i] = buf[2 * i + 1] = buf[i];
     }
-    return buf;
+    return buf + 2 * len;
 }
 
 }
@@ -79,6 +79,35 @@ extern os_mutex_t g_log_mutex;
 #define GLOBAL_LOG_OUTPUT log_output
 #endif
 
+#if defined(__cplusplus) && (defined(__linux__) || defined(__MACH__)) &&     \
+    !defined(__EMSCRIPTEN__)
+#define ASYNC_LOGGING
+/// Outputs the pending deferred log messages. Set while a deferred logger
+/// (see @ref AsyncLogger) is active, otherwise null.
+extern void (*g_log_flush_async)();
+/// Outputs the pending deferred log messages, so that they precede a fatal
+/// message.
+#define LOG_FLUSH_ASYNC()                                                      \
+    do                                                                         \
+    {                                                                          \
+        if (g_log_flush_async)                                                 \
+        {                                                                      \
+            g_log_flush_async();                                               \
+        }                                                                      \
+    } while (0)
+#else
+/// Deferred logging is not available on this platform.
+#define LOG_FLUSH_ASYNC()                                                      \
+    do                                                                         \
+    {                                                                          \
+    } while (0)
+#endif
+
+/// Hands off a log message to the deferred logger. Redefined by
+/// utils/AsyncLogging.hxx; without that header messages are rendered right
+/// away. @return true if the message was taken care of.
+#define LOG_ASYNC(level, message...) 0
+
 #ifdef __FreeRTOS__
 #define LOG_MAYBE_DIE(level) (level == FATAL)
 #else
@@ -103,10 +132,11 @@ extern os_mutex_t g_log_mutex;
         }                                                                      \
         else if (level == FATAL)                                               \
         {                                                                      \
+            LOG_FLUSH_ASYNC();                                                 \
             fprintf(stderr, message);                                          \
             abort();                                                           \
         }                                                                      \
-        else if (LOGLEVEL >= level)                                            \
+        else if (LOGLEVEL >= level && !LOG_ASYNC(level, message))              \
         {                                                                      \
             LOCK_LOG;                                                          \
             int sret = snprintf(logbuffer, sizeof(logbuffer), message);        \